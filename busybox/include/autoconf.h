@@ -3688,14 +3688,10 @@
 #define ENABLE_FREE 0
 #define IF_FREE(...)
 #define IF_NOT_FREE(...) __VA_ARGS__
-#define CONFIG_FUSER 1
-#define ENABLE_FUSER 1
-#ifdef MAKE_SUID
-# define IF_FUSER(...) __VA_ARGS__ "CONFIG_FUSER"
-#else
-# define IF_FUSER(...) __VA_ARGS__
-#endif
-#define IF_NOT_FUSER(...)
+#undef CONFIG_FUSER
+#define ENABLE_FUSER 0
+#define IF_FUSER(...)
+#define IF_NOT_FUSER(...) __VA_ARGS__
 #undef CONFIG_KILL
 #define ENABLE_KILL 0
 #define IF_KILL(...)
@@ -3728,14 +3724,10 @@
 #define ENABLE_PKILL 0
 #define IF_PKILL(...)
 #define IF_NOT_PKILL(...) __VA_ARGS__
-#define CONFIG_PS 1
-#define ENABLE_PS 1
-#ifdef MAKE_SUID
-# define IF_PS(...) __VA_ARGS__ "CONFIG_PS"
-#else
-# define IF_PS(...) __VA_ARGS__
-#endif
-#define IF_NOT_PS(...)
+#undef CONFIG_PS
+#define ENABLE_PS 0
+#define IF_PS(...)
+#define IF_NOT_PS(...) __VA_ARGS__
 #define CONFIG_FEATURE_PS_WIDE 1
 #define ENABLE_FEATURE_PS_WIDE 1
 #ifdef MAKE_SUID
@@ -76,6 +76,12 @@ typedef struct archive_handle_t {
 	/* Count processed bytes */
 	off_t offset;
 
+	/* changed for ofgwrite: read buffer of src_fd, see archive_buffer.c */
+	char *ofg_buf;
+	unsigned ofg_buf_pos;
+	unsigned ofg_buf_len;
+	off_t ofg_buf_read;
+
 	/* Archiver specific. Can make it a union if it ever gets big */
 #define PAX_NEXT_FILE 0
 #define PAX_GLOBAL    1
@@ -192,6 +198,16 @@ void seek_by_read(int fd, off_t amount) FAST_FUNC;
 const char *strip_unsafe_prefix(const char *str) FAST_FUNC;
 
 void data_align(archive_handle_t *archive_handle, unsigned boundary) FAST_FUNC;
+
+/* changed for ofgwrite: buffered archive input */
+#define archive_buf_ptr(archive_handle) ((archive_handle)->ofg_buf + (archive_handle)->ofg_buf_pos)
+#define archive_consume(archive_handle, n) ((archive_handle)->ofg_buf_pos += (n))
+unsigned archive_fill(archive_handle_t *archive_handle, unsigned len) FAST_FUNC;
+ssize_t archive_read(archive_handle_t *archive_handle, void *buf, size_t len) FAST_FUNC;
+void archive_xread(archive_handle_t *archive_handle, void *buf, size_t len) FAST_FUNC;
+void archive_copy(archive_handle_t *archive_handle, int dst_fd, off_t size) FAST_FUNC;
+void archive_skip(archive_handle_t *archive_handle, off_t amount) FAST_FUNC;
+off_t archive_rewind(archive_handle_t *archive_handle) FAST_FUNC;
 const llist_t *find_list_entry(const llist_t *list, const char *filename) FAST_FUNC;
 const llist_t *find_list_entry2(const llist_t *list, const char *filename) FAST_FUNC;
 
@@ -244,6 +260,9 @@ int bbunpack(char **argv,
 ) FAST_FUNC;
 
 void check_errors_in_children(int signo);
+/* changed for ofgwrite: pid of the last forked transformer (0: file isn't
+ * compressed), to reap it if its output isn't read to the end */
+extern pid_t transformer_pid;
 #if BB_MMU
 void fork_transformer(int fd,
 	int check_signature,
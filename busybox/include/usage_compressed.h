@@ -19,89 +19,60 @@
 "\157\146\040\143\171\154\151\156\144\145\162\163\057\150\145\141" \
 "\144\163\057\163\145\143\164\157\162\163\012\011\055\110\040\110" \
 "\105\101\104\123\012\011\055\123\040\123\105\103\124\117\122\123" \
-"\000\133\117\120\124\111\117\116\123\135\040\106\111\114\105\040" \
-"\157\162\040\120\117\122\124\057\120\122\117\124\117\012\012\106" \
-"\151\156\144\040\160\162\157\143\145\163\163\145\163\040\167\150" \
-"\151\143\150\040\165\163\145\040\106\111\114\105\163\040\157\162" \
-"\040\120\117\122\124\163\012\012\011\055\155\011\106\151\156\144" \
-"\040\160\162\157\143\145\163\163\145\163\040\167\150\151\143\150" \
-"\040\165\163\145\040\163\141\155\145\040\146\163\040\141\163\040" \
-"\106\111\114\105\163\012\011\055\064\054\055\066\011\123\145\141" \
-"\162\143\150\040\157\156\154\171\040\111\120\166\064\057\111\120" \
-"\166\066\040\163\160\141\143\145\012\011\055\163\011\104\157\156" \
-"\047\164\040\144\151\163\160\154\141\171\040\120\111\104\163\012" \
-"\011\055\153\011\113\151\154\154\040\146\157\165\156\144\040\160" \
-"\162\157\143\145\163\163\145\163\012\011\055\123\111\107\116\101" \
-"\114\011\123\151\147\156\141\154\040\164\157\040\163\145\156\144" \
-"\040\050\144\145\146\141\165\154\164\072\040\113\111\114\114\051" \
-"\000\012\012\123\150\157\167\040\154\151\163\164\040\157\146\040" \
-"\160\162\157\143\145\163\163\145\163\012\012\011\167\011\127\151" \
-"\144\145\040\157\165\164\160\165\164\012\011\154\011\114\157\156" \
-"\147\040\157\165\164\160\165\164\000\133\055\151\162\146\135\040" \
-"\106\111\114\105\056\056\056\012\012\122\145\155\157\166\145\040" \
-"\050\165\156\154\151\156\153\051\040\106\111\114\105\163\012\012" \
-"\011\055\151\011\101\154\167\141\171\163\040\160\162\157\155\160" \
-"\164\040\142\145\146\157\162\145\040\162\145\155\157\166\151\156" \
-"\147\012\011\055\146\011\116\145\166\145\162\040\160\162\157\155" \
-"\160\164\012\011\055\122\054\055\162\011\122\145\143\165\162\163" \
-"\145\000\055\133\170\164\152\166\117\135\040\133\055\146\040\124" \
-"\101\122\106\111\114\105\135\040\133\055\103\040\104\111\122\135" \
-"\040\133\106\111\114\105\135\056\056\056\012\012\105\170\164\162" \
-"\141\143\164\040\157\162\040\154\151\163\164\040\146\151\154\145" \
-"\163\040\146\162\157\155\040\141\040\164\141\162\040\146\151\154" \
-"\145\012\012\117\160\145\162\141\164\151\157\156\072\012\011\170" \
-"\011\105\170\164\162\141\143\164\012\011\164\011\114\151\163\164" \
-"\012\011\146\011\116\141\155\145\040\157\146\040\124\101\122\106" \
-"\111\114\105\040\050\047\055\047\040\146\157\162\040\163\164\144" \
-"\151\156\057\157\165\164\051\012\011\103\011\103\150\141\156\147" \
-"\145\040\164\157\040\104\111\122\040\142\145\146\157\162\145\040" \
-"\157\160\145\162\141\164\151\157\156\012\011\166\011\126\145\162" \
-"\142\157\163\145\012\011\152\011\050\104\145\051\143\157\155\160" \
-"\162\145\163\163\040\165\163\151\156\147\040\142\172\151\160\062" \
-"\012\011\117\011\105\170\164\162\141\143\164\040\164\157\040\163" \
-"\164\144\157\165\164\000" \
+"\000\133\055\151\162\146\135\040\106\111\114\105\056\056\056\012" \
+"\012\122\145\155\157\166\145\040\050\165\156\154\151\156\153\051" \
+"\040\106\111\114\105\163\012\012\011\055\151\011\101\154\167\141" \
+"\171\163\040\160\162\157\155\160\164\040\142\145\146\157\162\145" \
+"\040\162\145\155\157\166\151\156\147\012\011\055\146\011\116\145" \
+"\166\145\162\040\160\162\157\155\160\164\012\011\055\122\054\055" \
+"\162\011\122\145\143\165\162\163\145\000\055\133\170\164\152\166" \
+"\117\135\040\133\055\146\040\124\101\122\106\111\114\105\135\040" \
+"\133\055\103\040\104\111\122\135\040\133\106\111\114\105\135\056" \
+"\056\056\012\012\105\170\164\162\141\143\164\040\157\162\040\154" \
+"\151\163\164\040\146\151\154\145\163\040\146\162\157\155\040\141" \
+"\040\164\141\162\040\146\151\154\145\012\012\117\160\145\162\141" \
+"\164\151\157\156\072\012\011\170\011\105\170\164\162\141\143\164" \
+"\012\011\164\011\114\151\163\164\012\011\146\011\116\141\155\145" \
+"\040\157\146\040\124\101\122\106\111\114\105\040\050\047\055\047" \
+"\040\146\157\162\040\163\164\144\151\156\057\157\165\164\051\012" \
+"\011\103\011\103\150\141\156\147\145\040\164\157\040\104\111\122" \
+"\040\142\145\146\157\162\145\040\157\160\145\162\141\164\151\157" \
+"\156\012\011\166\011\126\145\162\142\157\163\145\012\011\152\011" \
+"\050\104\145\051\143\157\155\160\162\145\163\163\040\165\163\151" \
+"\156\147\040\142\172\151\160\062\012\011\117\011\105\170\164\162" \
+"\141\143\164\040\164\157\040\163\164\144\157\165\164\000" \
 
 #define PACKED_USAGE \
-0150,0061,0061,0101,0131,0046,0123,0131,0027,0267,0243,0364,0000,0000,0337,0137, \
-0200,0100,0060,0100,0347,0325,0120,0057,0357,0335,0272,0077,0377,0337,0360,0100, \
-0002,0105,0073,0035,0166,0300,0064,0050,0144,0011,0223,0050,0323,0364,0115,0023, \
-0324,0364,0215,0251,0352,0036,0246,0041,0352,0031,0223,0024,0011,0104,0310,0215, \
-0065,0032,0247,0342,0145,0047,0351,0251,0075,0047,0232,0243,0040,0064,0323,0115, \
-0006,0203,0322,0003,0123,0021,0252,0036,0243,0117,0120,0000,0014,0200,0000,0000, \
-0000,0003,0121,0115,0352,0232,0036,0223,0106,0231,0031,0031,0064,0321,0223,0004, \
-0321,0243,0106,0046,0103,0106,0212,0266,0361,0272,0133,0260,0271,0347,0301,0025, \
-0307,0076,0031,0127,0317,0234,0120,0376,0007,0272,0367,0311,0025,0207,0216,0113, \
-0042,0214,0240,0132,0045,0355,0264,0304,0141,0245,0112,0154,0307,0127,0074,0226, \
-0034,0073,0167,0167,0066,0233,0126,0012,0314,0035,0125,0347,0260,0142,0167,0342, \
-0264,0013,0225,0174,0206,0162,0112,0233,0003,0013,0170,0024,0104,0343,0347,0266, \
-0337,0273,0151,0145,0146,0156,0333,0126,0027,0173,0171,0130,0304,0170,0111,0266, \
-0073,0144,0371,0324,0373,0134,0256,0275,0252,0115,0156,0024,0063,0124,0342,0064, \
-0061,0366,0124,0172,0065,0351,0020,0025,0266,0277,0156,0363,0063,0025,0251,0357, \
-0064,0207,0177,0032,0065,0277,0041,0342,0014,0314,0031,0326,0151,0301,0020,0314, \
-0311,0263,0011,0140,0025,0122,0377,0110,0273,0017,0324,0147,0250,0062,0337,0220, \
-0210,0360,0165,0220,0016,0220,0215,0041,0322,0154,0040,0116,0111,0204,0200,0244, \
-0155,0053,0035,0067,0121,0320,0126,0022,0030,0316,0144,0320,0167,0110,0037,0146, \
-0003,0021,0144,0314,0010,0172,0105,0200,0016,0064,0060,0227,0215,0241,0120,0324, \
-0276,0255,0200,0163,0025,0310,0376,0230,0357,0164,0247,0355,0360,0142,0343,0167, \
-0116,0064,0113,0351,0064,0306,0342,0157,0230,0251,0033,0147,0103,0164,0312,0013, \
-0042,0033,0263,0224,0226,0262,0265,0110,0110,0245,0237,0201,0342,0100,0234,0204, \
-0353,0025,0166,0171,0077,0323,0266,0346,0112,0121,0247,0324,0153,0357,0371,0242, \
-0215,0257,0146,0125,0166,0221,0223,0102,0262,0025,0226,0333,0341,0171,0023,0355, \
-0336,0124,0356,0205,0300,0003,0157,0201,0305,0031,0020,0012,0050,0261,0011,0216, \
-0320,0142,0016,0004,0352,0137,0112,0003,0001,0203,0204,0104,0135,0072,0233,0246, \
-0047,0052,0067,0107,0114,0223,0111,0370,0220,0262,0121,0175,0273,0317,0052,0313, \
-0244,0134,0244,0330,0051,0323,0157,0055,0064,0125,0112,0267,0304,0315,0110,0006, \
-0123,0020,0236,0000,0052,0025,0263,0150,0214,0150,0140,0315,0252,0107,0012,0142, \
-0147,0021,0060,0242,0164,0325,0030,0037,0321,0272,0071,0050,0144,0241,0101,0055, \
-0207,0233,0126,0177,0350,0344,0266,0105,0360,0076,0230,0105,0330,0331,0262,0065, \
-0342,0060,0200,0112,0062,0066,0021,0143,0106,0346,0125,0014,0126,0220,0146,0205, \
-0227,0246,0241,0000,0135,0124,0164,0354,0136,0210,0207,0001,0125,0052,0114,0041, \
-0236,0261,0075,0206,0244,0364,0162,0337,0163,0111,0304,0122,0206,0122,0014,0027, \
-0021,0135,0040,0214,0061,0055,0366,0050,0132,0243,0244,0214,0152,0202,0223,0313, \
-0021,0361,0156,0346,0171,0130,0321,0322,0346,0045,0315,0162,0272,0026,0332,0215, \
-0222,0225,0203,0136,0313,0064,0025,0040,0150,0347,0015,0321,0251,0364,0244,0171, \
-0306,0305,0211,0056,0252,0025,0257,0134,0213,0325,0261,0330,0054,0216,0056,0226, \
-0045,0203,0046,0144,0256,0303,0132,0253,0013,0335,0125,0060,0356,0077,0315,0271, \
-0135,0115,0325,0014,0376,0033,0322,0073,0150,0057,0043,0376,0056,0344,0212,0160, \
-0241,0040,0057,0157,0107,0350, \
+0150,0061,0061,0101,0131,0046,0123,0131,0150,0027,0257,0124,0000,0000,0233,0137, \
+0200,0100,0060,0100,0347,0324,0120,0057,0157,0235,0072,0077,0377,0337,0360,0100, \
+0001,0246,0340,0351,0103,0123,0052,0176,0224,0323,0322,0003,0117,0121,0240,0000, \
+0365,0000,0007,0251,0241,0350,0100,0065,0117,0102,0236,0123,0305,0064,0365,0075, \
+0100,0332,0236,0243,0115,0000,0000,0000,0032,0150,0105,0074,0123,0106,0240,0144, \
+0146,0220,0150,0031,0006,0152,0172,0043,0040,0150,0304,0011,0115,0115,0023,0044, \
+0152,0176,0243,0041,0064,0144,0046,0324,0320,0362,0232,0146,0223,0365,0001,0066, \
+0241,0303,0074,0044,0174,0357,0254,0305,0000,0362,0303,0361,0321,0367,0013,0236, \
+0313,0005,0050,0241,0110,0211,0145,0345,0045,0042,0312,0215,0051,0364,0061,0067, \
+0146,0062,0140,0016,0132,0114,0127,0205,0005,0064,0040,0167,0071,0013,0155,0021, \
+0340,0025,0124,0252,0032,0307,0234,0270,0242,0030,0316,0271,0056,0107,0064,0321, \
+0017,0011,0221,0215,0306,0203,0007,0115,0104,0037,0047,0102,0124,0225,0255,0162, \
+0200,0203,0156,0132,0111,0337,0024,0011,0372,0002,0042,0002,0302,0046,0021,0044, \
+0263,0050,0175,0103,0156,0353,0264,0257,0261,0313,0003,0304,0342,0131,0063,0334, \
+0270,0326,0316,0114,0337,0037,0161,0303,0023,0147,0261,0300,0340,0172,0016,0130, \
+0251,0152,0331,0025,0317,0016,0141,0036,0254,0114,0240,0132,0173,0061,0374,0062, \
+0115,0310,0067,0306,0006,0065,0225,0327,0235,0372,0105,0033,0154,0274,0255,0013, \
+0213,0005,0131,0111,0115,0242,0176,0310,0042,0116,0067,0150,0251,0363,0343,0361, \
+0131,0265,0162,0275,0070,0033,0374,0031,0020,0352,0217,0230,0360,0133,0213,0016, \
+0071,0211,0030,0361,0045,0030,0217,0305,0066,0120,0163,0270,0164,0144,0164,0373, \
+0314,0016,0250,0103,0046,0125,0212,0234,0066,0132,0371,0350,0332,0074,0305,0110, \
+0276,0134,0017,0237,0103,0226,0152,0164,0353,0257,0146,0277,0124,0213,0042,0167, \
+0243,0240,0050,0000,0334,0202,0233,0362,0266,0201,0205,0157,0170,0273,0003,0071, \
+0200,0124,0305,0155,0117,0304,0213,0305,0155,0225,0377,0106,0222,0052,0202,0155, \
+0156,0212,0264,0164,0216,0024,0202,0200,0223,0375,0334,0040,0051,0051,0363,0011, \
+0266,0355,0104,0101,0372,0004,0232,0115,0135,0133,0073,0216,0332,0120,0257,0342, \
+0116,0043,0114,0114,0312,0361,0134,0320,0147,0162,0315,0326,0326,0004,0132,0302, \
+0371,0301,0031,0314,0023,0352,0347,0176,0113,0101,0055,0162,0334,0043,0131,0141, \
+0003,0211,0221,0007,0126,0261,0063,0120,0165,0240,0051,0141,0045,0102,0103,0210, \
+0357,0140,0044,0210,0240,0056,0103,0111,0250,0257,0144,0144,0136,0147,0377,0103, \
+0072,0072,0342,0370,0353,0152,0025,0353,0077,0342,0356,0110,0247,0012,0022,0015, \
+0002,0365,0352,0200, \
 
@@ -0,0 +1,127 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+
+/* changed for ofgwrite: buffered reading of the archive stream.
+ *
+ * Header parser, data skipping and extraction share one large buffer in
+ * the archive handle, so a small entry costs no syscall for reading at all
+ * and headers are parsed in place. Reading from the decompressor pipe is
+ * done with the whole free buffer space at once.
+ */
+
+#include <fcntl.h>
+#include "libbb.h"
+#include "bb_archive.h"
+
+#define ARCHIVE_BUF_SIZE  (256 * 1024)
+#define ARCHIVE_PIPE_SIZE (1024 * 1024)
+
+/* Makes at least len bytes (len <= ARCHIVE_BUF_SIZE) available at
+ * archive_buf_ptr(). Returns the number of available bytes, which is only
+ * less than len at the end of the stream. Pointers into the buffer are
+ * invalid after the next fill.
+ */
+unsigned FAST_FUNC archive_fill(archive_handle_t *archive_handle, unsigned len)
+{
+	unsigned avail = archive_handle->ofg_buf_len - archive_handle->ofg_buf_pos;
+
+	if (avail >= len)
+		return avail;
+
+	if (!archive_handle->ofg_buf) {
+		archive_handle->ofg_buf = xmalloc(ARCHIVE_BUF_SIZE);
+#ifdef F_SETPIPE_SZ
+		/* fewer wakeups of the decompressor; fails harmlessly for files */
+		fcntl(archive_handle->src_fd, F_SETPIPE_SZ, ARCHIVE_PIPE_SIZE);
+#endif
+	}
+	memmove(archive_handle->ofg_buf, archive_handle->ofg_buf + archive_handle->ofg_buf_pos, avail);
+	archive_handle->ofg_buf_pos = 0;
+	archive_handle->ofg_buf_len = avail;
+
+	while (archive_handle->ofg_buf_len < len) {
+		ssize_t rd = safe_read(archive_handle->src_fd,
+				archive_handle->ofg_buf + archive_handle->ofg_buf_len,
+				ARCHIVE_BUF_SIZE - archive_handle->ofg_buf_len);
+		if (rd < 0)
+			bb_perror_msg_and_die(bb_msg_read_error);
+		if (rd == 0)
+			break;
+		archive_handle->ofg_buf_len += rd;
+		archive_handle->ofg_buf_read += rd;
+	}
+	return archive_handle->ofg_buf_len;
+}
+
+/* Like full_read() */
+ssize_t FAST_FUNC archive_read(archive_handle_t *archive_handle, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		unsigned n = archive_fill(archive_handle, 1);
+		if (n == 0)
+			break;
+		if (n > len - done)
+			n = len - done;
+		memcpy((char *)buf + done, archive_buf_ptr(archive_handle), n);
+		archive_consume(archive_handle, n);
+		done += n;
+	}
+	return done;
+}
+
+void FAST_FUNC archive_xread(archive_handle_t *archive_handle, void *buf, size_t len)
+{
+	if (archive_read(archive_handle, buf, len) != len)
+		bb_error_msg_and_die("short read");
+}
+
+/* Writes size bytes of the stream to dst_fd (-1: discard) without copying
+ * them out of the buffer first.
+ */
+void FAST_FUNC archive_copy(archive_handle_t *archive_handle, int dst_fd, off_t size)
+{
+	while (size > 0) {
+		unsigned n = archive_fill(archive_handle, 1);
+		if (n == 0)
+			bb_error_msg_and_die("short read");
+		if (n > size)
+			n = size;
+		if (dst_fd >= 0)
+			xwrite(dst_fd, archive_buf_ptr(archive_handle), n);
+		archive_consume(archive_handle, n);
+		size -= n;
+	}
+}
+
+void FAST_FUNC archive_skip(archive_handle_t *archive_handle, off_t amount)
+{
+	unsigned avail = archive_handle->ofg_buf_len - archive_handle->ofg_buf_pos;
+
+	if (amount <= avail) {
+		archive_consume(archive_handle, amount);
+		return;
+	}
+	archive_consume(archive_handle, avail);
+	amount -= avail;
+	/* stream position is behind the buffer: seekable input can jump */
+	if (archive_handle->seek == seek_by_jump)
+		archive_handle->seek(archive_handle->src_fd, amount);
+	else
+		archive_copy(archive_handle, -1, amount);
+}
+
+/* Seeks the input back to where the buffer was filled from. Returns 0 if
+ * that is the start of the stream.
+ */
+off_t FAST_FUNC archive_rewind(archive_handle_t *archive_handle)
+{
+	off_t pos = lseek(archive_handle->src_fd, -archive_handle->ofg_buf_read, SEEK_CUR);
+
+	archive_handle->ofg_buf_pos = archive_handle->ofg_buf_len = 0;
+	archive_handle->ofg_buf_read = 0;
+	return pos;
+}
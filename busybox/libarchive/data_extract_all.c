@@ -3,6 +3,9 @@
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 
+// changed for ofgwrite
+#include "../ofgwrite.h"
+
 #include "libbb.h"
 #include "bb_archive.h"
 
@@ -12,6 +15,12 @@ void FAST_FUNC data_extract_all(archive_handle_t *archive_handle)
 	int dst_fd;
 	int res;
 
+	// changed for ofgwrite: entry was extracted before the flash was interrupted
+	if (journal_tar_skip()) {
+		data_skip(archive_handle);
+		return;
+	}
+
 #if ENABLE_FEATURE_TAR_SELINUX
 	char *sctx = archive_handle->tar__sctx[PAX_NEXT_FILE];
 	if (!sctx)
@@ -120,7 +129,8 @@ void FAST_FUNC data_extract_all(archive_handle_t *archive_handle)
 			flags,
 			file_header->mode
 			);
-		bb_copyfd_exact_size(archive_handle->src_fd, dst_fd, file_header->size);
+		archive_copy(archive_handle, dst_fd, file_header->size); // changed for ofgwrite
+		io_target_done(dst_fd); // changed for ofgwrite
 		close(dst_fd);
 #ifdef ARCHIVE_REPLACE_VIA_RENAME
 		if (archive_handle->ah_flags & ARCHIVE_REPLACE_VIA_RENAME) {
@@ -204,6 +214,7 @@ void FAST_FUNC data_extract_all(archive_handle_t *archive_handle)
 	}
 
  ret: ;
+	journal_tar_entry(); // changed for ofgwrite
 #if ENABLE_FEATURE_TAR_SELINUX
 	if (sctx) {
 		/* reset the context after creating an entry */
@@ -8,7 +8,7 @@
 
 void FAST_FUNC data_extract_to_stdout(archive_handle_t *archive_handle)
 {
-	bb_copyfd_exact_size(archive_handle->src_fd,
+	archive_copy(archive_handle, // changed for ofgwrite
 			STDOUT_FILENO,
 			archive_handle->file_header->size);
 }
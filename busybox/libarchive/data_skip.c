@@ -8,5 +8,5 @@
 
 void FAST_FUNC data_skip(archive_handle_t *archive_handle)
 {
-	archive_handle->seek(archive_handle->src_fd, archive_handle->file_header->size);
+	archive_skip(archive_handle, archive_handle->file_header->size); // changed for ofgwrite
 }
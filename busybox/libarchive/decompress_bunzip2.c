@@ -137,6 +137,7 @@ static unsigned get_bits(bunzip_data *bd, int bits_wanted)
 			bd->inbufCount = read(bd->in_fd, bd->inbuf, IOBUF_SIZE);
 			if (bd->inbufCount <= 0)
 				longjmp(bd->jmpbuf, RETVAL_UNEXPECTED_INPUT_EOF);
+			io_source_read(bd->in_fd, bd->inbufCount); // changed for ofgwrite
 			bd->inbufPos = 0;
 			// changed for ofgwrite
 			bz2_current_pos += bd->inbufCount;
@@ -146,6 +147,7 @@ static unsigned get_bits(bunzip_data *bd, int bits_wanted)
 				set_step_progress(bz2_new_percent);
 				bz2_current_percent = bz2_new_percent;
 			}
+			telemetry_progress(rootfs_device, bz2_current_pos, rootfs_file_stat.st_size);
 		}
 
 		/* Avoid 32-bit overflow (dump bit buffer to top of output) */
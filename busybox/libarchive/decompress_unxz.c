@@ -75,6 +75,7 @@ unpack_xz_stream(transformer_state_t *xstate)
 	while (1) {
 		if (iobuf.in_pos == iobuf.in_size) {
 			int rd = safe_read(xstate->src_fd, membuf, BUFSIZ);
+			io_source_read(xstate->src_fd, rd); // changed for ofgwrite
 			if (rd < 0) {
 				bb_error_msg(bb_msg_read_error);
 				total = -1;
@@ -92,6 +93,7 @@ unpack_xz_stream(transformer_state_t *xstate)
 				set_step_progress(xz_new_percent);
 				xz_current_percent = xz_new_percent;
 			}
+			telemetry_progress(rootfs_device, xz_current_pos, rootfs_file_stat.st_size);
 		}
 		if (xz_result == XZ_STREAM_END) {
 			/*
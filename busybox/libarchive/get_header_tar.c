@@ -68,7 +68,7 @@ static void process_pax_hdr(archive_handle_t *archive_handle, unsigned sz, int g
 
 	blk_sz = (sz + 511) & (~511);
 	p = buf = xmalloc(blk_sz + 1);
-	xread(archive_handle->src_fd, buf, blk_sz);
+	archive_xread(archive_handle, buf, blk_sz); // changed for ofgwrite
 	archive_handle->offset += blk_sz;
 
 	/* prevent bb_strtou from running off the buffer */
@@ -133,7 +133,7 @@ static void process_pax_hdr(archive_handle_t *archive_handle, unsigned sz, int g
 char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 {
 	file_header_t *file_header = archive_handle->file_header;
-	struct tar_header_t tar;
+	struct tar_header_t *tar; /* changed for ofgwrite: parsed in place in the read buffer */
 	char *cp;
 	int i, sum_u, sum;
 #if ENABLE_FEATURE_TAR_OLDSUN_COMPATIBILITY
@@ -159,9 +159,9 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
  again_after_align:
 
 #if ENABLE_DESKTOP || ENABLE_FEATURE_TAR_AUTODETECT
-	/* to prevent misdetection of bz2 sig */
-	*(aliased_uint32_t*)&tar = 0;
-	i = full_read(archive_handle->src_fd, &tar, 512);
+	i = archive_fill(archive_handle, 512);
+	if (i > 512)
+		i = 512;
 	/* If GNU tar sees EOF in above read, it says:
 	 * "tar: A lone zero block at N", where N = kilobyte
 	 * where EOF was met (not EOF block, actual EOF!),
@@ -181,18 +181,21 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 
 #else
 	i = 512;
-	xread(archive_handle->src_fd, &tar, i);
+	if (archive_fill(archive_handle, i) < i)
+		bb_error_msg_and_die("short read");
 #endif
+	tar = (struct tar_header_t *)archive_buf_ptr(archive_handle);
+	archive_consume(archive_handle, i);
 	archive_handle->offset += i;
 
 	/* If there is no filename its an empty header */
-	if (tar.name[0] == 0 && tar.prefix[0] == 0) {
+	if (tar->name[0] == 0 && tar->prefix[0] == 0) {
 		if (archive_handle->tar__end) {
 			/* Second consecutive empty header - end of archive.
 			 * Read until the end to empty the pipe from gz or bz2
 			 */
-			while (full_read(archive_handle->src_fd, &tar, 512) == 512)
-				continue;
+			while (archive_fill(archive_handle, 1) != 0)
+				archive_consume(archive_handle, archive_handle->ofg_buf_len - archive_handle->ofg_buf_pos);
 			return EXIT_FAILURE; /* "end of archive" */
 		}
 		archive_handle->tar__end = 1;
@@ -202,16 +205,16 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 
 	/* Check header has valid magic, "ustar" is for the proper tar,
 	 * five NULs are for the old tar format  */
-	if (!is_prefixed_with(tar.magic, "ustar")
+	if (!is_prefixed_with(tar->magic, "ustar")
 	 && (!ENABLE_FEATURE_TAR_OLDGNU_COMPATIBILITY
-	     || memcmp(tar.magic, "\0\0\0\0", 5) != 0)
+	     || memcmp(tar->magic, "\0\0\0\0", 5) != 0)
 	) {
 #if ENABLE_FEATURE_TAR_AUTODETECT
  autodetect:
 		/* Two different causes for lseek() != 0:
 		 * unseekable fd (would like to support that too, but...),
 		 * or not first block (false positive, it's not .gz/.bz2!) */
-		if (lseek(archive_handle->src_fd, -i, SEEK_CUR) != 0)
+		if (archive_rewind(archive_handle) != 0)
 			goto err;
 		if (setup_unzip_on_fd(archive_handle->src_fd, /*fail_if_not_compressed:*/ 0) != 0)
  err:
@@ -227,85 +230,85 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 	 * Sun and HP-UX gets it wrong... more details in
 	 * GNU tar source. */
 #if ENABLE_FEATURE_TAR_OLDSUN_COMPATIBILITY
-	sum_s = ' ' * sizeof(tar.chksum);
+	sum_s = ' ' * sizeof(tar->chksum);
 #endif
-	sum_u = ' ' * sizeof(tar.chksum);
+	sum_u = ' ' * sizeof(tar->chksum);
 	for (i = 0; i < 148; i++) {
-		sum_u += ((unsigned char*)&tar)[i];
+		sum_u += ((unsigned char*)tar)[i];
 #if ENABLE_FEATURE_TAR_OLDSUN_COMPATIBILITY
-		sum_s += ((signed char*)&tar)[i];
+		sum_s += ((signed char*)tar)[i];
 #endif
 	}
 	for (i = 156; i < 512; i++) {
-		sum_u += ((unsigned char*)&tar)[i];
+		sum_u += ((unsigned char*)tar)[i];
 #if ENABLE_FEATURE_TAR_OLDSUN_COMPATIBILITY
-		sum_s += ((signed char*)&tar)[i];
+		sum_s += ((signed char*)tar)[i];
 #endif
 	}
 	/* This field does not need special treatment (getOctal) */
 	{
 		char *endp; /* gcc likes temp var for &endp */
-		sum = strtoul(tar.chksum, &endp, 8);
+		sum = strtoul(tar->chksum, &endp, 8);
 		if ((*endp != '\0' && *endp != ' ')
 		 || (sum_u != sum IF_FEATURE_TAR_OLDSUN_COMPATIBILITY(&& sum_s != sum))
 		) {
 			bb_error_msg_and_die("invalid tar header checksum");
 		}
 	}
-	/* don't use xstrtoul, tar.chksum may have leading spaces */
-	sum = strtoul(tar.chksum, NULL, 8);
+	/* don't use xstrtoul, tar->chksum may have leading spaces */
+	sum = strtoul(tar->chksum, NULL, 8);
 	if (sum_u != sum IF_FEATURE_TAR_OLDSUN_COMPATIBILITY(&& sum_s != sum)) {
 		bb_error_msg_and_die("invalid tar header checksum");
 	}
 
 	/* 0 is reserved for high perf file, treat as normal file */
-	if (!tar.typeflag) tar.typeflag = '0';
-	parse_names = (tar.typeflag >= '0' && tar.typeflag <= '7');
+	if (!tar->typeflag) tar->typeflag = '0';
+	parse_names = (tar->typeflag >= '0' && tar->typeflag <= '7');
 
 	/* getOctal trashes subsequent field, therefore we call it
 	 * on fields in reverse order */
-	if (tar.devmajor[0]) {
-		char t = tar.prefix[0];
+	if (tar->devmajor[0]) {
+		char t = tar->prefix[0];
 		/* we trash prefix[0] here, but we DO need it later! */
-		unsigned minor = GET_OCTAL(tar.devminor);
-		unsigned major = GET_OCTAL(tar.devmajor);
+		unsigned minor = GET_OCTAL(tar->devminor);
+		unsigned major = GET_OCTAL(tar->devmajor);
 		file_header->device = makedev(major, minor);
-		tar.prefix[0] = t;
+		tar->prefix[0] = t;
 	}
 	file_header->link_target = NULL;
-	if (!p_linkname && parse_names && tar.linkname[0]) {
-		file_header->link_target = xstrndup(tar.linkname, sizeof(tar.linkname));
+	if (!p_linkname && parse_names && tar->linkname[0]) {
+		file_header->link_target = xstrndup(tar->linkname, sizeof(tar->linkname));
 		/* FIXME: what if we have non-link object with link_target? */
 		/* Will link_target be free()ed? */
 	}
 #if ENABLE_FEATURE_TAR_UNAME_GNAME
-	file_header->tar__uname = tar.uname[0] ? xstrndup(tar.uname, sizeof(tar.uname)) : NULL;
-	file_header->tar__gname = tar.gname[0] ? xstrndup(tar.gname, sizeof(tar.gname)) : NULL;
+	file_header->tar__uname = tar->uname[0] ? xstrndup(tar->uname, sizeof(tar->uname)) : NULL;
+	file_header->tar__gname = tar->gname[0] ? xstrndup(tar->gname, sizeof(tar->gname)) : NULL;
 #endif
-	file_header->mtime = GET_OCTAL(tar.mtime);
-	file_header->size = GET_OCTAL(tar.size);
-	file_header->gid = GET_OCTAL(tar.gid);
-	file_header->uid = GET_OCTAL(tar.uid);
+	file_header->mtime = GET_OCTAL(tar->mtime);
+	file_header->size = GET_OCTAL(tar->size);
+	file_header->gid = GET_OCTAL(tar->gid);
+	file_header->uid = GET_OCTAL(tar->uid);
 	/* Set bits 0-11 of the files mode */
-	file_header->mode = 07777 & GET_OCTAL(tar.mode);
+	file_header->mode = 07777 & GET_OCTAL(tar->mode);
 
 	file_header->name = NULL;
 	if (!p_longname && parse_names) {
 		/* we trash mode[0] here, it's ok */
-		//tar.name[sizeof(tar.name)] = '\0'; - gcc 4.3.0 would complain
-		tar.mode[0] = '\0';
-		if (tar.prefix[0]) {
+		//tar->name[sizeof(tar->name)] = '\0'; - gcc 4.3.0 would complain
+		tar->mode[0] = '\0';
+		if (tar->prefix[0]) {
 			/* and padding[0] */
-			//tar.prefix[sizeof(tar.prefix)] = '\0'; - gcc 4.3.0 would complain
-			tar.padding[0] = '\0';
-			file_header->name = concat_path_file(tar.prefix, tar.name);
+			//tar->prefix[sizeof(tar->prefix)] = '\0'; - gcc 4.3.0 would complain
+			tar->padding[0] = '\0';
+			file_header->name = concat_path_file(tar->prefix, tar->name);
 		} else
-			file_header->name = xstrdup(tar.name);
+			file_header->name = xstrdup(tar->name);
 	}
 
 	/* Set bits 12-15 of the files mode */
 	/* (typeflag was not trashed because chksum does not use getOctal) */
-	switch (tar.typeflag) {
+	switch (tar->typeflag) {
 	case '1': /* hardlink */
 		/* we mark hardlinks as regular files with zero size and a link name */
 		file_header->mode |= S_IFREG;
@@ -354,7 +357,7 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 	case 'x': {	/* pax extended header */
 		if ((uoff_t)file_header->size > 0xfffff) /* paranoia */
 			goto skip_ext_hdr;
-		process_pax_hdr(archive_handle, file_header->size, (tar.typeflag == 'g'));
+		process_pax_hdr(archive_handle, file_header->size, (tar->typeflag == 'g'));
 		goto again_after_align;
 #if ENABLE_FEATURE_TAR_GNU_EXTENSIONS
 /* See http://www.gnu.org/software/tar/manual/html_node/Extensions.html */
@@ -364,7 +367,7 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 		/* For paranoia reasons we allocate extra NUL char */
 		p_longname = xzalloc(file_header->size + 1);
 		/* We read ASCIZ string, including NUL */
-		xread(archive_handle->src_fd, p_longname, file_header->size);
+		archive_xread(archive_handle, p_longname, file_header->size);
 		archive_handle->offset += file_header->size;
 		/* return get_header_tar(archive_handle); */
 		/* gcc 4.1.1 didn't optimize it into jump */
@@ -373,7 +376,7 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
 	case 'K':
 		free(p_linkname);
 		p_linkname = xzalloc(file_header->size + 1);
-		xread(archive_handle->src_fd, p_linkname, file_header->size);
+		archive_xread(archive_handle, p_linkname, file_header->size);
 		archive_handle->offset += file_header->size;
 		/* return get_header_tar(archive_handle); */
 		goto again;
@@ -392,17 +395,15 @@ char FAST_FUNC get_header_tar(archive_handle_t *archive_handle)
  skip_ext_hdr:
 	{
 		off_t sz;
-		bb_error_msg("warning: skipping header '%c'", tar.typeflag);
+		bb_error_msg("warning: skipping header '%c'", tar->typeflag);
 		sz = (file_header->size + 511) & ~(off_t)511;
 		archive_handle->offset += sz;
-		sz >>= 9; /* sz /= 512 but w/o contortions for signed div */
-		while (sz--)
-			xread(archive_handle->src_fd, &tar, 512);
+		archive_skip(archive_handle, sz);
 		/* return get_header_tar(archive_handle); */
 		goto again_after_align;
 	}
 	default:
-		bb_error_msg_and_die("unknown typeflag: 0x%x", tar.typeflag);
+		bb_error_msg_and_die("unknown typeflag: 0x%x", tar->typeflag);
 	}
 
 #if ENABLE_FEATURE_TAR_GNU_EXTENSIONS
@@ -5,6 +5,7 @@
 
 #include "libbb.h"
 #include "bb_archive.h"
+#include "../ofgwrite.h" // changed for ofgwrite
 
 void FAST_FUNC init_transformer_state(transformer_state_t *xstate)
 {
@@ -99,6 +100,8 @@ void check_errors_in_children(int signo)
 	}
 }
 
+pid_t transformer_pid; // changed for ofgwrite
+
 /* transformer(), more than meets the eye */
 #if BB_MMU
 void FAST_FUNC fork_transformer(int fd,
@@ -151,6 +154,7 @@ void FAST_FUNC fork_transformer(int fd, const char *transform_prog)
 	}
 
 	/* parent process */
+	transformer_pid = pid; // changed for ofgwrite
 	close(fd_pipe.wr); /* don't want to write to the child */
 	xmove_fd(fd_pipe.rd, fd);
 }
@@ -231,7 +235,13 @@ static transformer_state_t *setup_transformer_on_fd(int fd, int fail_if_not_comp
 	 * an external unzipper that wants
 	 * file position at the start of the file.
 	 */
-	xlseek(fd, offset, SEEK_CUR);
+	// changed for ofgwrite: streams (image in zip archive) can't seek back
+	if (lseek(fd, offset, SEEK_CUR) < 0) {
+		fd = image_unread(fd, magic.b, -offset);
+		if (fd < 0)
+			bb_perror_msg_and_die("can't read image");
+		xstate->src_fd = fd;
+	}
 
  USE_FOR_MMU(found_magic:)
 	/* In MMU case, if magic was found, seeking back is not necessary */
@@ -265,7 +275,7 @@ static transformer_state_t *open_transformer(const char *fname, int fail_if_not_
 	transformer_state_t *xstate;
 	int fd;
 
-	fd = open(fname, O_RDONLY);
+	fd = image_open(fname); // changed for ofgwrite: image can be in a zip archive
 	if (fd < 0)
 		return NULL;
 
@@ -291,6 +301,7 @@ int FAST_FUNC open_zipped(const char *fname, int fail_if_not_compressed)
 	int fd;
 	transformer_state_t *xstate;
 
+	transformer_pid = 0; // changed for ofgwrite
 	xstate = open_transformer(fname, fail_if_not_compressed);
 	if (!xstate)
 		return -1;
@@ -285,8 +285,12 @@ void FAST_FUNC die_if_ferror_stdout(void)
 	die_if_ferror(stdout, bb_msg_standard_output);
 }
 
+// changed for ofgwrite
+void logger_flush(void);
+
 int FAST_FUNC fflush_all(void)
 {
+	logger_flush(); // changed for ofgwrite: queued messages first
 	return fflush(NULL);
 }
 
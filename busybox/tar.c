@@ -1209,11 +1209,14 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	}
 	if (ENABLE_FEATURE_CLEAN_UP /* && tar_handle->src_fd != STDIN_FILENO */)
 		close(tar_handle->src_fd);
+	free(tar_handle->ofg_buf); // changed for ofgwrite: tar_main runs more than once
 
 	if (SEAMLESS_COMPRESSION || OPT_COMPRESS) {
 		/* Set bb_got_signal to 1 if a child died with !0 exitcode */
 		check_errors_in_children(0);
 	}
+	if (!image_streams_ok()) // changed for ofgwrite: CRC error of a zip member
+		bb_got_signal = EXIT_FAILURE;
 
 	return bb_got_signal;
 }
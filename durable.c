@@ -0,0 +1,89 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* Commits exactly what ofgwrite wrote instead of calling sync().
+ *
+ * Writers register the filesystem (any path on it) or the block device they
+ * wrote to. A commit runs syncfs() on filesystems and fsync() on block
+ * devices and returns when the data is on the medium, so USB sticks and
+ * network mounts aren't flushed and no fixed sleeps are needed. MTD
+ * character devices are written without cache and are skipped.
+ */
+
+#define DURABLE_MAX_TARGETS 16
+
+static char durable_targets[DURABLE_MAX_TARGETS][1000];
+static int durable_cnt;
+
+static long long durable_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// remembers a filesystem path or block device for durable_commit()
+void durable_track(const char* path)
+{
+	int i;
+
+	for (i = 0; i < durable_cnt; i++)
+		if (strcmp(durable_targets[i], path) == 0)
+			return;
+	if (durable_cnt == DURABLE_MAX_TARGETS)
+	{
+		my_printf("Too many sync targets, ignoring %s\n", path);
+		return;
+	}
+	strncpy(durable_targets[durable_cnt], path, sizeof(durable_targets[0]) - 1);
+	durable_cnt++;
+}
+
+// flushes the filesystem containing path or the block device path
+int durable_sync(const char* path)
+{
+	struct stat st;
+	long long start = durable_now_ms();
+	int fd, ret;
+
+	if (stat(path, &st) != 0)
+	{
+		my_printf("Error syncing %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	if (S_ISCHR(st.st_mode))
+		return 1;
+
+	fd = open(path, O_RDONLY | (S_ISDIR(st.st_mode) ? O_DIRECTORY : 0));
+	if (fd < 0)
+	{
+		my_printf("Error syncing %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	ret = S_ISBLK(st.st_mode) ? fsync(fd) : syncfs(fd);
+	if (ret != 0)
+		my_printf("Error syncing %s: %s\n", path, strerror(errno));
+	else
+		my_printf("Synced %s in %lld ms\n", path, durable_now_ms() - start);
+	close(fd);
+	return ret == 0;
+}
+
+// flushes all tracked targets. Returns 1 if all of them were synced
+int durable_commit()
+{
+	int i, ret = 1;
+
+	for (i = 0; i < durable_cnt; i++)
+		if (!durable_sync(durable_targets[i]))
+			ret = 0;
+	return ret;
+}
@@ -9,6 +9,7 @@
 #include <linux/kd.h>
 #include <sys/ioctl.h>
 
+#include "ofgwrite.h"
 #include "font.h"
 
 #define TRANS "\x00\x00\x00\x00"
@@ -68,7 +69,7 @@ void blit()
 {
 	if (g_manual_blit == 1) {
 		if (ioctl(g_fbFd, FBIO_BLIT) < 0)
-			perror("FBIO_BLIT");
+			my_perror("FBIO_BLIT");
 	}
 }
 
@@ -76,7 +77,7 @@ void enableManualBlit()
 {
 	unsigned char tmp = 1;
 	if (ioctl(g_fbFd, FBIO_SET_MANUAL_BLIT, &tmp)<0)
-		perror("FBIO_SET_MANUAL_BLIT");
+		my_perror("FBIO_SET_MANUAL_BLIT");
 	else
 		g_manual_blit = 1;
 }
@@ -85,7 +86,7 @@ void disableManualBlit()
 {
 	unsigned char tmp = 0;
 	if (ioctl(g_fbFd, FBIO_SET_MANUAL_BLIT, &tmp)<0)
-		perror("FBIO_SET_MANUAL_BLIT");
+		my_perror("FBIO_SET_MANUAL_BLIT");
 	else
 		g_manual_blit = 0;
 }
@@ -177,13 +178,13 @@ int get_screeninfo()
 {
 	if (ioctl(g_fbFd, FBIOGET_VSCREENINFO, &g_screeninfo_var) < 0)
 	{
-		perror("FBIOGET_VSCREENINFO");
+		my_perror("FBIOGET_VSCREENINFO");
 		return 0;
 	}
 
 	if (ioctl(g_fbFd, FBIOGET_FSCREENINFO, &g_screeninfo_fix) < 0)
 	{
-		perror("FBIOGET_FSCREENINFO");
+		my_perror("FBIOGET_FSCREENINFO");
 		return 0;
 	}
 
@@ -198,7 +199,7 @@ int set_screeninfo()
 
 	if (ioctl(g_fbFd, FBIOPUT_VSCREENINFO, &g_screeninfo_var) < 0)
 	{
-		perror("Cannot set variable information");
+		my_perror("Cannot set variable information");
 		return 0;
 	}
 
@@ -210,7 +211,7 @@ int open_framebuffer()
 	g_fbFd = open(g_fbDevice, O_RDWR);
 	if (g_fbFd < 0)
 	{
-		perror(g_fbDevice);
+		my_perror(g_fbDevice);
 		goto nolfb;
 	}
 
@@ -243,7 +244,7 @@ int mmap_fb()
 	g_lfb = (unsigned char*)mmap(0, g_screeninfo_fix.smem_len, PROT_WRITE|PROT_READ, MAP_SHARED, g_fbFd, 0);
 	if (!g_lfb)
 	{
-		perror("mmap");
+		my_perror("mmap");
 		return 0;
 	}
 	return 1;
@@ -456,6 +457,8 @@ void set_step_text(char* str)
 
 void set_step(char* str)
 {
+	telemetry_step(str);
+	stats_phase(str);
 	if (g_fbFd == -1)
 		return;
 
@@ -492,6 +495,7 @@ void set_info_text(char* str)
 
 void set_error_text(char* str)
 {
+	telemetry_error(str);
 	if (g_fbFd == -1)
 		return;
 
@@ -514,6 +518,7 @@ void set_error_text(char* str)
 
 void set_error_text1(char* str)
 {
+	telemetry_error(str);
 	if (g_fbFd == -1)
 		return;
 
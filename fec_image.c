@@ -0,0 +1,521 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libfec.h>
+#include <mtd_swab.h>
+#include <crc32.h>
+
+/* FEC sidecar of an image file.
+ *
+ * "<image>.fec" beside a kernel or rootfs image holds the CRC32 of every
+ * chunk of the image and m parity chunks (libfec) for every stripe of k
+ * chunks. image_open() checks the image against it before anything is
+ * flashed. Chunks which are corrupted or can't be read are rebuilt from the
+ * rest of their stripe and the parity, and the flash backends get the
+ * repaired image instead of aborting in the middle of the flash.
+ * The result of the check is kept per image: an intact image isn't checked
+ * again, a repaired kernel is kept in memory and of a repaired rootfs only
+ * the bad stripes are rebuilt again on the next open.
+ *
+ * Layout (little endian): header, CRC32 of all data chunks followed by the
+ * CRC32 of all parity chunks, parity chunks stripe by stripe. The last chunk
+ * is padded with zeros for the parity.
+ */
+
+#define FEC_SIDECAR_SUFFIX ".fec"
+#define FEC_MAGIC          "OFGWFEC1"
+#define FEC_MAX_CHUNK      (1024 * 1024)
+#define FEC_MEMFD_MAX      (32 * 1024 * 1024)
+#define FEC_RESULT_CACHE   4
+
+struct fec_sidecar_header
+{
+	char magic[8];
+	uint32_t chunk_size;
+	uint16_t k;             // data chunks per stripe
+	uint16_t m;             // parity chunks per stripe
+	uint64_t image_size;
+	uint32_t reserved;
+	uint32_t hdr_crc;       // of the bytes before
+};
+
+struct fec_image
+{
+	int fd;
+	int sidecar_fd;
+	int chunk_size, k, m;
+	long long size, chunks, stripes;
+	off_t parity_offs;
+	uint32_t* crc;          // data chunks, then parity chunks
+	struct fec_parms* code;
+	unsigned char* data;    // k chunks of the current stripe
+	unsigned char* parity;  // m chunks
+	long long repaired;
+};
+
+// checked images
+struct fec_result
+{
+	struct stat st;
+	unsigned char* bad; // bitmap of the stripes to rebuild, NULL: intact
+	int memfd;          // repaired image in memory or -1
+};
+
+static struct fec_result fec_results[FEC_RESULT_CACHE];
+static int fec_result_cnt = 0;
+
+static int fec_pread(int fd, void* buf, int len, off_t offs)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		ssize_t ret = pread(fd, (char*)buf + done, len - done, offs + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static int fec_write(int fd, const void* buf, int len)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		ssize_t ret = write(fd, (const char*)buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static struct fec_result* fec_result_find(const struct stat* st)
+{
+	int i;
+
+	for (i = 0; i < fec_result_cnt; i++)
+		if (fec_results[i].st.st_dev == st->st_dev && fec_results[i].st.st_ino == st->st_ino
+		 && fec_results[i].st.st_size == st->st_size && fec_results[i].st.st_mtime == st->st_mtime)
+			return &fec_results[i];
+	return NULL;
+}
+
+// remembers the result of a check, bad is owned by the cache then
+static struct fec_result* fec_result_add(const struct stat* st, unsigned char* bad)
+{
+	struct fec_result* r;
+
+	if (fec_result_cnt == FEC_RESULT_CACHE)
+	{
+		free(bad);
+		return NULL;
+	}
+	r = &fec_results[fec_result_cnt++];
+	r->st = *st;
+	r->bad = bad;
+	r->memfd = -1;
+	return r;
+}
+
+// own file description of the repaired image in memory, read from the start
+static int fec_memfd_open(int memfd)
+{
+	char path[40];
+	int fd;
+
+	sprintf(path, "/proc/self/fd/%d", memfd);
+	fd = open(path, O_RDONLY);
+	if (fd < 0 && (fd = dup(memfd)) >= 0)
+		lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+static void fec_close(struct fec_image* f)
+{
+	if (f->code)
+		fec_free(f->code);
+	if (f->sidecar_fd >= 0)
+		close(f->sidecar_fd);
+	free(f->crc);
+	free(f->data);
+	free(f->parity);
+}
+
+// length of the image data in chunk (0 for the padding of the last stripe)
+static int fec_chunk_len(const struct fec_image* f, long long chunk)
+{
+	long long offs = chunk * f->chunk_size;
+
+	if (offs >= f->size)
+		return 0;
+	return f->size - offs < f->chunk_size ? f->size - offs : f->chunk_size;
+}
+
+/* Opens the sidecar of filename. Returns 0 if there is none or it doesn't
+ * belong to the image.
+ */
+static int fec_sidecar_open(const char* filename, int fd, const struct stat* st, struct fec_image* f)
+{
+	struct fec_sidecar_header hdr;
+	char path[1100];
+	long long i, crc_cnt;
+
+	memset(f, 0, sizeof(*f));
+	f->fd = fd;
+	snprintf(path, sizeof(path), "%s%s", filename, FEC_SIDECAR_SUFFIX);
+	f->sidecar_fd = open(path, O_RDONLY);
+	if (f->sidecar_fd < 0)
+		return 0;
+
+	if (!fec_pread(f->sidecar_fd, &hdr, sizeof(hdr), 0) || memcmp(hdr.magic, FEC_MAGIC, sizeof(hdr.magic)) != 0
+	 || mtd_crc32(UINT32_MAX, &hdr, offsetof(struct fec_sidecar_header, hdr_crc)) != le32_to_cpu(hdr.hdr_crc))
+	{
+		my_printf("FEC: %s is no valid sidecar, ignored\n", path);
+		fec_close(f);
+		return 0;
+	}
+	f->chunk_size = le32_to_cpu(hdr.chunk_size);
+	f->k = le16_to_cpu(hdr.k);
+	f->m = le16_to_cpu(hdr.m);
+	f->size = le64_to_cpu(hdr.image_size);
+	if (f->size != st->st_size || f->chunk_size <= 0 || f->chunk_size > FEC_MAX_CHUNK
+	 || f->k < 1 || f->m < 1 || f->k + f->m > 256)
+	{
+		my_printf("FEC: %s doesn't match %s, ignored\n", path, filename);
+		fec_close(f);
+		return 0;
+	}
+
+	f->chunks = (f->size + f->chunk_size - 1) / f->chunk_size;
+	f->stripes = (f->chunks + f->k - 1) / f->k;
+	crc_cnt = f->chunks + f->stripes * f->m;
+	f->parity_offs = sizeof(hdr) + crc_cnt * sizeof(uint32_t);
+	f->crc = malloc(crc_cnt * sizeof(uint32_t));
+	f->data = malloc((size_t)f->k * f->chunk_size);
+	f->parity = malloc((size_t)f->m * f->chunk_size);
+	f->code = f->crc && f->data && f->parity ? fec_new(f->k, f->k + f->m) : NULL;
+	if (f->code == NULL || !fec_pread(f->sidecar_fd, f->crc, crc_cnt * sizeof(uint32_t), sizeof(hdr)))
+	{
+		my_printf("FEC: error reading %s\n", path);
+		fec_close(f);
+		return 0;
+	}
+	for (i = 0; i < crc_cnt; i++)
+		f->crc[i] = le32_to_cpu(f->crc[i]);
+	return 1;
+}
+
+/* Reads stripe into f->data and rebuilds its bad chunks. Returns the number
+ * of rebuilt chunks, -1 if the stripe can't be repaired.
+ */
+static int fec_read_stripe(struct fec_image* f, long long stripe)
+{
+	unsigned char* pkt[256];
+	int index[256];
+	int i, j, len, bad = 0;
+
+	for (i = 0; i < f->k; i++)
+	{
+		long long chunk = stripe * f->k + i;
+		unsigned char* buf = f->data + (size_t)i * f->chunk_size;
+
+		len = fec_chunk_len(f, chunk);
+		memset(buf + len, 0, f->chunk_size - len);
+		if (len == 0 || (fec_pread(f->fd, buf, len, chunk * f->chunk_size) && mtd_crc32(UINT32_MAX, buf, len) == f->crc[chunk]))
+		{
+			pkt[i] = buf;
+			index[i] = i;
+		}
+		else
+		{
+			pkt[i] = NULL;
+			bad++;
+		}
+	}
+	if (bad == 0)
+		return 0;
+
+	// good parity chunks take the places of the bad data chunks
+	for (i = 0, j = 0; i < f->k; i++)
+	{
+		if (pkt[i])
+			continue;
+		for (; j < f->m && pkt[i] == NULL; j++)
+		{
+			long long pchunk = stripe * f->m + j;
+			unsigned char* buf = f->parity + (size_t)j * f->chunk_size;
+
+			if (fec_pread(f->sidecar_fd, buf, f->chunk_size, f->parity_offs + pchunk * f->chunk_size)
+			 && mtd_crc32(UINT32_MAX, buf, f->chunk_size) == f->crc[f->chunks + pchunk])
+			{
+				pkt[i] = buf;
+				index[i] = f->k + j;
+			}
+		}
+		if (pkt[i] == NULL)
+			return -1;
+	}
+	if (fec_decode(f->code, pkt, index, f->chunk_size) != 0)
+		return -1;
+
+	// decoded in place: pkt[i] is data chunk i now
+	for (i = 0; i < f->k; i++)
+	{
+		unsigned char* buf = f->data + (size_t)i * f->chunk_size;
+		long long chunk = stripe * f->k + i;
+
+		if (pkt[i] != buf)
+			memcpy(buf, pkt[i], f->chunk_size);
+		len = fec_chunk_len(f, chunk);
+		if (len && mtd_crc32(UINT32_MAX, buf, len) != f->crc[chunk])
+			return -1;
+	}
+	return bad;
+}
+
+// writes the repaired image to out_fd, only the stripes in bad are rebuilt
+static int fec_write_image(struct fec_image* f, const unsigned char* bad, int out_fd)
+{
+	long long stripe;
+
+	for (stripe = 0; stripe < f->stripes; stripe++)
+	{
+		long long offs = stripe * f->k * f->chunk_size;
+		long long len = f->size - offs < (long long)f->k * f->chunk_size ? f->size - offs : (long long)f->k * f->chunk_size;
+
+		if (bad[stripe / 8] & (1 << (stripe % 8)))
+		{
+			if (fec_read_stripe(f, stripe) < 0)
+				return 0;
+		}
+		else if (!fec_pread(f->fd, f->data, len, offs))
+			return 0;
+		if (!fec_write(out_fd, f->data, len))
+			return 0;
+	}
+	return 1;
+}
+
+/* Checks the image file fd against its sidecar, if there is one. Returns fd
+ * if the image is intact, a stream of the repaired image (fd is closed) or
+ * -1 if it can't be repaired.
+ */
+int fec_image_open(const char* filename, int fd)
+{
+	struct fec_image f;
+	struct fec_result* r;
+	struct stat st;
+	unsigned char* bad;
+	long long stripe;
+	int ret, pipe_fd[2], out_fd;
+	pid_t pid;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return fd;
+	r = fec_result_find(&st);
+	if (r && r->bad == NULL)
+		return fd;
+	if (r && r->memfd >= 0 && (out_fd = fec_memfd_open(r->memfd)) >= 0)
+	{
+		close(fd);
+		return out_fd;
+	}
+	if (!fec_sidecar_open(filename, fd, &st, &f))
+		return fd;
+
+	if (r)
+		bad = r->bad; // checked before: rebuild the same stripes
+	else
+	{
+		my_printf("Checking %s with FEC sidecar\n", filename);
+		bad = calloc(f.stripes / 8 + 1, 1);
+		if (bad == NULL)
+		{
+			fec_close(&f);
+			return fd;
+		}
+		for (stripe = 0; stripe < f.stripes; stripe++)
+		{
+			ret = fec_read_stripe(&f, stripe);
+			if (ret < 0)
+			{
+				my_printf("Error: %s is corrupted at %lld and can't be repaired\n", filename, stripe * f.k * f.chunk_size);
+				free(bad);
+				fec_close(&f);
+				close(fd);
+				errno = EIO;
+				return -1;
+			}
+			if (ret)
+				bad[stripe / 8] |= 1 << (stripe % 8);
+			f.repaired += ret;
+		}
+
+		if (f.repaired == 0)
+		{
+			free(bad);
+			fec_result_add(&st, NULL);
+			fec_close(&f);
+			lseek(fd, 0, SEEK_SET);
+			return fd;
+		}
+		my_printf("FEC: %lld corrupted chunks of %s are rebuilt\n", f.repaired, filename);
+		r = fec_result_add(&st, bad);
+	}
+
+	// small images (kernel) stay seekable
+	if (f.size <= FEC_MEMFD_MAX)
+	{
+		out_fd = memfd_create("ofgwrite-fec", MFD_CLOEXEC);
+		if (out_fd < 0 || !fec_write_image(&f, bad, out_fd) || lseek(out_fd, 0, SEEK_SET) != 0)
+		{
+			my_printf("Error writing repaired %s\n", filename);
+			if (out_fd >= 0)
+				close(out_fd);
+			out_fd = -1;
+		}
+		else if (r)
+		{
+			r->memfd = out_fd; // kept for the next open
+			out_fd = fec_memfd_open(r->memfd);
+		}
+		if (r == NULL)
+			free(bad);
+		fec_close(&f);
+		close(fd);
+		return out_fd;
+	}
+
+	if (pipe(pipe_fd) != 0)
+	{
+		if (r == NULL)
+			free(bad);
+		fec_close(&f);
+		close(fd);
+		return -1;
+	}
+	pid = fork();
+	switch (pid)
+	{
+	case -1:
+		my_printf("Error fork failed\n");
+		close(pipe_fd[0]);
+		pipe_fd[0] = -1;
+		break;
+	case 0:
+		close(pipe_fd[0]);
+		signal(SIGPIPE, SIG_IGN);
+		exit(fec_write_image(&f, bad, pipe_fd[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+	default:
+		image_stream_add(pipe_fd[0], pid);
+	}
+	close(pipe_fd[1]);
+	if (r == NULL)
+		free(bad);
+	fec_close(&f);
+	close(fd);
+	return pipe_fd[0];
+}
+
+/* Creates the sidecar of image, used by ofgwrite_bench mkfec.
+ * Returns 1 on success.
+ */
+int fec_sidecar_create(const char* image, int chunk_size, int k, int m)
+{
+	struct fec_sidecar_header hdr;
+	struct fec_image f;
+	struct stat st;
+	unsigned char* src[256];
+	char path[1100];
+	long long stripe, i;
+	int j, out, ret = 0;
+
+	memset(&f, 0, sizeof(f));
+	f.sidecar_fd = -1;
+	f.fd = open(image, O_RDONLY);
+	if (f.fd < 0 || fstat(f.fd, &st) != 0 || chunk_size <= 0 || chunk_size > FEC_MAX_CHUNK
+	 || k < 1 || m < 1 || k + m > 256)
+	{
+		my_printf("Error: can't create FEC sidecar for %s\n", image);
+		if (f.fd >= 0)
+			close(f.fd);
+		return 0;
+	}
+	f.chunk_size = chunk_size;
+	f.k = k;
+	f.m = m;
+	f.size = st.st_size;
+	f.chunks = (f.size + chunk_size - 1) / chunk_size;
+	f.stripes = (f.chunks + k - 1) / k;
+	f.parity_offs = sizeof(hdr) + (f.chunks + f.stripes * m) * sizeof(uint32_t);
+	f.crc = calloc(f.chunks + f.stripes * m, sizeof(uint32_t));
+	f.data = malloc((size_t)k * chunk_size);
+	f.parity = malloc(chunk_size);
+	f.code = f.crc && f.data && f.parity ? fec_new(k, k + m) : NULL;
+
+	snprintf(path, sizeof(path), "%s%s", image, FEC_SIDECAR_SUFFIX);
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (f.code == NULL || out < 0)
+		goto out;
+
+	for (stripe = 0; stripe < f.stripes; stripe++)
+	{
+		for (j = 0; j < k; j++)
+		{
+			long long chunk = stripe * k + j;
+			int len = fec_chunk_len(&f, chunk);
+
+			src[j] = f.data + (size_t)j * chunk_size;
+			memset(src[j] + len, 0, chunk_size - len);
+			if (len && !fec_pread(f.fd, src[j], len, chunk * chunk_size))
+				goto out;
+			if (len)
+				f.crc[chunk] = cpu_to_le32(mtd_crc32(UINT32_MAX, src[j], len));
+		}
+		for (j = 0; j < m; j++)
+		{
+			long long pchunk = stripe * m + j;
+
+			fec_encode(f.code, src, f.parity, k + j, chunk_size);
+			f.crc[f.chunks + pchunk] = cpu_to_le32(mtd_crc32(UINT32_MAX, f.parity, chunk_size));
+			if (pwrite(out, f.parity, chunk_size, f.parity_offs + pchunk * chunk_size) != chunk_size)
+				goto out;
+		}
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FEC_MAGIC, sizeof(hdr.magic));
+	hdr.chunk_size = cpu_to_le32(chunk_size);
+	hdr.k = cpu_to_le16(k);
+	hdr.m = cpu_to_le16(m);
+	hdr.image_size = cpu_to_le64(f.size);
+	hdr.hdr_crc = cpu_to_le32(mtd_crc32(UINT32_MAX, &hdr, offsetof(struct fec_sidecar_header, hdr_crc)));
+	i = (f.chunks + f.stripes * m) * sizeof(uint32_t);
+	if (pwrite(out, &hdr, sizeof(hdr), 0) == sizeof(hdr) && pwrite(out, f.crc, i, sizeof(hdr)) == i)
+		ret = 1;
+out:
+	if (!ret)
+		my_printf("Error creating FEC sidecar %s\n", path);
+	if (out >= 0)
+		close(out);
+	close(f.fd);
+	fec_close(&f);
+	return ret;
+}
@@ -33,6 +33,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 
+#include "ofgwrite.h"
 #include <common.h>
 #include <crc32.h>
 #include <libmtd.h>
@@ -244,6 +245,7 @@ int flash_erase_main(int argc, char *argv[])
 		if (!noskipbad) {
 			int ret = mtd_is_bad(&mtd, fd, eb);
 			if (ret > 0) {
+				telemetry_bad_block(mtd_device, eb);
 				verbose(!quiet, "Skipping bad block at %08"PRIxoff_t, offset);
 				continue;
 			} else if (ret < 0) {
@@ -265,10 +267,12 @@ int flash_erase_main(int argc, char *argv[])
 			}
 		}
 
+		telemetry_progress(mtd_device, (long long)(eb - eb_start) * mtd.eb_size, (long long)eb_cnt * mtd.eb_size);
 		if (mtd_erase(mtd_desc, &mtd, fd, eb) != 0) {
 			sys_errmsg("%s: MTD Erase failure", mtd_device);
 			continue;
 		}
+		telemetry_erase(mtd_device, 1);
 
 		/* format for JFFS2 ? */
 		if (!jffs2)
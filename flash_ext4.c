@@ -8,71 +8,137 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mount.h>
 
+#define KERNEL_CHUNK_SIZE (1024 * 1024)
+#define KERNEL_BLOCK_SIZE (64 * 1024)
+
+// reads len bytes at pos, or from current position if pos < 0 (kernel file can be a pipe)
+static ssize_t pread_full(int fd, char* buf, size_t len, off_t pos)
+{
+	size_t done = 0;
+
+	while (done < len)
+	{
+		ssize_t ret = pos < 0 ? read(fd, buf + done, len - done) : pread(fd, buf + done, len - done, pos + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return done ? (ssize_t)done : -1;
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+/* The kernel device is read and compared with the kernel file in big chunks.
+ * Only blocks which differ are written. If the kernel is already identical
+ * nothing is written at all. A kernel file (kexec, rootSubDir) is written
+ * anew, it has been removed with the rootfs or can be longer than the kernel.
+ */
 int flash_ext4_kernel(char* device, char* filename, off_t kernel_file_size, int quiet, int no_write)
 {
-	char buffer[512];
+	char* file_buf;
+	char* dev_buf;
+	off_t pos = 0, written = 0;
+	ssize_t len, dev_len, off;
+	int kernel_fd, dev_fd = -1, ret = 0;
+	int is_file;
+	struct stat st;
+	int current_percent = 0;
+	int new_percent     = 0;
 
 	// Open kernel file
-	FILE* kernel_file;
-	kernel_file = fopen(filename, "rb");
-	if (kernel_file == NULL)
+	kernel_fd = image_open(filename);
+	if (kernel_fd < 0)
 	{
 		my_printf("Error while opening kernel file %s\n", filename);
 		return 0;
 	}
 
 	// Open kernel device
-	FILE* kernel_dev;
-	kernel_dev = fopen(device, "wb");
-	if (kernel_dev == NULL)
+	is_file = stat(device, &st) != 0 || !S_ISBLK(st.st_mode);
+	if (is_file)
+	{
+		if (!no_write)
+			dev_fd = open(device, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	else
+		dev_fd = open(device, no_write ? O_RDONLY : O_RDWR);
+	if (dev_fd < 0 && !(is_file && no_write))
 	{
 		my_printf("Error while opening kernel device %s\n", device);
+		close(kernel_fd);
 		return 0;
 	}
 
+	file_buf = malloc(KERNEL_CHUNK_SIZE);
+	dev_buf = malloc(KERNEL_CHUNK_SIZE);
+	if (file_buf == NULL || dev_buf == NULL)
+	{
+		my_printf("Error: out of memory\n");
+		goto out;
+	}
+
 	set_step("Writing ext4 kernel");
-	int ret;
-	long long readBytes = 0;
-	int current_percent = 0;
-	int new_percent     = 0;
-	while (!feof(kernel_file))
+	while ((len = pread_full(kernel_fd, file_buf, KERNEL_CHUNK_SIZE, -1)) > 0)
 	{
-		// Don't add my_printf for debugging! Debug messages will be written to kernel device!
-		ret = fread(buffer, 1, sizeof(buffer), kernel_file);
-		if (ret == 0)
+		io_source_read(kernel_fd, len);
+		dev_len = is_file ? 0 : pread_full(dev_fd, dev_buf, len, pos);
+		for (off = 0; off < len; off += KERNEL_BLOCK_SIZE)
 		{
-			if (feof(kernel_file))
+			ssize_t block_len = len - off > KERNEL_BLOCK_SIZE ? KERNEL_BLOCK_SIZE : len - off;
+			if (dev_len >= off + block_len && memcmp(&file_buf[off], &dev_buf[off], block_len) == 0)
 				continue;
-			my_printf("Error reading kernel file.\n");
-			fclose(kernel_file);
-			fclose(kernel_dev);
-			return 0;
+			if (!no_write && pwrite(dev_fd, &file_buf[off], block_len, pos + off) != block_len)
+			{
+				my_printf("Error writing kernel file to kernel device.\n");
+				goto out;
+			}
+			written += block_len;
 		}
-		readBytes += ret;
-		new_percent = readBytes * 100/ kernel_file_size;
+		pos += len;
+		if (!no_write)
+			io_target_written(dev_fd, pos);
+		new_percent = pos * 100 / kernel_file_size;
 		if (current_percent < new_percent)
 		{
 			set_step_progress(new_percent);
 			current_percent = new_percent;
 		}
-		if (!no_write)
+		telemetry_progress(device, pos, kernel_file_size);
+	}
+	if (len < 0)
+	{
+		my_printf("Error reading kernel file.\n");
+		goto out;
+	}
+
+	if (written == 0)
+		my_printf("Kernel on %s is already up to date. Skipping kernel write\n", device);
+	else
+	{
+		if (!quiet)
+			my_printf("Kernel: %lld of %lld bytes differ and were written\n", (long long)written, (long long)pos);
+		if (!no_write && fsync(dev_fd) != 0)
 		{
-			ret = fwrite(buffer, ret, 1, kernel_dev);
-			if (ret != 1)
-			{
-				my_printf("Error writing kernel file to kernel device.\n");
-				fclose(kernel_file);
-				fclose(kernel_dev);
-				return 0;
-			}
+			my_printf("Error syncing kernel device %s\n", device);
+			goto out;
 		}
 	}
+	ret = 1;
 
-	fclose(kernel_file);
-	fclose(kernel_dev);
-
-	return 1;
+out:
+	free(file_buf);
+	free(dev_buf);
+	if (!image_close(kernel_fd))
+		ret = 0;
+	if (dev_fd >= 0)
+		close(dev_fd);
+	return ret;
 }
 
 int rm_rootfs(char* directory, int quiet, int no_write)
@@ -112,6 +178,7 @@ int untar_rootfs(char* filename, char* directory, int quiet, int no_write)
 
 	if (!quiet)
 		my_printf("Untar: tar xf %s\n", filename);
+	stats_phase("Untar");
 	if (!no_write)
 		if (tar_main(argc, argv) != 0)
 			return 0;
@@ -119,12 +186,41 @@ int untar_rootfs(char* filename, char* directory, int quiet, int no_write)
 	return 1;
 }
 
+/* Not running and not shared rootfs: discard the partition and create a new
+ * filesystem instead of deleting all files. Returns 0 if the partition is
+ * still mounted unchanged and the content must be deleted, -1 on errors.
+ */
+static int reset_rootfs(int quiet)
+{
+	if (stop_neutrino_needed || rootfs_flash_mode != TARBZ2
+	 || (current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0))
+		return 0;
+
+	if (umount("/oldroot_remount/") != 0)
+	{
+		my_printf("Can't unmount rootfs (%s). Deleting content\n", strerror(errno));
+		return 0;
+	}
+	set_step("Formatting rootfs");
+	// the partition was discarded already: don't extract onto a half made filesystem
+	if (!mkfs_ext4(rootfs_device, quiet))
+	{
+		my_printf("Error formatting %s\n", rootfs_device);
+		return -1;
+	}
+	if (mount(rootfs_device, "/oldroot_remount/", "ext4", 0, NULL) != 0)
+	{
+		my_printf("Error mounting %s: %s\n", rootfs_device, strerror(errno));
+		return -1;
+	}
+	return 1;
+}
+
 int flash_unpack_rootfs(char* filename, int quiet, int no_write)
 {
 	int ret;
 	char path[1000];
 
-	// instead of creating new filesystem just delete whole content
 	set_step("Deleting rootfs");
 	strcpy(path, "/oldroot_remount/");
 	if (current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0) // box with rootSubDir feature
@@ -132,26 +228,45 @@ int flash_unpack_rootfs(char* filename, int quiet, int no_write)
 		strcat(path, rootfs_sub_dir);
 		strcat(path, "/");
 	}
-	if (!no_write)
+	// interrupted extraction: keep the entries which were extracted already
+	if (!no_write && journal_tar_start(rootfs_device, "/oldroot_remount/") > 0)
+		my_printf("Continuing interrupted extraction\n");
+	else if (!no_write)
 	{
-		ret = rm_rootfs(path, quiet, no_write); // ignore return value as it always fails, because oldroot_remount cannot be removed
+		ret = reset_rootfs(quiet);
+		if (ret < 0)
+			return 0;
+		// otherwise delete whole content
+		if (ret == 0)
+			ret = rm_rootfs(path, quiet, no_write); // ignore return value as it always fails, because oldroot_remount cannot be removed
 	}
 
 	set_step("Extracting rootfs");
 	set_step_progress(0);
 	if (!no_write && current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0) // box with rootSubDir feature
 		mkdir(path, 777); // directory is maybe not present
-	if (!untar_rootfs(filename, path, quiet, no_write))
+	ret = untar_rootfs(filename, path, quiet, no_write);
+	journal_tar_stop();
+	if (!ret)
 	{
 		my_printf("Error extracting rootfs\n");
 		return 0;
 	}
-	// sync filesystem double because of sdcard
-	sync();
-	sync();
-	sleep(1);
+	stats_phase("Syncing rootfs");
+	copy_backup_to_rootfs(path);
+	durable_track("/oldroot_remount/");
+	if (!no_write && !durable_sync("/oldroot_remount/"))
+		return 0;
+
+	ret = chdir("/"); // needed to be able to umount filesystem
+	return 1;
+}
 
-	//NI
+//NI
+// copies backup_flash.tar.gz (if available) to var/ of the rootfs in path
+void copy_backup_to_rootfs(char* path)
+{
+	int ret;
 	char backup_file[64] = "";
 	if (access("/backup_flash.tar.gz", F_OK) == 0)
 		strcpy(backup_file, "/backup_flash.tar.gz");
@@ -170,10 +285,6 @@ int flash_unpack_rootfs(char* filename, int quiet, int no_write)
 		if (ret != 0)
 			my_printf("Error copying backup_flash.tar.gz\n");
 	}
-	sync();
-
-	ret = chdir("/"); // needed to be able to umount filesystem
-	return 1;
 }
 
 #define BUF_SIZE 1024
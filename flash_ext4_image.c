@@ -0,0 +1,753 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
+
+#include "busybox/include/libbb.h"
+#include "busybox/include/bb_archive.h"
+
+/* Image based ext4 rootfs flashing.
+ *
+ * Instead of deleting the rootfs and extracting a tar archive file by file
+ * a whole ext4 filesystem image is written to the rootfs partition.
+ * Supported are Android sparse images and raw ext4 images, both optionally
+ * bz2 or xz compressed (decompressed on the fly by busybox open_zipped()).
+ * Only blocks which contain data are written. Everything else is discarded.
+ * - sparse image: raw chunks are written, fill chunks with 0 are zeroed,
+ *   don't care chunks are discarded
+ * - raw ext4 image: the block bitmaps are read while streaming the image.
+ *   Blocks marked as free are discarded, blocks in use are written.
+ *   Blocks of groups whose bitmap isn't known (yet) are written, or zeroed if
+ *   they only contain zeros.
+ * The part of the partition behind the filesystem is discarded.
+ */
+
+#define SPARSE_HEADER_MAGIC 0xed26ff3a
+#define CHUNK_TYPE_RAW       0xCAC1
+#define CHUNK_TYPE_FILL      0xCAC2
+#define CHUNK_TYPE_DONT_CARE 0xCAC3
+#define CHUNK_TYPE_CRC32     0xCAC4
+
+#define EXT4_SUPER_MAGIC        0xEF53
+#define EXT4_INCOMPAT_META_BG   0x0010
+#define EXT4_INCOMPAT_64BIT     0x0080
+#define EXT4_RO_COMPAT_BIGALLOC 0x0200
+#define EXT4_BG_BLOCK_UNINIT    0x0002
+
+#define IMAGE_WRITE_BUF_SIZE (1024 * 1024)
+
+struct sparse_header
+{
+	uint32_t magic;
+	uint16_t major_version;
+	uint16_t minor_version;
+	uint16_t file_hdr_sz;
+	uint16_t chunk_hdr_sz;
+	uint32_t blk_sz;
+	uint32_t total_blks;
+	uint32_t total_chunks;
+	uint32_t image_checksum;
+} __attribute__((packed));
+
+struct chunk_header
+{
+	uint16_t chunk_type;
+	uint16_t reserved1;
+	uint32_t chunk_sz;  // in blocks
+	uint32_t total_sz;  // in bytes including chunk header
+} __attribute__((packed));
+
+enum range_type
+{
+	RANGE_NONE, RANGE_DISCARD, RANGE_ZERO
+};
+
+struct image_writer
+{
+	char* device;
+	int fd;
+	int no_write;
+	int can_discard;
+	int can_zeroout;
+	int show_progress;
+	unsigned int block_size;
+	unsigned long long total_bytes;
+
+	// pending write: buffer data belongs to device offset buf_offset
+	unsigned char* buf;
+	size_t buf_len;
+	unsigned long long buf_offset;
+
+	// pending discard/zero range
+	enum range_type range_type;
+	unsigned long long range_start;
+	unsigned long long range_len;
+
+	unsigned long long bytes_written;
+	unsigned long long bytes_discarded;
+	unsigned long long bytes_zeroed;
+	int current_percent;
+};
+
+static int read_full(int fd, void* buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len)
+	{
+		ret = read(fd, (char*)buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static int write_full(int fd, const void* buf, size_t len, unsigned long long offset)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len)
+	{
+		ret = pwrite(fd, (const char*)buf + done, len - done, offset + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+static void writer_progress(struct image_writer* w, unsigned long long pos)
+{
+	int new_percent;
+
+	if (w->total_bytes == 0)
+		return;
+	if (pos > w->total_bytes)
+		pos = w->total_bytes;
+	telemetry_progress(w->device, pos, w->total_bytes);
+	// compressed images: the decompressor shows the progress
+	if (!w->show_progress)
+		return;
+	new_percent = pos * 100 / w->total_bytes;
+	if (new_percent > w->current_percent)
+	{
+		set_step_progress(new_percent);
+		w->current_percent = new_percent;
+	}
+}
+
+static int writer_flush_buf(struct image_writer* w)
+{
+	if (w->buf_len == 0)
+		return 1;
+	if (!w->no_write && !write_full(w->fd, w->buf, w->buf_len, w->buf_offset))
+	{
+		my_printf("Error writing to %s at offset %llu: %s\n", w->device, w->buf_offset, strerror(errno));
+		return 0;
+	}
+	telemetry_write(w->device, 1);
+	w->bytes_written += w->buf_len;
+	w->buf_offset += w->buf_len;
+	w->buf_len = 0;
+	return 1;
+}
+
+static int writer_zero_by_write(struct image_writer* w, unsigned long long start, unsigned long long len)
+{
+	unsigned long long done = 0;
+
+	memset(w->buf, 0, IMAGE_WRITE_BUF_SIZE);
+	while (done < len)
+	{
+		size_t chunk = len - done > IMAGE_WRITE_BUF_SIZE ? IMAGE_WRITE_BUF_SIZE : len - done;
+		if (!write_full(w->fd, w->buf, chunk, start + done))
+		{
+			my_printf("Error zeroing %s at offset %llu: %s\n", w->device, start + done, strerror(errno));
+			return 0;
+		}
+		done += chunk;
+	}
+	return 1;
+}
+
+static int writer_flush_range(struct image_writer* w)
+{
+	uint64_t range[2];
+
+	if (w->range_type == RANGE_NONE || w->range_len == 0)
+	{
+		w->range_type = RANGE_NONE;
+		return 1;
+	}
+
+	range[0] = w->range_start;
+	range[1] = w->range_len;
+	if (w->range_type == RANGE_DISCARD)
+	{
+		// content of free blocks doesn't matter: ignore if device can't discard
+		if (!w->no_write && w->can_discard)
+		{
+			if (ioctl(w->fd, BLKDISCARD, &range) == 0)
+			{
+				telemetry_erase(w->device, 1);
+				w->bytes_discarded += w->range_len;
+			}
+			else
+			{
+				my_printf("BLKDISCARD not supported on %s: %s\n", w->device, strerror(errno));
+				w->can_discard = 0;
+			}
+		}
+	}
+	else
+	{
+		if (!w->no_write)
+		{
+			if (w->can_zeroout && ioctl(w->fd, BLKZEROOUT, &range) != 0)
+			{
+				my_printf("BLKZEROOUT not supported on %s: %s\n", w->device, strerror(errno));
+				w->can_zeroout = 0;
+			}
+			// buffer is empty as pending writes are always flushed first
+			if (!w->can_zeroout && !writer_zero_by_write(w, w->range_start, w->range_len))
+				return 0;
+		}
+		w->bytes_zeroed += w->range_len;
+	}
+	w->range_type = RANGE_NONE;
+	w->range_len = 0;
+	return 1;
+}
+
+// data for device offset "offset" has to be written
+static int writer_data(struct image_writer* w, const unsigned char* data, size_t len, unsigned long long offset)
+{
+	if (!writer_flush_range(w))
+		return 0;
+	if (w->buf_len && w->buf_offset + w->buf_len != offset)
+		if (!writer_flush_buf(w))
+			return 0;
+
+	while (len)
+	{
+		size_t chunk;
+
+		if (w->buf_len == 0)
+			w->buf_offset = offset;
+		chunk = IMAGE_WRITE_BUF_SIZE - w->buf_len;
+		if (chunk > len)
+			chunk = len;
+		memcpy(&w->buf[w->buf_len], data, chunk);
+		w->buf_len += chunk;
+		data += chunk;
+		offset += chunk;
+		len -= chunk;
+		if (w->buf_len == IMAGE_WRITE_BUF_SIZE && !writer_flush_buf(w))
+			return 0;
+	}
+	writer_progress(w, offset);
+	return 1;
+}
+
+// device range has to be discarded (RANGE_DISCARD) or has to read back as zeros (RANGE_ZERO)
+static int writer_range(struct image_writer* w, enum range_type type, unsigned long long offset, unsigned long long len)
+{
+	if (!writer_flush_buf(w))
+		return 0;
+	if (w->range_type != type || w->range_start + w->range_len != offset)
+	{
+		if (!writer_flush_range(w))
+			return 0;
+		w->range_type = type;
+		w->range_start = offset;
+		w->range_len = 0;
+	}
+	w->range_len += len;
+	writer_progress(w, offset + len);
+	return 1;
+}
+
+static int writer_finish(struct image_writer* w)
+{
+	return writer_flush_buf(w) && writer_flush_range(w);
+}
+
+static int is_zero(const unsigned char* buf, size_t len)
+{
+	return buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0;
+}
+
+static int flash_sparse_image(struct image_writer* w, int in_fd, struct sparse_header* hdr)
+{
+	struct chunk_header chunk;
+	unsigned char* block;
+	unsigned long long offset = 0;
+	unsigned int i, j;
+	uint32_t fill;
+	int ret = 0;
+
+	block = malloc(w->block_size);
+	if (block == NULL)
+		return 0;
+
+	// skip rest of an extended header
+	for (i = sizeof(*hdr); i < le16toh(hdr->file_hdr_sz); i++)
+		if (!read_full(in_fd, block, 1))
+			goto out;
+
+	for (i = 0; i < le32toh(hdr->total_chunks); i++)
+	{
+		unsigned long long chunk_bytes;
+
+		if (!read_full(in_fd, &chunk, sizeof(chunk)))
+		{
+			my_printf("Error reading sparse chunk header %u\n", i);
+			goto out;
+		}
+		for (j = sizeof(chunk); j < le16toh(hdr->chunk_hdr_sz); j++)
+			if (!read_full(in_fd, block, 1))
+				goto out;
+
+		chunk_bytes = (unsigned long long)le32toh(chunk.chunk_sz) * w->block_size;
+		if (offset + chunk_bytes > w->total_bytes)
+		{
+			my_printf("Error: sparse chunk %u exceeds image size\n", i);
+			goto out;
+		}
+
+		switch (le16toh(chunk.chunk_type))
+		{
+		case CHUNK_TYPE_RAW:
+			for (j = 0; j < le32toh(chunk.chunk_sz); j++)
+			{
+				if (!read_full(in_fd, block, w->block_size))
+				{
+					my_printf("Error reading sparse chunk %u\n", i);
+					goto out;
+				}
+				if (!writer_data(w, block, w->block_size, offset + (unsigned long long)j * w->block_size))
+					goto out;
+			}
+			break;
+		case CHUNK_TYPE_FILL:
+			if (!read_full(in_fd, &fill, sizeof(fill)))
+				goto out;
+			if (fill == 0)
+			{
+				if (!writer_range(w, RANGE_ZERO, offset, chunk_bytes))
+					goto out;
+				break;
+			}
+			for (j = 0; j < w->block_size / sizeof(fill); j++)
+				memcpy(&block[j * sizeof(fill)], &fill, sizeof(fill));
+			for (j = 0; j < le32toh(chunk.chunk_sz); j++)
+				if (!writer_data(w, block, w->block_size, offset + (unsigned long long)j * w->block_size))
+					goto out;
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			if (!writer_range(w, RANGE_DISCARD, offset, chunk_bytes))
+				goto out;
+			break;
+		case CHUNK_TYPE_CRC32:
+			if (!read_full(in_fd, &fill, sizeof(fill)))
+				goto out;
+			break;
+		default:
+			my_printf("Error: unknown sparse chunk type 0x%x\n", le16toh(chunk.chunk_type));
+			goto out;
+		}
+		offset += chunk_bytes;
+	}
+	ret = writer_finish(w);
+
+out:
+	free(block);
+	return ret;
+}
+
+struct bitmap_location
+{
+	unsigned long long block;
+	unsigned int group;
+};
+
+struct ext4_layout
+{
+	unsigned long long blocks_count;
+	unsigned int first_data_block;
+	unsigned int blocks_per_group;
+	unsigned int group_cnt;
+	unsigned int desc_size;
+	unsigned int gdt_blocks;
+	struct bitmap_location* bitmap_loc; // block bitmap of each group, sorted by block after reading all descriptors
+	unsigned int next_bitmap;           // next entry of bitmap_loc in stream order
+	unsigned char* bitmap_known;        // bitmap of group was read and is valid
+	unsigned char* bitmap;              // one bit per block, 1 = in use
+};
+
+// reads the superblock from the first 2k of the image
+static int parse_ext4_superblock(const unsigned char* sb, struct ext4_layout* l, unsigned int* block_size)
+{
+	uint32_t incompat, ro_compat;
+
+	if (le16toh(*(uint16_t*)&sb[0x38]) != EXT4_SUPER_MAGIC)
+		return 0;
+
+	memset(l, 0, sizeof(*l));
+	*block_size = 1024 << le32toh(*(uint32_t*)&sb[0x18]);
+	incompat = le32toh(*(uint32_t*)&sb[0x60]);
+	ro_compat = le32toh(*(uint32_t*)&sb[0x64]);
+	l->blocks_count = le32toh(*(uint32_t*)&sb[0x04]);
+	if (incompat & EXT4_INCOMPAT_64BIT)
+		l->blocks_count |= (unsigned long long)le32toh(*(uint32_t*)&sb[0x150]) << 32;
+	l->first_data_block = le32toh(*(uint32_t*)&sb[0x14]);
+	l->blocks_per_group = le32toh(*(uint32_t*)&sb[0x20]);
+	l->desc_size = (incompat & EXT4_INCOMPAT_64BIT) ? le16toh(*(uint16_t*)&sb[0xFE]) : 32;
+	if (*block_size > 65536 || l->blocks_per_group == 0 || l->desc_size < 32)
+		return 0;
+	l->group_cnt = (l->blocks_count - l->first_data_block + l->blocks_per_group - 1) / l->blocks_per_group;
+	// with meta_bg the group descriptors are spread over the disk and with
+	// bigalloc a bitmap bit covers a cluster: bitmaps stay unknown
+	if (!(incompat & EXT4_INCOMPAT_META_BG) && !(ro_compat & EXT4_RO_COMPAT_BIGALLOC))
+		l->gdt_blocks = ((unsigned long long)l->group_cnt * l->desc_size + *block_size - 1) / *block_size;
+	return 1;
+}
+
+static void parse_group_descriptor(struct ext4_layout* l, unsigned int group, const unsigned char* desc)
+{
+	struct bitmap_location* loc = &l->bitmap_loc[group];
+
+	loc->group = group;
+	loc->block = le32toh(*(uint32_t*)&desc[0x00]);
+	if (l->desc_size >= 64)
+		loc->block |= (unsigned long long)le32toh(*(uint32_t*)&desc[0x20]) << 32;
+	// uninitialized bitmap: content on disk isn't valid
+	if (le16toh(*(uint16_t*)&desc[0x12]) & EXT4_BG_BLOCK_UNINIT)
+		loc->block = 0;
+}
+
+static int compare_bitmap_location(const void* a, const void* b)
+{
+	const struct bitmap_location* la = a;
+	const struct bitmap_location* lb = b;
+
+	if (la->block != lb->block)
+		return la->block < lb->block ? -1 : 1;
+	return 0;
+}
+
+// block nr of the image just passed by: store it if it's a block bitmap
+static void check_bitmap_block(struct ext4_layout* l, unsigned long long nr, const unsigned char* data, unsigned int block_size)
+{
+	unsigned int bytes = l->blocks_per_group / 8;
+
+	if (bytes > block_size)
+		bytes = block_size;
+	while (l->next_bitmap < l->group_cnt && l->bitmap_loc[l->next_bitmap].block <= nr)
+	{
+		struct bitmap_location* loc = &l->bitmap_loc[l->next_bitmap++];
+		if (loc->block != nr || nr == 0)
+			continue; // uninitialized or already passed
+		memcpy(&l->bitmap[(unsigned long long)loc->group * (l->blocks_per_group / 8)], data, bytes);
+		l->bitmap_known[loc->group] = 1;
+	}
+}
+
+// 1 = in use, 0 = free, -1 = unknown
+static int ext4_block_used(struct ext4_layout* l, unsigned long long nr)
+{
+	unsigned long long bit;
+	unsigned int g;
+
+	if (nr < l->first_data_block + 1 + l->gdt_blocks)
+		return 1; // boot block, superblock and group descriptors
+	g = (nr - l->first_data_block) / l->blocks_per_group;
+	if (g >= l->group_cnt || !l->bitmap_known[g])
+		return -1;
+	bit = nr - l->first_data_block;
+	return (l->bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+static int flash_raw_ext4_image(struct image_writer* w, int in_fd, unsigned char* first, size_t first_len)
+{
+	struct ext4_layout l;
+	unsigned char* block;
+	unsigned long long nr;
+	unsigned int g;
+	int ret = 0;
+
+	parse_ext4_superblock(&first[1024], &l, &w->block_size);
+	l.bitmap_loc = calloc(l.group_cnt, sizeof(*l.bitmap_loc));
+	l.bitmap_known = calloc(l.group_cnt, 1);
+	l.bitmap = calloc((unsigned long long)l.group_cnt * l.blocks_per_group / 8 + 1, 1);
+	block = malloc(w->block_size);
+	if (!l.bitmap_loc || !l.bitmap_known || !l.bitmap || !block)
+	{
+		my_printf("Error: not enough memory for ext4 block bitmaps\n");
+		goto out;
+	}
+
+	my_printf("ext4 image: %llu blocks of %u bytes, %u groups\n", l.blocks_count, w->block_size, l.group_cnt);
+
+	for (nr = 0; nr < l.blocks_count; nr++)
+	{
+		// first 2k were already read to detect the image type
+		if (nr * w->block_size < first_len)
+		{
+			size_t from_first = first_len - nr * w->block_size;
+			if (from_first > w->block_size)
+				from_first = w->block_size;
+			memcpy(block, &first[nr * w->block_size], from_first);
+			if (from_first < w->block_size && !read_full(in_fd, &block[from_first], w->block_size - from_first))
+				goto read_error;
+		}
+		else if (!read_full(in_fd, block, w->block_size))
+			goto read_error;
+
+		// group descriptor table follows the superblock
+		if (l.gdt_blocks && nr > l.first_data_block && nr <= l.first_data_block + l.gdt_blocks)
+		{
+			unsigned int per_block = w->block_size / l.desc_size;
+			unsigned int first_group = (nr - l.first_data_block - 1) * per_block;
+			for (g = 0; g < per_block && first_group + g < l.group_cnt; g++)
+				parse_group_descriptor(&l, first_group + g, &block[g * l.desc_size]);
+			if (nr == l.first_data_block + l.gdt_blocks)
+				qsort(l.bitmap_loc, l.group_cnt, sizeof(*l.bitmap_loc), compare_bitmap_location);
+		}
+		else if (l.gdt_blocks && nr > l.first_data_block + l.gdt_blocks)
+			check_bitmap_block(&l, nr, block, w->block_size);
+
+		switch (ext4_block_used(&l, nr))
+		{
+		case 1:
+			if (!writer_data(w, block, w->block_size, nr * w->block_size))
+				goto out;
+			break;
+		case 0:
+			if (!writer_range(w, RANGE_DISCARD, nr * w->block_size, w->block_size))
+				goto out;
+			break;
+		default:
+			if (is_zero(block, w->block_size))
+			{
+				if (!writer_range(w, RANGE_ZERO, nr * w->block_size, w->block_size))
+					goto out;
+			}
+			else if (!writer_data(w, block, w->block_size, nr * w->block_size))
+				goto out;
+			break;
+		}
+	}
+	ret = writer_finish(w);
+	goto out;
+
+read_error:
+	my_printf("Error reading ext4 image at block %llu\n", nr);
+out:
+	free(l.bitmap_loc);
+	free(l.bitmap_known);
+	free(l.bitmap);
+	free(block);
+	return ret;
+}
+
+/* Mounts the freshly written filesystem to restore backup_flash.tar.gz.
+ * Returns 0 if the restored files couldn't be synced.
+ */
+static int copy_backup_to_image_rootfs(char* device)
+{
+	char path[1000];
+	int ret;
+
+	if (access("/backup_flash.tar.gz", F_OK) != 0 && access("/newroot/backup_flash.tar.gz", F_OK) != 0)
+		return 1;
+
+	mkdir("/oldroot_remount", 777);
+	if (mount(device, "/oldroot_remount/", "ext4", 0, NULL) != 0)
+	{
+		my_printf("Error mounting %s to copy backup: %s\n", device, strerror(errno));
+		return 1;
+	}
+	strcpy(path, "/oldroot_remount/");
+	copy_backup_to_rootfs(path);
+	ret = durable_sync("/oldroot_remount/");
+	if (umount("/oldroot_remount/") != 0)
+		my_printf("Error umounting %s: %s\n", device, strerror(errno));
+	return ret;
+}
+
+/* Reads the image header and returns the size of the filesystem in the image
+ * or 0 if it's neither a sparse nor an ext4 image.
+ * in_fd is left positioned behind the first 2k which are stored in header.
+ */
+static unsigned long long read_image_header(int in_fd, unsigned char* header, unsigned int* block_size)
+{
+	struct sparse_header* sparse = (struct sparse_header*)header;
+	struct ext4_layout l;
+
+	if (!read_full(in_fd, header, sizeof(*sparse)))
+		return 0;
+	if (le32toh(sparse->magic) == SPARSE_HEADER_MAGIC)
+	{
+		*block_size = le32toh(sparse->blk_sz);
+		if (*block_size == 0 || *block_size % 4 || le16toh(sparse->file_hdr_sz) < sizeof(*sparse)
+		 || le16toh(sparse->chunk_hdr_sz) < sizeof(struct chunk_header))
+			return 0;
+		return (unsigned long long)le32toh(sparse->total_blks) * *block_size;
+	}
+
+	if (!read_full(in_fd, &header[sizeof(*sparse)], 2048 - sizeof(*sparse)))
+		return 0;
+	if (!parse_ext4_superblock(&header[1024], &l, block_size))
+		return 0;
+	return l.blocks_count * *block_size;
+}
+
+/* Closes the stream of open_zipped() and reaps the decompressor and zip
+ * stream. Returns 0 if one of them failed.
+ */
+static int close_zipped(int in_fd)
+{
+	int status = 0;
+
+	close(in_fd);
+	if (transformer_pid > 0 && waitpid(transformer_pid, &status, 0) < 0)
+		status = 0;
+	return image_streams_ok() && status == 0;
+}
+
+// size of the filesystem in image file filename or 0 if it's not a valid image
+unsigned long long ext4_image_size(char* filename)
+{
+	unsigned char header[2048];
+	unsigned int block_size;
+	unsigned long long size;
+	int in_fd;
+
+	in_fd = open_zipped(filename, 0);
+	if (in_fd < 0)
+		return 0;
+	size = read_image_header(in_fd, header, &block_size);
+	close_zipped(in_fd); // the decompressor stops with a write error
+	return size;
+}
+
+int flash_ext4_image_rootfs(char* device, char* filename, int quiet, int no_write)
+{
+	struct image_writer w;
+	unsigned char header[2048];
+	unsigned long long devsize = 0;
+	int in_fd, ret = 0;
+
+	memset(&w, 0, sizeof(w));
+	w.device = device;
+	w.no_write = no_write;
+	w.can_discard = 1;
+	w.can_zeroout = 1;
+
+	set_step("Writing ext4 image");
+	set_step_progress(0);
+
+	in_fd = open_zipped(filename, 0);
+	if (in_fd < 0)
+	{
+		my_printf("Error opening rootfs image %s\n", filename);
+		return 0;
+	}
+	// decompressor runs in a child process and can't be seeked
+	w.show_progress = lseek(in_fd, 0, SEEK_CUR) != -1;
+
+	w.total_bytes = read_image_header(in_fd, header, &w.block_size);
+	if (w.total_bytes == 0)
+	{
+		my_printf("Error: %s is neither an Android sparse nor an ext4 image\n", filename);
+		close_zipped(in_fd);
+		return 0;
+	}
+
+	w.fd = open(device, no_write ? O_RDONLY : O_WRONLY);
+	if (w.fd < 0)
+	{
+		my_printf("Error opening rootfs device %s: %s\n", device, strerror(errno));
+		close_zipped(in_fd);
+		return 0;
+	}
+	if (ioctl(w.fd, BLKGETSIZE64, &devsize) != 0 || devsize < w.total_bytes)
+	{
+		my_printf("Error: image filesystem (%llu) is bigger than rootfs device %s (%llu)\n", w.total_bytes, device, devsize);
+		goto out;
+	}
+
+	w.buf = malloc(IMAGE_WRITE_BUF_SIZE);
+	if (w.buf == NULL)
+		goto out;
+
+	if (le32toh(((struct sparse_header*)header)->magic) == SPARSE_HEADER_MAGIC)
+	{
+		if (!quiet)
+			my_printf("Writing Android sparse image %s to %s\n", filename, device);
+		ret = flash_sparse_image(&w, in_fd, (struct sparse_header*)header);
+	}
+	else
+	{
+		if (!quiet)
+			my_printf("Writing ext4 image %s to %s\n", filename, device);
+		ret = flash_raw_ext4_image(&w, in_fd, header, sizeof(header));
+	}
+	// errors of the decompressor and the zip CRC are known at the end
+	while (ret && safe_read(in_fd, w.buf, IMAGE_WRITE_BUF_SIZE) > 0)
+		continue;
+	if (!close_zipped(in_fd) && ret)
+	{
+		my_printf("Error: rootfs image %s is corrupt\n", filename);
+		ret = 0;
+	}
+	in_fd = -1;
+
+	// rest of the partition isn't used by the new filesystem
+	if (ret && devsize > w.total_bytes)
+		ret = writer_range(&w, RANGE_DISCARD, w.total_bytes, devsize - w.total_bytes) && writer_finish(&w);
+
+	stats_phase("Syncing rootfs");
+	if (ret && !no_write && fsync(w.fd) != 0)
+	{
+		my_printf("Error syncing %s: %s\n", device, strerror(errno));
+		ret = 0;
+	}
+
+	my_printf("ext4 image: %llu bytes written, %llu bytes zeroed, %llu bytes discarded\n",
+			  w.bytes_written, w.bytes_zeroed, w.bytes_discarded);
+
+	if (ret && !no_write)
+		ret = copy_backup_to_image_rootfs(device);
+	if (ret && devsize > w.total_bytes)
+		my_printf("Filesystem in image (%llu) is smaller than rootfs device (%llu). Unused space can be added with resize2fs\n",
+				  w.total_bytes, devsize);
+
+out:
+	free(w.buf);
+	close(w.fd);
+	if (in_fd >= 0)
+		close_zipped(in_fd);
+	if (ret)
+		set_step_progress(100);
+	return ret;
+}
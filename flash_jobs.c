@@ -0,0 +1,450 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <libmtd.h>
+#include <mtd/mtd-abi.h>
+
+#include "busybox/include/libbb.h"
+
+/* Kernel flashing in parallel to the rootfs.
+ *
+ * If kernel and rootfs are on different devices the kernel is written by a
+ * background process while the rootfs is flashed. The kernel is staged: the
+ * background job writes everything except the first block (NAND: the first
+ * eraseblock) with the image header checked by the bootloader and waits.
+ * After the rootfs was flashed the job is told to commit (write the first
+ * block) or to abort. So the new kernel never gets bootable without a
+ * successfully flashed rootfs. The overwritten part of the old kernel is
+ * saved before staging and written back on abort, so the old kernel stays
+ * bootable. Only if that fails the first block is cleared.
+ *
+ * The job is a separate process, because the busybox applets use global
+ * state. It's detached (double fork), so busybox's wait() for the
+ * decompressor children can't reap it. Results are passed through pipes.
+ */
+
+#define KERNEL_HEAD_SIZE 4096
+#define KERNEL_BUF_SIZE  (256 * 1024)
+
+extern int g_fbFd;
+
+static int kernel_job_cmd_fd = -1;    // parent -> job: commit or abort
+static int kernel_job_result_fd = -1; // job -> parent: result
+static unsigned int kernel_job_head_size;
+static int kernel_job_backup_fd = -1; // old kernel behind the first block
+
+// returns eraseblock size of a NAND kernel device with good first block, 0 otherwise
+static unsigned int nand_stage_size(char* device)
+{
+	struct mtd_dev_info mtd;
+	libmtd_t libmtd;
+	int fd, bad;
+
+	libmtd = libmtd_open();
+	if (libmtd == NULL)
+		return 0;
+	if (mtd_get_dev_info(libmtd, device, &mtd) != 0
+	 || (mtd.type != MTD_NANDFLASH && mtd.type != MTD_MLCNANDFLASH))
+	{
+		libmtd_close(libmtd);
+		return 0;
+	}
+	libmtd_close(libmtd);
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	bad = mtd_is_bad(&mtd, fd, 0);
+	close(fd);
+	return bad == 0 ? mtd.eb_size : 0;
+}
+
+static int run_flash_erase(char* device, unsigned long long start, unsigned int count)
+{
+	char start_str[24], count_str[16];
+	char* argv[] = { "flash_erase", device, start_str, count_str, NULL };
+
+	optind = 0; // reset getopt_long
+	sprintf(start_str, "%llu", start);
+	sprintf(count_str, "%u", count);
+	return flash_erase_main(4, argv) == 0;
+}
+
+static int run_nandwrite(char* device, char* filename, unsigned long long start, char* input_opt)
+{
+	char start_str[40];
+	char* argv[] = { "nandwrite", "-pm", "-s", start_str, input_opt, device, filename, NULL };
+
+	optind = 0; // reset getopt_long
+	sprintf(start_str, "%llu", start);
+	return nandwrite_main(7, argv) == 0;
+}
+
+// saves the old kernel from offset KERNEL_HEAD_SIZE to the size of the new one
+static int backup_ext4_kernel(char* device, int backup_fd)
+{
+	char* buf = xmalloc(KERNEL_BUF_SIZE);
+	off_t pos = KERNEL_HEAD_SIZE;
+	off_t size = kernel_file_stat.st_size;
+	int in, ret = 0;
+
+	in = open(device, O_RDONLY);
+	while (in >= 0 && pos < size)
+	{
+		ssize_t len = pread(in, buf, size - pos > KERNEL_BUF_SIZE ? KERNEL_BUF_SIZE : size - pos, pos);
+		if (len <= 0 || full_write(backup_fd, buf, len) != len)
+			break;
+		pos += len;
+	}
+	ret = pos >= size;
+	if (in >= 0)
+		close(in);
+	free(buf);
+	return ret;
+}
+
+static int restore_ext4_kernel(char* device, int backup_fd)
+{
+	char* buf = xmalloc(KERNEL_BUF_SIZE);
+	off_t pos = KERNEL_HEAD_SIZE;
+	ssize_t len;
+	int out, ret = 0;
+
+	out = open(device, O_WRONLY);
+	if (out < 0 || lseek(backup_fd, 0, SEEK_SET) != 0)
+		goto out;
+	while ((len = full_read(backup_fd, buf, KERNEL_BUF_SIZE)) > 0)
+	{
+		if (pwrite(out, buf, len, pos) != len)
+			goto out;
+		pos += len;
+	}
+	ret = len == 0 && fsync(out) == 0;
+out:
+	if (out >= 0)
+		close(out);
+	free(buf);
+	return ret;
+}
+
+/* Saves the good eraseblocks behind the first one, without the erased ones at
+ * the end. nandwrite skips the bad blocks again when writing them back.
+ */
+static int backup_nand_kernel(char* device, int backup_fd)
+{
+	struct mtd_dev_info mtd;
+	libmtd_t libmtd;
+	char* buf = NULL;
+	off_t used = 0;
+	int fd = -1, eb, i, ret = 0;
+
+	libmtd = libmtd_open();
+	if (libmtd == NULL)
+		return 0;
+	if (mtd_get_dev_info(libmtd, device, &mtd) != 0 || (fd = open(device, O_RDONLY)) < 0)
+		goto out;
+	buf = xmalloc(mtd.eb_size);
+	for (eb = kernel_job_head_size / mtd.eb_size; eb < mtd.eb_cnt; eb++)
+	{
+		int bad = mtd_is_bad(&mtd, fd, eb);
+		if (bad > 0)
+			continue;
+		if (bad < 0 || mtd_read(&mtd, fd, eb, 0, buf, mtd.eb_size) != 0
+		 || full_write(backup_fd, buf, mtd.eb_size) != mtd.eb_size)
+			goto out;
+		for (i = 0; i < mtd.eb_size && (unsigned char)buf[i] == 0xff; i++)
+			continue;
+		if (i < mtd.eb_size)
+			used = lseek(backup_fd, 0, SEEK_CUR);
+	}
+	ret = ftruncate(backup_fd, used) == 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	libmtd_close(libmtd);
+	return ret;
+}
+
+static int restore_nand_kernel(char* device, int backup_fd)
+{
+	char path[40];
+
+	sprintf(path, "/proc/self/fd/%d", backup_fd);
+	return run_flash_erase(device, kernel_job_head_size, 0)
+		&& run_nandwrite(device, path, kernel_job_head_size, "--input-skip=0");
+}
+
+// writes the kernel file from offset head_size on
+static int stage_ext4_kernel(char* device, char* filename)
+{
+	char* buf = xmalloc(KERNEL_BUF_SIZE);
+	off_t pos = KERNEL_HEAD_SIZE;
+	off_t size = kernel_file_stat.st_size;
+	int in, out, ret = 0;
+
+	in = image_open(filename);
+	out = open(device, O_WRONLY);
+	if (in < 0 || out < 0)
+	{
+		my_printf("Kernel: Error opening %s or %s\n", filename, device);
+		goto out;
+	}
+	// read sequentially: a zip member or repaired image is a pipe
+	if (!journal_skip_input(in, KERNEL_HEAD_SIZE))
+	{
+		my_printf("Kernel: Error reading %s\n", filename);
+		goto out;
+	}
+	while (pos < size)
+	{
+		ssize_t len = full_read(in, buf, size - pos > KERNEL_BUF_SIZE ? KERNEL_BUF_SIZE : size - pos);
+		if (len <= 0 || pwrite(out, buf, len, pos) != len)
+		{
+			my_printf("Kernel: Error writing %s: %s\n", device, strerror(errno));
+			goto out;
+		}
+		pos += len;
+		io_target_written(out, pos);
+		telemetry_progress(device, pos, size);
+	}
+	ret = fsync(out) == 0;
+out:
+	if (in >= 0 && !image_close(in))
+		ret = 0;
+	if (out >= 0)
+		close(out);
+	free(buf);
+	return ret;
+}
+
+// commit: copy first block from kernel file. abort: clear first block
+static int finish_ext4_kernel(char* device, char* filename, int commit)
+{
+	char buf[KERNEL_HEAD_SIZE];
+	int in, out, ret = 0;
+
+	memset(buf, 0, sizeof(buf));
+	if (commit)
+	{
+		in = image_open(filename);
+		if (in < 0 || full_read(in, buf, sizeof(buf)) != sizeof(buf))
+		{
+			if (in >= 0)
+				image_close(in);
+			return 0;
+		}
+		if (!image_close(in))
+			return 0;
+	}
+	out = open(device, O_WRONLY);
+	if (out < 0)
+		return 0;
+	if (pwrite(out, buf, sizeof(buf), 0) == sizeof(buf) && fsync(out) == 0)
+		ret = 1;
+	close(out);
+	return ret;
+}
+
+// saves the part of the old kernel which is overwritten when staging
+static int backup_kernel(char* device)
+{
+	int ok;
+
+	kernel_job_backup_fd = memfd_create("ofgwrite-kernel", 0);
+	if (kernel_job_backup_fd < 0)
+		return 0;
+	if (kernel_flash_mode == TARBZ2)
+		ok = backup_ext4_kernel(device, kernel_job_backup_fd);
+	else
+		ok = backup_nand_kernel(device, kernel_job_backup_fd);
+	if (!ok)
+	{
+		close(kernel_job_backup_fd);
+		kernel_job_backup_fd = -1;
+	}
+	return ok;
+}
+
+static int restore_kernel(char* device)
+{
+	if (kernel_job_backup_fd < 0)
+		return 0;
+	if (kernel_flash_mode == TARBZ2)
+		return restore_ext4_kernel(device, kernel_job_backup_fd);
+	return restore_nand_kernel(device, kernel_job_backup_fd);
+}
+
+static int stage_kernel(char* device, char* filename)
+{
+	char input_skip[40];
+
+	if (kernel_flash_mode == TARBZ2)
+		return stage_ext4_kernel(device, filename);
+
+	sprintf(input_skip, "--input-skip=%u", kernel_job_head_size);
+	return run_flash_erase(device, kernel_job_head_size, 0)
+		&& run_nandwrite(device, filename, kernel_job_head_size, input_skip);
+}
+
+static int finish_kernel(char* device, char* filename, int commit)
+{
+	char input_size[40];
+
+	if (kernel_flash_mode == TARBZ2)
+		return finish_ext4_kernel(device, filename, commit);
+
+	if (!run_flash_erase(device, 0, 1))
+		return 0;
+	if (!commit)
+		return 1;
+	sprintf(input_size, "--input-size=%u", kernel_job_head_size);
+	return run_nandwrite(device, filename, 0, input_size);
+}
+
+static void kernel_job_main(char* device, char* filename)
+{
+	char cmd = 0, result;
+	int staged;
+
+	g_fbFd = -1; // only the main process draws
+	die_func = NULL;
+
+	my_printf("Kernel: writing %s to %s in background\n", filename, device);
+	staged = stage_kernel(device, filename);
+	if (staged)
+		my_printf("Kernel: staged, waiting for rootfs\n");
+	else
+		my_printf("Kernel: Error writing kernel\n");
+
+	if (read(kernel_job_cmd_fd, &cmd, 1) != 1)
+		cmd = 0;
+	if (staged && cmd == 'c')
+		result = finish_kernel(device, filename, 1) ? 'c' : 'e';
+	else
+	{
+		// the first block is still the old one: old kernel gets complete again
+		if (!restore_kernel(device))
+		{
+			my_printf("Kernel: Error restoring old kernel\n");
+			// clear header, so the half written kernel isn't booted
+			finish_kernel(device, filename, 0);
+		}
+		result = staged ? 'a' : 'e';
+	}
+	my_printf("Kernel: %s\n", result == 'c' ? "committed" : result == 'a' ? "aborted" : "Error committing kernel");
+	if (write(kernel_job_result_fd, &result, 1) != 1)
+		exit(EXIT_FAILURE);
+	exit(EXIT_SUCCESS);
+}
+
+/* Starts flashing the kernel in background if kernel and rootfs are on
+ * different devices and the kernel can be staged.
+ * Returns 0 if the kernel must be flashed after the rootfs as usual.
+ */
+int kernel_job_start(char* kernel_dev, char* rootfs_dev, char* filename)
+{
+	struct stat kst, rst;
+	int cmd_pipe[2], result_pipe[2];
+	pid_t pid;
+
+	if (stat(kernel_dev, &kst) != 0 || stat(rootfs_dev, &rst) != 0
+	 || !(S_ISBLK(kst.st_mode) || S_ISCHR(kst.st_mode))
+	 || kst.st_rdev == rst.st_rdev)
+		return 0;
+
+	if (kernel_flash_mode == TARBZ2)
+		kernel_job_head_size = KERNEL_HEAD_SIZE;
+	else if (kernel_flash_mode == MTD)
+		kernel_job_head_size = nand_stage_size(kernel_dev);
+	else
+		kernel_job_head_size = 0;
+	if (kernel_job_head_size == 0 || kernel_file_stat.st_size <= kernel_job_head_size)
+		return 0;
+	if (!backup_kernel(kernel_dev))
+	{
+		my_printf("Kernel: Error saving old kernel, flashing kernel after rootfs\n");
+		return 0;
+	}
+
+	if (pipe(cmd_pipe) != 0)
+		goto error;
+	if (pipe(result_pipe) != 0)
+	{
+		close(cmd_pipe[0]);
+		close(cmd_pipe[1]);
+		goto error;
+	}
+
+	pid = fork();
+	if (pid < 0)
+	{
+		my_printf("Error fork failed\n");
+		close(cmd_pipe[0]);
+		close(cmd_pipe[1]);
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		goto error;
+	}
+	if (pid == 0)
+	{
+		close(cmd_pipe[1]);
+		close(result_pipe[0]);
+		kernel_job_cmd_fd = cmd_pipe[0];
+		kernel_job_result_fd = result_pipe[1];
+		// detach, so wait() in busybox doesn't see the job
+		if (fork() != 0)
+			_exit(EXIT_SUCCESS);
+		kernel_job_main(kernel_dev, filename);
+	}
+	waitpid(pid, NULL, 0);
+
+	close(cmd_pipe[0]);
+	close(result_pipe[1]);
+	close(kernel_job_backup_fd); // only used by the job
+	kernel_job_backup_fd = -1;
+	kernel_job_cmd_fd = cmd_pipe[1];
+	kernel_job_result_fd = result_pipe[0];
+	durable_track(kernel_dev);
+	my_printf("Flashing kernel %s in parallel to rootfs\n", kernel_dev);
+	return 1;
+
+error:
+	close(kernel_job_backup_fd);
+	kernel_job_backup_fd = -1;
+	return 0;
+}
+
+/* Tells the kernel job to commit (rootfs was flashed successfully) or to abort
+ * and waits for it. Returns 1 if the kernel was committed.
+ */
+int kernel_job_finish(int commit)
+{
+	char cmd = commit ? 'c' : 'a', result = 0;
+	void (*old_handler)(int);
+
+	if (kernel_job_cmd_fd < 0)
+		return 0;
+
+	set_step(commit ? "Committing kernel" : "Aborting kernel");
+	old_handler = signal(SIGPIPE, SIG_IGN); // job might be dead already
+	if (write(kernel_job_cmd_fd, &cmd, 1) != 1
+	 || safe_read(kernel_job_result_fd, &result, 1) != 1)
+		result = 'e';
+	signal(SIGPIPE, old_handler);
+	close(kernel_job_cmd_fd);
+	close(kernel_job_result_fd);
+	kernel_job_cmd_fd = kernel_job_result_fd = -1;
+
+	return commit && result == 'c';
+}
@@ -12,6 +12,7 @@
 #include <libmtd.h>
 #include <errno.h>
 #include <mtd/mtd-abi.h>
+#include <sys/stat.h>
 
 
 int getFlashType(char* device)
@@ -59,21 +60,23 @@ int flash_erase(char* device, char* context, int quiet, int no_write)
 	return 1;
 }
 
-int flash_erase_jffs2(char* device, char* context, int quiet, int no_write)
+int flash_erase_jffs2(char* device, unsigned long long start, char* context, int quiet, int no_write)
 {
 	optind = 0; // reset getopt_long
+	char start_str[24];
 	char* argv[] = {
 		"flash_erase",	// program name
 		"-j",			// format the device for jffs2
 		device,			// device
-		"0",			// start offset
+		start_str,		// start offset
 		"0",			// block count
 		NULL
 	};
 	int argc = (int)(sizeof(argv) / sizeof(argv[0])) - 1;
 
+	sprintf(start_str, "%llu", start);
 	if (!quiet)
-		my_printf("Erasing %s: flash_erase -j %s 0 0\n", context, device);
+		my_printf("Erasing %s: flash_erase -j %s %s 0\n", context, device, start_str);
 	if (!no_write)
 		if (flash_erase_main(argc, argv) != 0)
 			return 0;
@@ -104,6 +107,47 @@ int flash_write(char* device, char* filename, int quiet, int no_write)
 	return 1;
 }
 
+/* Writes the JFFS2 rootfs, with erase block summaries if requested. A resumed
+ * write continues at flash offset start and input offset input_skip.
+ */
+static int flash_write_jffs2(char* device, char* filename, long long start, long long input_skip, int quiet, int no_write)
+{
+	optind = 0; // reset getopt_long
+	char start_str[24], skip_str[40];
+	char* argv[10];
+	int argc = 0;
+
+	argv[argc++] = "nandwrite";		// program name
+	argv[argc++] = "-pm";			// pad and mark bad blocks
+	if (start || input_skip)
+	{
+		sprintf(start_str, "%lld", start);
+		sprintf(skip_str, "--input-skip=%lld", input_skip);
+		argv[argc++] = "-s";
+		argv[argc++] = start_str;	// flash offset
+		argv[argc++] = skip_str;	// input offset
+	}
+	if (jffs2_summary)
+		argv[argc++] = "--jffs2-summary";
+	argv[argc++] = device;			// device
+	argv[argc++] = filename;		// file to flash
+	argv[argc] = NULL;
+
+	if (!quiet)
+	{
+		char line[1000] = "";
+		int i;
+		for (i = 1; i < argc; i++)
+			snprintf(line + strlen(line), sizeof(line) - strlen(line), " %s", argv[i]);
+		my_printf("Flashing rootfs: nandwrite%s\n", line);
+	}
+	if (!no_write)
+		if (nandwrite_main(argc, argv) != 0)
+			return 0;
+
+	return 1;
+}
+
 int ubi_write(char* device, char* filename, int quiet, int no_write)
 {
 	optind = 0; // reset getopt_long
@@ -169,6 +213,111 @@ int flashcp(char* device, char* filename, int reboot, int quiet, int no_write)
 	return 1;
 }
 
+static int read_block(int fd, char* buf, int len)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		ssize_t ret = read(fd, buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -1 : done;
+		done += ret;
+	}
+	return done;
+}
+
+/* Compares the NAND kernel partition eraseblock by eraseblock with the kernel
+ * file (padded with 0xff like nandwrite does) and only erases and writes the
+ * eraseblocks which differ. Bad blocks are skipped like nandwrite does.
+ * Returns 0 if the kernel must be flashed by flash_erase and nandwrite.
+ */
+static int nand_kernel_compare_write(char* device, char* filename, int quiet, int no_write)
+{
+	struct mtd_dev_info mtd;
+	struct stat st;
+	libmtd_t libmtd;
+	char* file_buf = NULL;
+	char* dev_buf = NULL;
+	long long pos = 0;
+	int dev_fd = -1, file_fd = -1;
+	int eb, changed = 0, ret = 0;
+
+	libmtd = libmtd_open();
+	if (libmtd == NULL)
+		return 0;
+	if (mtd_get_dev_info(libmtd, device, &mtd) != 0 || image_stat(filename, &st) != 0 || st.st_size > mtd.size)
+		goto out;
+	dev_fd = open(device, no_write ? O_RDONLY : O_RDWR);
+	file_fd = image_open(filename);
+	file_buf = malloc(mtd.eb_size);
+	dev_buf = malloc(mtd.eb_size);
+	if (dev_fd < 0 || file_fd < 0 || file_buf == NULL || dev_buf == NULL)
+		goto out;
+
+	set_step("Comparing kernel");
+	for (eb = 0; eb < mtd.eb_cnt; eb++)
+	{
+		int len = 0, data_len, bad;
+
+		bad = mtd_is_bad(&mtd, dev_fd, eb);
+		if (bad > 0)
+			continue;
+		if (bad < 0)
+			goto out;
+
+		if (pos < st.st_size)
+		{
+			len = read_block(file_fd, file_buf, mtd.eb_size);
+			if (len <= 0)
+				goto out;
+			pos += len;
+		}
+		// last page is padded, the rest of the eraseblock stays erased
+		data_len = (len + mtd.min_io_size - 1) / mtd.min_io_size * mtd.min_io_size;
+		memset(&file_buf[len], 0xff, mtd.eb_size - len);
+
+		if (mtd_read(&mtd, dev_fd, eb, 0, dev_buf, mtd.eb_size) == 0
+		 && memcmp(file_buf, dev_buf, mtd.eb_size) == 0)
+			continue;
+
+		changed++;
+		if (!no_write)
+		{
+			if (mtd_erase(libmtd, &mtd, dev_fd, eb) != 0)
+				goto out;
+			telemetry_erase(device, 1);
+			if (data_len && mtd_write(libmtd, &mtd, dev_fd, eb, 0, file_buf, data_len, NULL, 0, 0) != 0)
+				goto out;
+			if (data_len)
+				telemetry_write(device, 1);
+		}
+		set_step_progress(eb * 100 / mtd.eb_cnt);
+	}
+	if (pos < st.st_size) // too many bad blocks
+		goto out;
+
+	if (changed == 0)
+		my_printf("Kernel on %s is already up to date. Skipping kernel write\n", device);
+	else if (!quiet)
+		my_printf("Kernel: %d of %d eraseblocks differ and were written\n", changed, mtd.eb_cnt);
+	ret = 1;
+
+out:
+	if (file_fd >= 0 && !image_close(file_fd))
+		ret = 0;
+	if (!ret)
+		my_printf("Compare and write of kernel failed. Using normal kernel flashing\n");
+	free(file_buf);
+	free(dev_buf);
+	if (dev_fd >= 0)
+		close(dev_fd);
+	libmtd_close(libmtd);
+	return ret;
+}
+
 int flash_ubi_jffs2_kernel(char* device, char* filename, int quiet, int no_write)
 {
 	int type = getFlashType(device);
@@ -178,6 +327,9 @@ int flash_ubi_jffs2_kernel(char* device, char* filename, int quiet, int no_write
 	if (type == MTD_NANDFLASH || type == MTD_MLCNANDFLASH)
 	{
 		my_printf("Found NAND flash\n");
+		if (nand_kernel_compare_write(device, filename, quiet, no_write))
+			return 1;
+
 		// Erase
 		set_step("Erasing kernel");
 		if (!flash_erase(device, "kernel", quiet, no_write))
@@ -221,16 +373,35 @@ int flash_ubi_jffs2_rootfs(char* device, char* filename, enum RootfsTypeEnum roo
 	if ((type == MTD_NANDFLASH || type == MTD_MLCNANDFLASH) && rootfs_type == UBIFS)
 	{
 		my_printf("Found NAND flash\n");
+		if (ubi_volume_update)
+		{
+			int ret = flash_ubi_volume(device, filename, quiet, no_write);
+			if (ret >= 0)
+				return ret;
+			my_printf("UBI volume update not possible, formatting %s\n", device);
+		}
 		if (!ubi_write(device, filename, quiet, no_write))
 			return 0;
 	}
 	else if ((type == MTD_NANDFLASH || type == MTD_MLCNANDFLASH) && rootfs_type == JFFS2)
 	{
+		long long start, input_skip;
 		my_printf("Found NAND flash\n");
-		if (!flash_erase_jffs2(device, "rootfs", quiet, no_write))
-			return 0;
-		if (!flash_write(device, filename, quiet, no_write))
-			return 0;
+		if (!no_write && journal_resume(device, &start, &input_skip))
+		{
+			// blocks behind the resume point were erased by the interrupted run
+			if (!flash_erase_jffs2(device, start, "rootfs", quiet, no_write))
+				return 0;
+			if (!flash_write_jffs2(device, filename, start, input_skip, quiet, no_write))
+				return 0;
+		}
+		else
+		{
+			if (!flash_erase_jffs2(device, 0, "rootfs", quiet, no_write))
+				return 0;
+			if (!flash_write_jffs2(device, filename, 0, 0, quiet, no_write))
+				return 0;
+		}
 	}
 	else if (type == MTD_NORFLASH && rootfs_type == JFFS2)
 	{
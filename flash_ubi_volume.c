@@ -0,0 +1,268 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <mntent.h>
+#include <libubi.h>
+#include <libmtd.h>
+#include <mtd/ubi-media.h>
+#include <mtd_swab.h>
+#include <crc32.h>
+
+/* Rootfs flashing by updating just the rootfs volume of the attached UBI
+ * device (ubiupdatevol) instead of formatting the whole MTD partition.
+ *
+ * Only used if the UBI device already has the layout of the image: for a
+ * raw UBIFS image a volume with the rootfs name and LEB size, for a UBI image
+ * with a single volume the same volume id, name and LEB size and no other
+ * volumes. Only the LEBs of the image are written then.
+ */
+
+#define UBIFS_NODE_MAGIC 0x06101831
+#define UBIFS_SB_NODE    6
+
+int ubiupdatevol_main(int argc, char* const argv[]);
+
+struct ubi_volume_image
+{
+	int peb_size;          // 0: raw UBIFS image
+	int leb_size;
+	int vol_id;            // -1: any
+	char name[UBI_VOL_NAME_MAX + 1];
+	long long bytes;
+};
+
+// volume name of the mounted rootfs "ubi0:rootfs"
+static const char* ubi_volume_name()
+{
+	const char* name = strchr(ubi_fs_name, ':');
+
+	return name && name[1] ? name + 1 : "rootfs";
+}
+
+static int pread_full(int fd, void* buf, int len, off_t offs)
+{
+	int done = 0;
+
+	while (done < len)
+	{
+		ssize_t ret = pread(fd, (char*)buf + done, len - done, offs + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return 0;
+		done += ret;
+	}
+	return 1;
+}
+
+/* UBI image with the layout volume in the first two PEBs and the LEBs of one
+ * dynamic volume in order after them, like ubinize creates it.
+ */
+static int ubi_volume_check_ubi_image(int fd, off_t size, int peb_size, struct ubi_volume_image* img)
+{
+	struct ubi_ec_hdr ec;
+	struct ubi_vid_hdr vid;
+	struct ubi_vtbl_record rec;
+	int vid_offs, data_offs, i, n, vols = 0;
+
+	if (!pread_full(fd, &ec, sizeof(ec), 0) || be32_to_cpu(ec.magic) != UBI_EC_HDR_MAGIC)
+		return 0;
+	vid_offs = be32_to_cpu(ec.vid_hdr_offset);
+	data_offs = be32_to_cpu(ec.data_offset);
+	if (size % peb_size || size / peb_size <= UBI_LAYOUT_VOLUME_EBS
+	 || data_offs >= peb_size || vid_offs + sizeof(vid) > data_offs)
+		return 0;
+
+	for (i = 0; i < UBI_MAX_VOLUMES; i++)
+	{
+		if (!pread_full(fd, &rec, sizeof(rec), data_offs + i * UBI_VTBL_RECORD_SIZE))
+			return 0;
+		if (be32_to_cpu(rec.reserved_pebs) == 0)
+			continue;
+		if (mtd_crc32(UBI_CRC32_INIT, &rec, UBI_VTBL_RECORD_SIZE_CRC) != be32_to_cpu(rec.crc)
+		 || rec.vol_type != UBI_VID_DYNAMIC || be16_to_cpu(rec.name_len) > UBI_VOL_NAME_MAX)
+			return 0;
+		img->vol_id = i;
+		memcpy(img->name, rec.name, be16_to_cpu(rec.name_len));
+		img->name[be16_to_cpu(rec.name_len)] = '\0';
+		vols++;
+	}
+	if (vols != 1)
+		return 0;
+
+	// every PEB after the layout volume holds the next LEB of the volume
+	n = size / peb_size - UBI_LAYOUT_VOLUME_EBS;
+	for (i = 0; i < n; i++)
+	{
+		off_t peb = (off_t)(i + UBI_LAYOUT_VOLUME_EBS) * peb_size;
+		if (!pread_full(fd, &ec, sizeof(ec), peb) || !pread_full(fd, &vid, sizeof(vid), peb + vid_offs)
+		 || be32_to_cpu(ec.magic) != UBI_EC_HDR_MAGIC || be32_to_cpu(ec.data_offset) != data_offs
+		 || be32_to_cpu(vid.magic) != UBI_VID_HDR_MAGIC
+		 || be32_to_cpu(vid.vol_id) != img->vol_id || be32_to_cpu(vid.lnum) != i)
+			return 0;
+	}
+
+	img->peb_size = peb_size;
+	img->leb_size = peb_size - data_offs;
+	img->bytes = (long long)n * img->leb_size;
+	return 1;
+}
+
+static int ubi_volume_check_image(const char* filename, int peb_size, struct ubi_volume_image* img)
+{
+	unsigned char sb[40];
+	struct stat st;
+	int fd, rd, len = 0, ret = 0;
+
+	memset(img, 0, sizeof(*img));
+	if (image_stat(filename, &st) != 0)
+		return 0;
+	fd = image_open(filename);
+	if (fd < 0)
+		return 0;
+	// a raw UBIFS image can also be streamed from a zip archive
+	while (len < sizeof(sb) && (rd = read(fd, sb + len, sizeof(sb) - len)) > 0)
+		len += rd;
+	if (len == sizeof(sb))
+	{
+		if (le32_to_cpu(*(uint32_t*)sb) == UBIFS_NODE_MAGIC && sb[20] == UBIFS_SB_NODE)
+		{
+			img->leb_size = le32_to_cpu(*(uint32_t*)(sb + 36));
+			img->vol_id = -1;
+			strcpy(img->name, ubi_volume_name());
+			img->bytes = st.st_size;
+			ret = 1;
+		}
+		else
+			ret = ubi_volume_check_ubi_image(fd, st.st_size, peb_size, img);
+	}
+	image_close(fd);
+	return ret;
+}
+
+// 1 if the volume is mounted (umount of the old rootfs failed)
+static int ubi_volume_mounted(const struct ubi_vol_info* vi)
+{
+	struct mntent* m;
+	char name[UBI_VOL_NAME_MAX + 1];
+	int dev, vol, mounted = 0;
+	FILE* f = setmntent("/proc/mounts", "r");
+
+	if (f == NULL)
+		return 1;
+	while (!mounted && (m = getmntent(f)) != NULL)
+	{
+		if (strcmp(m->mnt_type, "ubifs") != 0)
+			continue;
+		if (sscanf(m->mnt_fsname, "ubi%d:%127s", &dev, name) == 2)
+			mounted = dev == vi->dev_num && strcmp(name, vi->name) == 0;
+		else if (sscanf(m->mnt_fsname, "ubi%d_%d", &dev, &vol) == 2 || sscanf(m->mnt_fsname, "/dev/ubi%d_%d", &dev, &vol) == 2)
+			mounted = dev == vi->dev_num && vol == vi->vol_id;
+		else
+			mounted = 1; // unknown notation: better format
+	}
+	endmntent(f);
+	return mounted;
+}
+
+/* Finds the volume of the UBI device attached to mtd which matches the image.
+ * Returns 0 if there is none.
+ */
+static int ubi_volume_find(libubi_t libubi, int mtd_num, const struct ubi_volume_image* img, struct ubi_vol_info* vi)
+{
+	struct ubi_info info;
+	struct ubi_dev_info di;
+	int dev;
+
+	if (ubi_get_info(libubi, &info) != 0)
+		return 0;
+	for (dev = info.lowest_dev_num; dev <= info.highest_dev_num; dev++)
+	{
+		if (ubi_get_dev_info1(libubi, dev, &di) != 0 || di.mtd_num != mtd_num)
+			continue;
+		if (ubi_get_vol_info1_nm(libubi, dev, img->name, vi) != 0)
+		{
+			my_printf("UBI volume update: no volume %s on ubi%d\n", img->name, dev);
+			return 0;
+		}
+		if (vi->type != UBI_DYNAMIC_VOLUME || vi->leb_size != img->leb_size || vi->rsvd_bytes < img->bytes
+		 || (img->vol_id >= 0 && (vi->vol_id != img->vol_id || di.vol_count != 1)))
+		{
+			my_printf("UBI volume update: layout of ubi%d doesn't match the image\n", dev);
+			return 0;
+		}
+		if (ubi_volume_mounted(vi))
+		{
+			my_printf("UBI volume update: volume %s is still mounted\n", img->name);
+			return 0;
+		}
+		return 1;
+	}
+	my_printf("UBI volume update: no UBI device attached to mtd%d\n", mtd_num);
+	return 0;
+}
+
+/* Writes the rootfs image into the matching volume of the UBI device attached
+ * to device. Returns 1 on success, 0 on error and -1 if the layout doesn't
+ * match (the device has to be formatted then).
+ */
+int flash_ubi_volume(char* device, char* filename, int quiet, int no_write)
+{
+	struct ubi_volume_image img;
+	struct ubi_vol_info vi;
+	struct mtd_dev_info mtd;
+	libmtd_t libmtd;
+	libubi_t libubi;
+	char node[64], peb_str[40], skip_str[40], line[300] = "";
+	char* argv[6];
+	int argc = 0, found, i;
+
+	libmtd = libmtd_open();
+	if (libmtd == NULL)
+		return -1;
+	found = mtd_get_dev_info(libmtd, device, &mtd) == 0;
+	libmtd_close(libmtd);
+	if (!found || !ubi_volume_check_image(filename, mtd.eb_size, &img))
+	{
+		my_printf("UBI volume update: %s is no UBIFS or single volume UBI image\n", filename);
+		return -1;
+	}
+
+	libubi = libubi_open();
+	if (libubi == NULL)
+		return -1;
+	found = ubi_volume_find(libubi, mtd.mtd_num, &img, &vi);
+	libubi_close(libubi);
+	if (!found)
+		return -1;
+
+	sprintf(node, "/dev/ubi%d_%d", vi.dev_num, vi.vol_id);
+	argv[argc++] = "ubiupdatevol";	// program name
+	if (img.peb_size)
+	{
+		sprintf(peb_str, "--peb-size=%d", img.peb_size);
+		sprintf(skip_str, "--skip=%d", img.peb_size * UBI_LAYOUT_VOLUME_EBS);
+		argv[argc++] = peb_str;		// data from the PEBs of a UBI image
+		argv[argc++] = skip_str;	// behind the layout volume
+	}
+	argv[argc++] = node;			// volume
+	argv[argc++] = filename;		// file to flash
+	argv[argc] = NULL;
+
+	for (i = 1; i < argc; i++)
+		snprintf(line + strlen(line), sizeof(line) - strlen(line), " %s", argv[i]);
+	my_printf("Flashing rootfs: ubiupdatevol%s (%lld of %lld bytes of volume %s)\n", line, img.bytes, vi.rsvd_bytes, vi.name);
+	if (!no_write)
+	{
+		optind = 0; // reset getopt_long
+		if (ubiupdatevol_main(argc, argv) != 0)
+			return 0;
+	}
+
+	return 1;
+}
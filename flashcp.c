@@ -44,6 +44,7 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <linux/reboot.h>
+#include "ofgwrite.h"
 
 typedef int bool;
 #define true 1
@@ -266,9 +267,10 @@ int flashcp_main (int argc,char *argv[])
 	}
 
 	/* get some info about the file we want to copy */
-	fil_fd = safe_open (filename,O_RDONLY);
+	fil_fd = image_open (filename); // changed for ofgwrite: image can be in a zip archive
 	if (fil_fd < 0)
 	{
+		log_printf (LOG_ERROR,"While trying to open %s: %m\n",filename);
 		cleanup;
 		return -1;
 	}
@@ -303,6 +305,7 @@ int flashcp_main (int argc,char *argv[])
 		set_step("Erasing rootfs");
 	else
 		set_step("Erasing kernel");
+	stats_phase ("flashcp erase");
 
 	if (flags & FLAG_VERBOSE)
 	{
@@ -325,6 +328,7 @@ int flashcp_main (int argc,char *argv[])
 				cleanup;
 				return -1;
 			}
+			telemetry_erase(device, 1);
 			erase.start += mtd.erasesize;
 		}
 		log_printf (LOG_NORMAL,"\rErasing blocks: %d/%d (100%%)\n",blocks,blocks);
@@ -341,6 +345,7 @@ int flashcp_main (int argc,char *argv[])
 			cleanup;
 			return -1;
 		}
+		telemetry_erase(device, erase.length / mtd.erasesize);
 	}
 	DEBUG("Erased %u / %luk bytes\n",erase.length,filestat.st_size);
 
@@ -352,6 +357,7 @@ int flashcp_main (int argc,char *argv[])
 		set_step("Writing rootfs");
 	else
 		set_step("Writing kernel");
+	stats_phase ("flashcp write");
 
 	if (flags & FLAG_VERBOSE) log_printf (LOG_NORMAL,"Writing data: 0k/%luk (0%%)",KB (filestat.st_size));
 	size = filestat.st_size;
@@ -401,6 +407,8 @@ int flashcp_main (int argc,char *argv[])
 
 		written += i;
 		size -= i;
+		telemetry_write(device, 1);
+		telemetry_progress(device, written, filestat.st_size);
 	}
 	if (flags & FLAG_VERBOSE)
 		log_printf (LOG_NORMAL,
@@ -413,7 +421,8 @@ int flashcp_main (int argc,char *argv[])
 	 * verify that flash == file data *
 	 **********************************/
 
-	/*ret = safe_rewind (fil_fd,filename);
+	/*stats_phase ("flashcp verify");
+	ret = safe_rewind (fil_fd,filename);
 	if (!ret)
 	{
 		cleanup;
@@ -478,9 +487,19 @@ int flashcp_main (int argc,char *argv[])
 				KB (filestat.st_size));
 	DEBUG("Verified %d / %luk bytes\n",written,filestat.st_size);*/
 
+	/* changed for ofgwrite: CRC error of a zip member is known at the end */
+	ret = image_close (fil_fd);
+	fil_fd = -1;
+	if (!ret)
+	{
+		cleanup ();
+		return -1;
+	}
+
 	if (flags & FLAG_REBOOT)
 	{
 		sleep(3);
+		logger_flush();
 		reboot(LINUX_REBOOT_CMD_RESTART);
 	}
 	//exit (EXIT_SUCCESS);
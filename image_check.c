@@ -0,0 +1,336 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "busybox/include/libbb.h"
+#include "busybox/include/bb_archive.h"
+
+/* Validation of the image files while Neutrino is stopped.
+ *
+ * As soon as the image files are known a background process checks them on
+ * a spare core: against a checksum file beside the image (<image>.sha256 or
+ * <image>.md5, also inside a zip archive) or, without one, by decompressing
+ * the whole stream and walking all tar headers. Stopping the processes,
+ * init 2 and waiting for Neutrino take several seconds anyway. The result is
+ * waited for before pivot_root, so a truncated or corrupt archive is found
+ * while the old rootfs is still untouched and Neutrino can be restarted.
+ *
+ * Like the kernel job it's a detached process with a result pipe. Progress
+ * (0..100) is sent through the pipe too, so a long full decode is shown.
+ */
+
+#define IMAGE_CHECK_BUF_SIZE (128 * 1024)
+
+extern int g_fbFd;
+
+static int image_check_fd = -1; // check -> parent: progress, result
+static int image_check_result = 1;
+static int image_check_percent = -1;
+static time_t image_check_time;
+
+static const struct { const char* suffix; int sha256; } image_check_sums[] = { { ".sha256", 1 }, { ".md5", 0 } };
+
+// 1 once a second: time to send the progress
+static int image_check_due()
+{
+	time_t now = time(NULL);
+
+	if (now == image_check_time)
+		return 0;
+	image_check_time = now;
+	return 1;
+}
+
+// sends the progress to the parent
+static void image_check_progress(long long done, long long total)
+{
+	char percent;
+
+	if (total <= 0 || done < 0)
+		return;
+	percent = done >= total ? 100 : done * 100 / total;
+	if (percent != image_check_percent)
+	{
+		image_check_percent = percent;
+		if (write(image_check_fd, &percent, 1) != 1)
+			return;
+	}
+}
+
+// bytes of the archive consumed so far: read by the decompressor or from fd
+static long long image_check_consumed(int fd)
+{
+	char path[64], line[64];
+	long long rchar = -1;
+	FILE* f;
+
+	if (transformer_pid <= 0)
+		return lseek(fd, 0, SEEK_CUR);
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)transformer_pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "rchar: %lld", &rchar) == 1)
+			break;
+	fclose(f);
+	return rchar;
+}
+
+// reads the whole stream fd (total bytes) into the digest
+static int image_check_digest(int fd, EVP_MD_CTX* mdctx, long long total)
+{
+	static char buf[IMAGE_CHECK_BUF_SIZE];
+	long long done = 0;
+	ssize_t len;
+
+	while ((len = safe_read(fd, buf, sizeof(buf))) > 0)
+	{
+		if (EVP_DigestUpdate(mdctx, buf, len) != 1)
+			return 0;
+		done += len;
+		if (image_check_due())
+			image_check_progress(done, total);
+	}
+	return len == 0;
+}
+
+// index into image_check_sums of the checksum file of filename or -1
+static int image_check_sum_file(const char* filename, char* path, size_t size)
+{
+	struct stat st;
+	int s;
+
+	for (s = 0; s < 2; s++)
+	{
+		snprintf(path, size, "%s%s", filename, image_check_sums[s].suffix);
+		if (image_stat(path, &st) == 0)
+			return s;
+	}
+	return -1;
+}
+
+/* Checks filename against <filename>.sha256 or <filename>.md5 ("<hex digest>"
+ * optionally followed by the file name). Returns -1 if there is no checksum
+ * file.
+ */
+static int image_check_checksum(const char* filename)
+{
+	char path[1100], line[200], hex[2 * EVP_MAX_MD_SIZE + 1];
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len, i;
+	struct stat st;
+	EVP_MD_CTX* mdctx;
+	int s, fd, len, ok;
+
+	s = image_check_sum_file(filename, path, sizeof(path));
+	if (s < 0)
+		return -1;
+
+	fd = image_open(path);
+	if (fd < 0)
+		return 0;
+	len = full_read(fd, line, sizeof(line) - 1);
+	image_close(fd);
+	line[len > 0 ? len : 0] = '\0';
+	line[strcspn(line, " \t\r\n")] = '\0';
+
+	if (image_stat(filename, &st) != 0)
+		st.st_size = 0;
+	mdctx = EVP_MD_CTX_new();
+	fd = image_open(filename);
+	ok = mdctx && fd >= 0
+		&& EVP_DigestInit_ex(mdctx, image_check_sums[s].sha256 ? EVP_sha256() : EVP_md5(), NULL) == 1
+		&& image_check_digest(fd, mdctx, st.st_size)
+		&& EVP_DigestFinal_ex(mdctx, hash, &hash_len) == 1;
+	if (fd >= 0 && !image_close(fd))
+		ok = 0;
+	EVP_MD_CTX_free(mdctx);
+	if (!ok)
+		return 0;
+
+	for (i = 0; i < hash_len; i++)
+		sprintf(hex + 2 * i, "%02x", hash[i]);
+	if (strcasecmp(hex, line) != 0)
+	{
+		my_printf("Image check: %s doesn't match %s\n", filename, path);
+		return 0;
+	}
+	my_printf("Image check: %s matches %s\n", filename, path);
+	return 1;
+}
+
+/* Decompresses the whole archive and walks all tar headers. Errors in the
+ * archive end the process (busybox die).
+ */
+static int image_check_archive(const char* filename, int tar)
+{
+	static char buf[IMAGE_CHECK_BUF_SIZE];
+	archive_handle_t* handle;
+	struct stat st;
+	int headers = 0;
+
+	if (image_stat(filename, &st) != 0)
+		st.st_size = 0;
+
+	handle = init_handle();
+	handle->src_fd = open_zipped(filename, /*fail_if_not_compressed:*/ 0);
+	if (handle->src_fd < 0)
+	{
+		my_printf("Image check: can't open %s\n", filename);
+		free(handle->file_header);
+		free(handle);
+		return 0;
+	}
+	// read all data, also of an uncompressed archive: it can be truncated
+	handle->seek = seek_by_read;
+
+	bb_got_signal = 0;
+	if (tar)
+		while (get_header_tar(handle) == EXIT_SUCCESS)
+		{
+			headers++;
+			if (image_check_due())
+				image_check_progress(image_check_consumed(handle->src_fd), st.st_size);
+		}
+	// rest of the stream: the decompressor has to finish
+	while (safe_read(handle->src_fd, buf, sizeof(buf)) > 0)
+		if (image_check_due())
+			image_check_progress(image_check_consumed(handle->src_fd), st.st_size);
+	close(handle->src_fd);
+	free(handle->ofg_buf);
+	free(handle->file_header);
+	free(handle);
+	check_errors_in_children(0);
+
+	if (bb_got_signal || !image_streams_ok() || (tar && headers == 0))
+	{
+		my_printf("Image check: %s is corrupted\n", filename);
+		return 0;
+	}
+	my_printf("Image check: %s is intact%s\n", filename, tar ? "" : " (decompressed)");
+	return 1;
+}
+
+// without checksum file: 1 tar archive, 2 compressed file, 0 nothing to check
+static int image_check_kind(const char* filename)
+{
+	const char* name = strrchr(filename, '/');
+	const char* ext;
+
+	name = name ? name + 1 : filename;
+	ext = strrchr(name, '.');
+	if (strstr(name, ".tar") != NULL)
+		return 1;
+	if (ext && (strcmp(ext, ".bz2") == 0 || strcmp(ext, ".xz") == 0 || strcmp(ext, ".gz") == 0))
+		return 2;
+	return 0;
+}
+
+static int image_check_file(const char* filename)
+{
+	int ret = image_check_checksum(filename);
+
+	if (ret >= 0)
+		return ret;
+	switch (image_check_kind(filename))
+	{
+	case 1:
+		return image_check_archive(filename, 1);
+	case 2:
+		return image_check_archive(filename, 0);
+	}
+	return 1; // nothing to check
+}
+
+static void image_check_main(char* kernel, char* rootfs)
+{
+	char result;
+
+	g_fbFd = -1; // only the main process draws
+	telemetry_detach();
+	die_func = NULL;
+	applet_name = "image check"; // prefix of busybox error messages
+	setsid();
+	setpriority(PRIO_PROCESS, 0, 10); // stopping Neutrino comes first
+
+	result = (!rootfs || image_check_file(rootfs)) && (!kernel || image_check_file(kernel)) ? 'o' : 'e';
+	if (write(image_check_fd, &result, 1) != 1)
+		exit(EXIT_FAILURE);
+	exit(EXIT_SUCCESS);
+}
+
+/* Starts checking the rootfs and kernel file (NULL: not flashed) in
+ * background. Returns 0 if the check couldn't be started.
+ */
+int image_check_start(char* kernel, char* rootfs)
+{
+	int result_pipe[2];
+	pid_t pid;
+
+	if (pipe(result_pipe) != 0)
+		return 0;
+
+	pid = fork();
+	if (pid < 0)
+	{
+		my_printf("Error fork failed\n");
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		return 0;
+	}
+	if (pid == 0)
+	{
+		close(result_pipe[0]);
+		image_check_fd = result_pipe[1];
+		// detach, so wait() in busybox doesn't see the check
+		if (fork() != 0)
+			_exit(EXIT_SUCCESS);
+		image_check_main(kernel, rootfs);
+	}
+	waitpid(pid, NULL, 0);
+
+	close(result_pipe[1]);
+	image_check_fd = result_pipe[0];
+	my_printf("Checking image files in background\n");
+	return 1;
+}
+
+/* Waits for the result of the image check and shows its progress. Returns 1
+ * if the images are intact or no check was started.
+ */
+int image_check_finish()
+{
+	char result = 0;
+
+	if (image_check_fd < 0)
+		return image_check_result;
+
+	my_printf("Waiting for image check\n");
+	while (1)
+	{
+		if (safe_read(image_check_fd, &result, 1) != 1)
+		{
+			result = 'e';
+			break;
+		}
+		if (result < 0 || result > 100)
+			break;
+		set_step_progress(result);
+	}
+	close(image_check_fd);
+	image_check_fd = -1;
+	image_check_result = result == 'o';
+	my_printf("Image check %s\n", image_check_result ? "passed" : "failed");
+	return image_check_result;
+}
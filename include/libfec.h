@@ -0,0 +1,23 @@
+/*
+ * Forward error correction based on Vandermonde matrices (lib/libfec.c)
+ * (C) 1997-98 Luigi Rizzo (luigi@iet.unipi.it)
+ */
+
+#ifndef __LIBFEC_H__
+#define __LIBFEC_H__
+
+struct fec_parms;
+
+/* k data packets, n - k parity packets (n <= 256) */
+struct fec_parms *fec_new(int k, int n);
+void fec_free(struct fec_parms *p);
+
+/* packet index (0 .. n-1) of the k source packets src[] of size sz */
+void fec_encode(struct fec_parms *code, unsigned char *src[], unsigned char *fec, int index, int sz);
+
+/* k received packets pkt[] with their indexes index[] are decoded in place:
+ * pkt[i] is data packet i then. Returns 0 on success.
+ */
+int fec_decode(struct fec_parms *code, unsigned char *pkt[], int index[], int sz);
+
+#endif /* __LIBFEC_H__ */
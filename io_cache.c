@@ -0,0 +1,157 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/* Page cache handling for boxes with little RAM.
+ *
+ * Image files are read only once, so their pages are dropped behind the
+ * read cursor. Written data is pushed to the device early (write-behind) and
+ * dropped afterwards, so dirty pages don't pile up until the kernel has to
+ * reclaim them in one go. If MemAvailable still gets low, flashing is
+ * throttled until writeback caught up.
+ */
+
+#define IO_DROP_INTERVAL  (4 * 1024 * 1024) // source: drop cache every 4 MiB read
+#define IO_WINDOW_SIZE    (4 * 1024 * 1024) // target: write-behind window
+#define IO_CHECK_INTERVAL 50                // ms between /proc/meminfo checks
+#define IO_MAX_DELAY      320               // ms
+#define IO_MIN_AVAILABLE  (16 * 1024)       // kB
+
+static long long io_source_bytes;
+static int io_target_fd = -1;
+static off_t io_target_window;
+static long long io_last_check;
+static int io_delay;
+static int io_throttled;
+
+static long long io_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// returns 1 if MemAvailable is below 1/8 of the RAM
+static int io_memory_low()
+{
+	char line[128];
+	long long total = 0, available = -1, free_mem = 0, cached = 0, value;
+	FILE* f = fopen("/proc/meminfo", "r");
+
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "MemTotal: %lld", &value) == 1)
+			total = value;
+		else if (sscanf(line, "MemAvailable: %lld", &value) == 1)
+			available = value;
+		else if (sscanf(line, "MemFree: %lld", &value) == 1)
+			free_mem = value;
+		else if (sscanf(line, "Cached: %lld", &value) == 1)
+			cached = value;
+	}
+	fclose(f);
+	if (available < 0) // kernel < 3.14
+		available = free_mem + cached;
+	return available < (total / 8 > IO_MIN_AVAILABLE ? total / 8 : IO_MIN_AVAILABLE);
+}
+
+/* Waits for writeback of the current target while memory is low. The delay grows while the
+ * memory stays low and shrinks again afterwards.
+ */
+void io_throttle()
+{
+	long long now = io_now_ms();
+	int waited = 0;
+
+	if (now - io_last_check < IO_CHECK_INTERVAL)
+		return;
+	io_last_check = now;
+
+	while (io_memory_low())
+	{
+		if (!io_throttled)
+			my_printf("Low memory: throttling flash writes\n");
+		io_throttled = 1;
+		// only the current target, a global sync() would also flush unrelated
+		// filesystems; without a target the kernel's writeback is waited for
+		if (io_target_fd >= 0)
+			sync_file_range(io_target_fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		io_delay = io_delay ? io_delay * 2 : 10;
+		if (io_delay > IO_MAX_DELAY)
+			io_delay = IO_MAX_DELAY;
+		usleep(io_delay * 1000);
+		waited += io_delay;
+		if (waited >= 10 * IO_MAX_DELAY) // writeback doesn't help, go on
+			break;
+	}
+	if (!waited)
+		io_delay /= 2;
+	io_last_check = io_now_ms();
+}
+
+// image file opened for reading
+void io_source_open(int fd)
+{
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+// len bytes were read from the image file
+void io_source_read(int fd, long long len)
+{
+	off_t pos;
+
+	if (len <= 0)
+		return;
+	io_source_bytes += len;
+	if (io_source_bytes < IO_DROP_INTERVAL)
+		return;
+	io_source_bytes = 0;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos > 0) // not for pipes
+		posix_fadvise(fd, 0, pos, POSIX_FADV_DONTNEED);
+	io_throttle();
+}
+
+/* Data was written up to pos. Writeback of the current window is started,
+ * the previous window is waited for and dropped from the cache.
+ */
+void io_target_written(int fd, off_t pos)
+{
+	off_t window = pos / IO_WINDOW_SIZE * IO_WINDOW_SIZE;
+
+	if (fd != io_target_fd)
+	{
+		io_target_fd = fd;
+		io_target_window = 0;
+	}
+	if (window <= io_target_window)
+		return;
+
+	if (io_target_window > 0)
+	{
+		off_t prev = io_target_window - IO_WINDOW_SIZE;
+		sync_file_range(fd, prev, IO_WINDOW_SIZE, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, prev, IO_WINDOW_SIZE, POSIX_FADV_DONTNEED);
+	}
+	sync_file_range(fd, io_target_window, window - io_target_window, SYNC_FILE_RANGE_WRITE);
+	io_target_window = window;
+	io_throttle();
+}
+
+// target file is complete: start its writeback without waiting
+void io_target_done(int fd)
+{
+	sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+	if (fd == io_target_fd)
+		io_target_fd = -1;
+	io_throttle();
+}
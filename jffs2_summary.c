@@ -0,0 +1,394 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/jffs2.h>
+#include <crc32.h>
+
+/* Adds JFFS2 erase block summaries to an image while it's written.
+ *
+ * Works like sumtool on the stream: the nodes of the image are packed into
+ * eraseblocks and every eraseblock gets a summary node at its end listing
+ * its inode, dirent and xattr nodes. The kernel (CONFIG_JFFS2_SUMMARY) then
+ * reads just the summary of each eraseblock on mount instead of scanning all
+ * nodes. Padding, cleanmarker and old summary nodes are dropped. Eraseblocks
+ * with unknown node types get no summary and are scanned as before.
+ *
+ * The output is produced one eraseblock at a time, so it's a bit longer than
+ * the input. Images without JFFS2 magic are passed through unchanged.
+ */
+
+#define SUM_MAGIC        0x02851885
+#define SUM_NODE_SIZE    32 // struct jffs2_raw_summary
+#define SUM_MARKER_SIZE  8  // struct jffs2_sum_marker
+#define SUM_INODE_SIZE   18 // struct jffs2_sum_inode_flash
+#define SUM_DIRENT_SIZE  24 // struct jffs2_sum_dirent_flash without name
+#define SUM_XATTR_SIZE   18 // struct jffs2_sum_xattr_flash
+#define SUM_XREF_SIZE    6  // struct jffs2_sum_xref_flash
+#define NODE_HDR_SIZE    12 // struct jffs2_unknown_node
+#define PAD(x)           (((x) + 3) & ~3)
+
+struct jffs2_sum
+{
+	int fd;
+	int eb_size;
+	int big_endian;
+	int raw;               // no JFFS2 image: pass through
+	int eof;
+
+	unsigned char* in;     // 2 eraseblocks of input
+	int in_pos, in_len;
+	long long input_pos;   // consumed input bytes
+
+	unsigned char* out;    // current output eraseblock
+	int out_pos, out_len;
+	long long output_pos;  // bytes handed out by jffs2_sum_read()
+
+	unsigned char* sum;    // summary entries of the current eraseblock
+	int sum_size, sum_num;
+};
+
+static uint32_t sum_get16(struct jffs2_sum* s, const unsigned char* p)
+{
+	return s->big_endian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static uint32_t sum_get32(struct jffs2_sum* s, const unsigned char* p)
+{
+	return s->big_endian ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+						 : p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned char* sum_put16(struct jffs2_sum* s, unsigned char* p, uint32_t v)
+{
+	p[s->big_endian ? 0 : 1] = v >> 8;
+	p[s->big_endian ? 1 : 0] = v;
+	return p + 2;
+}
+
+static unsigned char* sum_put32(struct jffs2_sum* s, unsigned char* p, uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		p[s->big_endian ? 3 - i : i] = v >> (i * 8);
+	return p + 4;
+}
+
+// makes at least len bytes of input available. Returns 0 at the end of the image
+static int sum_fill(struct jffs2_sum* s, int len)
+{
+	ssize_t rd;
+
+	if (s->in_len - s->in_pos >= len)
+		return 1;
+	memmove(s->in, s->in + s->in_pos, s->in_len - s->in_pos);
+	s->in_len -= s->in_pos;
+	s->in_pos = 0;
+	while (!s->eof && s->in_len < len)
+	{
+		rd = read(s->fd, s->in + s->in_len, 2 * s->eb_size - s->in_len);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd < 0)
+		{
+			my_printf("Error reading JFFS2 image: %s\n", strerror(errno));
+			return -1;
+		}
+		if (rd == 0)
+			s->eof = 1;
+		s->in_len += rd;
+	}
+	return s->in_len >= len;
+}
+
+static void sum_consume(struct jffs2_sum* s, int len)
+{
+	s->in_pos += len;
+	s->input_pos += len;
+}
+
+/* Finds the next node to keep. Returns 1 with the node at s->in + s->in_pos,
+ * 0 at the end of the image and -1 on error.
+ */
+static int sum_next_node(struct jffs2_sum* s)
+{
+	const unsigned char* p;
+	uint32_t type, totlen;
+	int ret;
+
+	for (;;)
+	{
+		ret = sum_fill(s, NODE_HDR_SIZE);
+		if (ret <= 0)
+			return ret;
+		p = s->in + s->in_pos;
+		if (sum_get16(s, p) != JFFS2_MAGIC_BITMASK) // erased, padding or garbage
+		{
+			sum_consume(s, 4);
+			continue;
+		}
+		type = sum_get16(s, p + 2);
+		totlen = sum_get32(s, p + 4);
+		if (mtd_crc32(0, p, NODE_HDR_SIZE - 4) != sum_get32(s, p + 8)
+		 || totlen < NODE_HDR_SIZE || totlen > s->eb_size)
+		{
+			sum_consume(s, 4);
+			continue;
+		}
+		ret = sum_fill(s, totlen);
+		if (ret < 0)
+			return ret;
+		if (ret == 0) // cut at the end of the image
+		{
+			sum_consume(s, 4);
+			continue;
+		}
+		if (type == JFFS2_NODETYPE_CLEANMARKER || type == JFFS2_NODETYPE_PADDING
+		 || type == JFFS2_NODETYPE_SUMMARY)
+		{
+			sum_consume(s, PAD(totlen) <= s->in_len - s->in_pos ? PAD(totlen) : totlen);
+			continue;
+		}
+		return 1;
+	}
+}
+
+// size of the summary entry of node p, 0 if the node type can't be summarized
+static int sum_entry_size(struct jffs2_sum* s, const unsigned char* p)
+{
+	switch (sum_get16(s, p + 2))
+	{
+		case JFFS2_NODETYPE_INODE:
+			return SUM_INODE_SIZE;
+		case JFFS2_NODETYPE_DIRENT:
+			return SUM_DIRENT_SIZE + p[offsetof(struct jffs2_raw_dirent, nsize)];
+		case JFFS2_NODETYPE_XATTR:
+			return SUM_XATTR_SIZE;
+		case JFFS2_NODETYPE_XREF:
+			return SUM_XREF_SIZE;
+	}
+	return 0;
+}
+
+static void sum_add_entry(struct jffs2_sum* s, const unsigned char* p, uint32_t ofs)
+{
+	unsigned char* e = s->sum + s->sum_size;
+	uint32_t type = sum_get16(s, p + 2);
+	uint32_t totlen = sum_get32(s, p + 4);
+	int nsize;
+
+	e = sum_put16(s, e, type);
+	switch (type)
+	{
+		case JFFS2_NODETYPE_INODE:
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_inode, ino)));
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_inode, version)));
+			e = sum_put32(s, e, ofs);
+			e = sum_put32(s, e, totlen);
+			break;
+		case JFFS2_NODETYPE_DIRENT:
+			nsize = p[offsetof(struct jffs2_raw_dirent, nsize)];
+			e = sum_put32(s, e, totlen);
+			e = sum_put32(s, e, ofs);
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_dirent, pino)));
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_dirent, version)));
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_dirent, ino)));
+			*e++ = nsize;
+			*e++ = p[offsetof(struct jffs2_raw_dirent, type)];
+			memcpy(e, p + sizeof(struct jffs2_raw_dirent), nsize);
+			e += nsize;
+			break;
+		case JFFS2_NODETYPE_XATTR:
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_xattr, xid)));
+			e = sum_put32(s, e, sum_get32(s, p + offsetof(struct jffs2_raw_xattr, version)));
+			e = sum_put32(s, e, ofs);
+			e = sum_put32(s, e, totlen);
+			break;
+		case JFFS2_NODETYPE_XREF:
+			e = sum_put32(s, e, ofs);
+			break;
+	}
+	s->sum_size = e - s->sum;
+	s->sum_num++;
+}
+
+// summary node from ofs to the end of the eraseblock, marker at the very end
+static void sum_write_summary(struct jffs2_sum* s, int ofs)
+{
+	unsigned char* node = s->out + ofs;
+	unsigned char* data = node + SUM_NODE_SIZE;
+	int datasize = s->eb_size - ofs - SUM_NODE_SIZE;
+	unsigned char* p;
+
+	memcpy(data, s->sum, s->sum_size);
+	memset(data + s->sum_size, 0xff, datasize - s->sum_size);
+	p = sum_put32(s, data + datasize - SUM_MARKER_SIZE, ofs);
+	sum_put32(s, p, SUM_MAGIC);
+
+	p = sum_put16(s, node, JFFS2_MAGIC_BITMASK);
+	p = sum_put16(s, p, JFFS2_NODETYPE_SUMMARY);
+	p = sum_put32(s, p, s->eb_size - ofs);
+	p = sum_put32(s, p, mtd_crc32(0, node, NODE_HDR_SIZE - 4));
+	p = sum_put32(s, p, s->sum_num);
+	p = sum_put32(s, p, 0); // cln_mkr: NAND has the cleanmarker in OOB
+	p = sum_put32(s, p, 0); // padded: padding nodes are dropped
+	p = sum_put32(s, p, mtd_crc32(0, data, datasize));
+	sum_put32(s, p, mtd_crc32(0, node, SUM_NODE_SIZE - 8));
+}
+
+// packs the next output eraseblock. Returns 0 at the end of the image
+static int sum_next_block(struct jffs2_sum* s)
+{
+	int ofs = 0, summary = 1, ret;
+
+	memset(s->out, 0xff, s->eb_size);
+	s->sum_size = 0;
+	s->sum_num = 0;
+	while ((ret = sum_next_node(s)) > 0)
+	{
+		const unsigned char* p = s->in + s->in_pos;
+		uint32_t totlen = sum_get32(s, p + 4);
+		int entry = sum_entry_size(s, p);
+		int len = PAD(totlen) <= s->in_len - s->in_pos ? PAD(totlen) : totlen;
+		int need = PAD(len);
+
+		if (entry == 0 || need + SUM_NODE_SIZE + entry + SUM_MARKER_SIZE > s->eb_size)
+			summary = 0; // the kernel would miss nodes not listed in the summary
+		if (summary)
+			need += SUM_NODE_SIZE + s->sum_size + entry + SUM_MARKER_SIZE;
+		if (ofs + need > s->eb_size)
+		{
+			if (ofs == 0)
+				summary = 0;
+			else
+				break; // node goes to the next eraseblock
+		}
+		memcpy(s->out + ofs, p, len);
+		if (summary)
+			sum_add_entry(s, p, ofs);
+		ofs += PAD(len);
+		sum_consume(s, len);
+	}
+	if (ret < 0)
+		return -1;
+	if (ofs == 0)
+		return 0;
+	if (summary && s->sum_num)
+		sum_write_summary(s, ofs);
+	s->out_pos = 0;
+	s->out_len = s->eb_size;
+	return 1;
+}
+
+/* Starts adding summaries to the JFFS2 image read from fd, which is written
+ * to eraseblocks of eb_size bytes.
+ */
+struct jffs2_sum* jffs2_sum_open(int fd, int eb_size)
+{
+	struct jffs2_sum* s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+	s->fd = fd;
+	s->eb_size = eb_size;
+	s->in = malloc(2 * eb_size);
+	s->out = malloc(eb_size);
+	s->sum = malloc(eb_size);
+	if (s->in == NULL || s->out == NULL || s->sum == NULL || sum_fill(s, 2) < 0)
+	{
+		jffs2_sum_close(s);
+		return NULL;
+	}
+
+	if (s->in_len >= 2 && s->in[0] == 0x19 && s->in[1] == 0x85)
+		s->big_endian = 1;
+	else if (s->in_len < 2 || s->in[0] != 0x85 || s->in[1] != 0x19)
+	{
+		my_printf("Image has no JFFS2 magic, writing it without summary\n");
+		s->raw = 1;
+	}
+	return s;
+}
+
+// like read(): the summarized image
+ssize_t jffs2_sum_read(struct jffs2_sum* s, void* buf, size_t len)
+{
+	int n;
+
+	if (s->raw)
+	{
+		if (s->in_pos == s->in_len)
+		{
+			n = read(s->fd, buf, len);
+			if (n > 0)
+			{
+				s->input_pos += n;
+				s->output_pos += n;
+			}
+			return n;
+		}
+		n = s->in_len - s->in_pos < len ? s->in_len - s->in_pos : len;
+		memcpy(buf, s->in + s->in_pos, n);
+		sum_consume(s, n);
+		s->output_pos += n;
+		return n;
+	}
+
+	if (s->out_pos == s->out_len)
+	{
+		n = sum_next_block(s);
+		if (n <= 0)
+		{
+			errno = EIO;
+			return n;
+		}
+	}
+	n = s->out_len - s->out_pos < len ? s->out_len - s->out_pos : len;
+	memcpy(buf, s->out + s->out_pos, n);
+	s->out_pos += n;
+	s->output_pos += n;
+	return n;
+}
+
+// skips len bytes of the summarized image (resuming an interrupted write)
+int jffs2_sum_skip(struct jffs2_sum* s, long long len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = jffs2_sum_read(s, buf, len > sizeof(buf) ? sizeof(buf) : len);
+		if (n <= 0)
+			return 0;
+		len -= n;
+	}
+	return 1;
+}
+
+// consumed input bytes, for progress
+long long jffs2_sum_input_pos(struct jffs2_sum* s)
+{
+	return s->input_pos;
+}
+
+// bytes of the summarized image read so far
+long long jffs2_sum_output_pos(struct jffs2_sum* s)
+{
+	return s->output_pos;
+}
+
+void jffs2_sum_close(struct jffs2_sum* s)
+{
+	if (s == NULL)
+		return;
+	free(s->in);
+	free(s->out);
+	free(s->sum);
+	free(s);
+}
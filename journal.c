@@ -0,0 +1,285 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <openssl/evp.h>
+
+/* Progress journal for resuming an interrupted rootfs flash.
+ *
+ * The journal is an append-only text file next to the image (USB stick or
+ * image directory). The first line identifies the image and the target
+ * device with the multiboot slot (several slots share a device with
+ * rootSubDir and kexec), every further line is a committed resume point "<pos> <input>":
+ *   ubiformat: next eraseblock, eraseblocks read from the image
+ *   nandwrite: next flash offset, input offset
+ *   tar:       extracted archive entries, 0
+ * A point is only written after the data up to it is on the medium. It's
+ * removed after a successful flash. If a journal for the same image and
+ * device is found on start, flashing continues from the last point.
+ */
+
+#define JOURNAL_NAME        ".ofgwrite_journal"
+#define JOURNAL_VERSION     2
+#define JOURNAL_INTERVAL_MS 2000
+#define JOURNAL_HASH_DATA   (1024 * 1024) // hashed bytes from image start
+
+static int journal_fd = -1;
+static char journal_path[1100];
+static char journal_device[1000];
+static int journal_resuming;
+static long long journal_resume_pos;
+static long long journal_resume_input;
+static long long journal_last_ms;
+
+static const char* journal_tar_sync_path;
+static long long journal_tar_entries;
+
+static long long journal_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Identifies the image: sha1 of name, size, mtime and the first MiB.
+ * Hashing the whole image would take as long as flashing it.
+ */
+static int journal_image_hash(const char* filename, char* hex)
+{
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_len, i;
+	struct stat st;
+	char* buf;
+	EVP_MD_CTX* mdctx;
+	ssize_t len, done = 0;
+	int fd;
+
+	if (image_stat(filename, &st) != 0)
+		return 0;
+	buf = malloc(JOURNAL_HASH_DATA);
+	mdctx = EVP_MD_CTX_new();
+	fd = image_open(filename);
+	if (buf == NULL || mdctx == NULL || fd < 0)
+	{
+		free(buf);
+		if (mdctx)
+			EVP_MD_CTX_free(mdctx);
+		if (fd >= 0)
+			image_close(fd);
+		return 0;
+	}
+
+	EVP_DigestInit_ex(mdctx, EVP_sha1(), NULL);
+	EVP_DigestUpdate(mdctx, filename, strlen(filename));
+	EVP_DigestUpdate(mdctx, &st.st_size, sizeof(st.st_size));
+	EVP_DigestUpdate(mdctx, &st.st_mtime, sizeof(st.st_mtime));
+	while (done < JOURNAL_HASH_DATA && (len = read(fd, buf + done, JOURNAL_HASH_DATA - done)) > 0)
+		done += len;
+	EVP_DigestUpdate(mdctx, buf, done);
+	EVP_DigestFinal_ex(mdctx, digest, &digest_len);
+	EVP_MD_CTX_free(mdctx);
+	image_close(fd);
+	free(buf);
+
+	for (i = 0; i < digest_len; i++)
+		sprintf(hex + i * 2, "%02x", digest[i]);
+	return 1;
+}
+
+// reads the last complete resume point of a journal with the given header
+static int journal_read(const char* header)
+{
+	char line[3200];
+	long long pos, input;
+	int found = 0;
+	FILE* f = fopen(journal_path, "r");
+
+	if (f == NULL)
+		return 0;
+	if (fgets(line, sizeof(line), f) && strcmp(line, header) == 0)
+	{
+		while (fgets(line, sizeof(line), f))
+		{
+			// a line cut by power loss has no newline
+			if (line[strlen(line) - 1] == '\n' && sscanf(line, "%lld %lld", &pos, &input) == 2)
+			{
+				journal_resume_pos = pos;
+				journal_resume_input = input;
+				found = 1;
+			}
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+/* Opens the journal for flashing image filename to device. Journal errors
+ * aren't fatal, flashing just can't be resumed then.
+ */
+void journal_open(const char* image_dir, const char* filename, const char* device)
+{
+	char header[3200], hash[2 * EVP_MAX_MD_SIZE + 1];
+	char dir[1000];
+	struct stat st;
+
+	journal_resuming = 0;
+	if (image_dir == NULL || !journal_image_hash(filename, hash))
+		return;
+
+	// journal beside the image, for a zip beside the zip file
+	strncpy(dir, image_dir, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	if (stat(dir, &st) == 0 && S_ISREG(st.st_mode))
+		strcpy(dir, dirname(dir));
+	snprintf(journal_path, sizeof(journal_path), "%s/%s", dir, JOURNAL_NAME);
+	snprintf(header, sizeof(header), "ofgwrite journal %d %s %s %s %s %d\n", JOURNAL_VERSION, hash, device,
+			 rootfs_sub_dir[0] ? rootfs_sub_dir : "-", current_rootfs_sub_dir[0] ? current_rootfs_sub_dir : "-", multiboot_partition);
+
+	if (journal_read(header))
+	{
+		journal_resuming = 1;
+		journal_fd = open(journal_path, O_WRONLY | O_APPEND);
+		my_printf("Found journal %s: resuming interrupted flash of %s\n", journal_path, device);
+	}
+	else
+	{
+		journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (journal_fd >= 0 && (write(journal_fd, header, strlen(header)) != strlen(header) || fdatasync(journal_fd) != 0))
+		{
+			close(journal_fd);
+			journal_fd = -1;
+		}
+	}
+	if (journal_fd < 0)
+	{
+		my_printf("Can't write journal %s: flashing can't be resumed\n", journal_path);
+		journal_resuming = 0;
+		return;
+	}
+	strncpy(journal_device, device, sizeof(journal_device) - 1);
+	journal_last_ms = journal_now_ms();
+}
+
+// removes the journal after success, keeps it for the next try otherwise
+void journal_close(int success)
+{
+	if (journal_fd < 0)
+		return;
+	close(journal_fd);
+	journal_fd = -1;
+	journal_resuming = 0;
+	journal_tar_sync_path = NULL;
+	if (success && unlink(journal_path) != 0)
+		my_printf("Error removing journal %s: %s\n", journal_path, strerror(errno));
+}
+
+/* Returns 1 and the last committed point if an interrupted flash of device
+ * is continued. A point is only handed out once.
+ */
+int journal_resume(const char* device, long long* pos, long long* input)
+{
+	if (journal_fd < 0 || !journal_resuming || strcmp(device, journal_device) != 0)
+		return 0;
+	journal_resuming = 0;
+	*pos = journal_resume_pos;
+	*input = journal_resume_input;
+	my_printf("Resuming %s at %lld (input %lld)\n", device, *pos, *input);
+	return 1;
+}
+
+static void journal_append(long long pos, long long input)
+{
+	char line[64];
+	int len = sprintf(line, "%lld %lld\n", pos, input);
+
+	if (write(journal_fd, line, len) != len || fdatasync(journal_fd) != 0)
+	{
+		my_printf("Error writing journal %s: flashing can't be resumed\n", journal_path);
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	journal_last_ms = journal_now_ms();
+}
+
+/* Everything before pos/input of device is on the medium. Written at most
+ * every JOURNAL_INTERVAL_MS to keep the journal small and cheap.
+ */
+void journal_progress(const char* device, long long pos, long long input)
+{
+	if (journal_fd < 0 || strcmp(device, journal_device) != 0
+	 || journal_now_ms() - journal_last_ms < JOURNAL_INTERVAL_MS)
+		return;
+	journal_append(pos, input);
+}
+
+/* Starts counting extracted tar entries. sync_path is the filesystem the
+ * entries are written to. Returns the number of entries to skip.
+ */
+long long journal_tar_start(const char* device, const char* sync_path)
+{
+	long long entries = 0, unused;
+
+	if (journal_fd < 0)
+		return 0;
+	journal_resume(device, &entries, &unused);
+	journal_tar_sync_path = sync_path;
+	journal_tar_entries = 0;
+	journal_resume_pos = entries;
+	return entries;
+}
+
+// returns 1 if the next tar entry was already extracted before
+int journal_tar_skip()
+{
+	if (journal_tar_sync_path == NULL || journal_tar_entries >= journal_resume_pos)
+		return 0;
+	journal_tar_entries++;
+	return 1;
+}
+
+// one tar entry was extracted
+void journal_tar_entry()
+{
+	int fd;
+
+	if (journal_fd < 0 || journal_tar_sync_path == NULL)
+		return;
+	journal_tar_entries++;
+	if (journal_now_ms() - journal_last_ms < JOURNAL_INTERVAL_MS)
+		return;
+	fd = open(journal_tar_sync_path, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+	if (syncfs(fd) == 0)
+		journal_append(journal_tar_entries, 0);
+	close(fd);
+}
+
+void journal_tar_stop()
+{
+	journal_tar_sync_path = NULL;
+}
+
+// skips len bytes of input, also for pipes
+int journal_skip_input(int fd, long long len)
+{
+	char buf[4096];
+
+	if (lseek(fd, len, SEEK_CUR) >= 0)
+		return 1;
+	while (len > 0)
+	{
+		ssize_t n = read(fd, buf, len > sizeof(buf) ? sizeof(buf) : len);
+		if (n <= 0)
+			return 0;
+		len -= n;
+	}
+	return 1;
+}
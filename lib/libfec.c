@@ -326,13 +326,113 @@ generate_gf(void)
 #define addmul(dst, src, c, sz) \
     if (c != 0) addmul1(dst, src, c, sz)
 
+/*
+ * changed for ofgwrite: split table multiply with SIMD byte shuffles.
+ * c * x = c * (x & 0x0f) ^ c * (x & 0xf0), so two 16 entry tables per
+ * constant are enough and 16 bytes are multiplied with one table lookup
+ * (pshufb, vtbl) per nibble. addmul_simd() returns the number of bytes
+ * done, the rest is done by the scalar loop.
+ */
+#if (GF_BITS <= 8) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_ADDMUL_SIMD
+#define ADDMUL_SIMD_TARGET __attribute__((target("ssse3")))
+#define addmul_simd_supported() __builtin_cpu_supports("ssse3")
+#elif (GF_BITS <= 8) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_ADDMUL_SIMD
+#define ADDMUL_SIMD_TARGET
+#define addmul_simd_supported() 1
+#endif
+
+#ifdef HAVE_ADDMUL_SIMD
+static int addmul_simd_ok = 0 ;
+
+static void
+gf_split_tables(gf c, gf *lo, gf *hi)
+{
+    int i ;
+
+    for (i = 0; i < 16; i++) {
+	lo[i] = gf_mul(c, i) ;
+	hi[i] = gf_mul(c, i << 4) ;
+    }
+}
+
+ADDMUL_SIMD_TARGET static int
+addmul_simd(gf *dst, gf *src, gf c, int sz)
+{
+    gf lo[16], hi[16] ;
+    int i ;
+
+    gf_split_tables(c, lo, hi) ;
+#if defined(__x86_64__) || defined(__i386__)
+    {
+	__m128i tlo = _mm_loadu_si128((__m128i *)lo) ;
+	__m128i thi = _mm_loadu_si128((__m128i *)hi) ;
+	__m128i mask = _mm_set1_epi8(0x0f) ;
+
+	for (i = 0; i + 16 <= sz; i += 16) {
+	    __m128i s = _mm_loadu_si128((__m128i *)(src + i)) ;
+	    __m128i d = _mm_loadu_si128((__m128i *)(dst + i)) ;
+	    __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)) ;
+	    __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)) ;
+	    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h))) ;
+	}
+    }
+#elif defined(__aarch64__)
+    {
+	uint8x16_t tlo = vld1q_u8(lo), thi = vld1q_u8(hi) ;
+	uint8x16_t mask = vdupq_n_u8(0x0f) ;
+
+	for (i = 0; i + 16 <= sz; i += 16) {
+	    uint8x16_t s = vld1q_u8(src + i) ;
+	    uint8x16_t l = vqtbl1q_u8(tlo, vandq_u8(s, mask)) ;
+	    uint8x16_t h = vqtbl1q_u8(thi, vshrq_n_u8(s, 4)) ;
+	    vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(l, h))) ;
+	}
+    }
+#else /* ARMv7 NEON: 8 byte table lookups */
+    {
+	uint8x8x2_t tlo, thi ;
+	uint8x8_t mask = vdup_n_u8(0x0f) ;
+
+	tlo.val[0] = vld1_u8(lo) ;
+	tlo.val[1] = vld1_u8(lo + 8) ;
+	thi.val[0] = vld1_u8(hi) ;
+	thi.val[1] = vld1_u8(hi + 8) ;
+	for (i = 0; i + 16 <= sz; i += 16) {
+	    uint8x16_t s = vld1q_u8(src + i) ;
+	    uint8x8_t l0 = vtbl2_u8(tlo, vand_u8(vget_low_u8(s), mask)) ;
+	    uint8x8_t l1 = vtbl2_u8(tlo, vand_u8(vget_high_u8(s), mask)) ;
+	    uint8x8_t h0 = vtbl2_u8(thi, vshr_n_u8(vget_low_u8(s), 4)) ;
+	    uint8x8_t h1 = vtbl2_u8(thi, vshr_n_u8(vget_high_u8(s), 4)) ;
+	    uint8x16_t p = vcombine_u8(veor_u8(l0, h0), veor_u8(l1, h1)) ;
+	    vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p)) ;
+	}
+    }
+#endif
+    return i ;
+}
+#endif /* HAVE_ADDMUL_SIMD */
+
 #define UNROLL 16 /* 1, 4, 8, 16 */
 static void
 addmul1(gf *dst1, gf *src1, gf c, int sz)
 {
     USE_GF_MULC ;
     register gf *dst = dst1, *src = src1 ;
-    gf *lim = &dst[sz - UNROLL + 1] ;
+    gf *lim ;
+
+#ifdef HAVE_ADDMUL_SIMD
+    if (addmul_simd_ok && sz >= 16) {
+	int done = addmul_simd(dst, src, c, sz) ;
+	dst += done ;
+	src += done ;
+	sz -= done ;
+    }
+#endif
+    lim = &dst[sz - UNROLL + 1] ;
 
     GF_MULC0(c) ;
 
@@ -367,21 +467,20 @@ addmul1(gf *dst1, gf *src1, gf c, int sz)
 
 /*
  * computes C = AB where A is n*k, B is k*m, C is n*m
+ * changed for ofgwrite: a row of C is the sum of the rows of B times the
+ * elements of the row of A, so it is done with addmul()
  */
 static void
 matmul(gf *a, gf *b, gf *c, int n, int k, int m)
 {
-    int row, col, i ;
+    int row, i ;
 
     for (row = 0; row < n ; row++) {
-	for (col = 0; col < m ; col++) {
-	    gf *pa = &a[ row * k ];
-	    gf *pb = &b[ col ];
-	    gf acc = 0 ;
-	    for (i = 0; i < k ; i++, pa++, pb += m )
-		acc ^= gf_mul( *pa, *pb ) ;
-	    c[ row * m + col ] = acc ;
-	}
+	gf *pa = &a[ row * k ];
+	gf *pc = &c[ row * m ];
+	memset(pc, '\0', m*sizeof(gf));
+	for (i = 0; i < k ; i++)
+	    addmul(pc, &b[ i * m ], pa[i], m) ;
     }
 }
 
@@ -616,6 +715,9 @@ init_fec(void)
     DDB(my_fprintf(stderr, "generate_gf took %ldus\n", ticks[0]);)
     TICK(ticks[0]);
     init_mul_table();
+#ifdef HAVE_ADDMUL_SIMD
+    addmul_simd_ok = addmul_simd_supported() ;
+#endif
     TOCK(ticks[0]);
     DDB(my_fprintf(stderr, "init_mul_table took %ldus\n", ticks[0]);)
     fec_initialized = 1 ;
@@ -37,6 +37,9 @@
 #include <crc32.h>
 #include "common.h"
 
+// changed for ofgwrite
+void logger_flush(void);
+
 static int all_ff(const void *buf, int len)
 {
 	int i;
@@ -81,6 +84,7 @@ int ubi_scan(struct mtd_dev_info *mtd, int fd, struct ubi_scan_info **info,
 			fflush(stdout);
 		}
 		if (pr) {
+			logger_flush(); // changed for ofgwrite
 			printf("\r" PROGRAM_NAME ": scanning eraseblock %d -- %2lld %% complete  ",
 			       eb, (long long)(eb + 1) * 100 / mtd->eb_cnt);
 			fflush(stdout);
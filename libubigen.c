@@ -168,12 +168,36 @@ void ubigen_init_vid_hdr(const struct ubigen_info *ui,
 	hdr->hdr_crc = cpu_to_be32(crc);
 }
 
+int ubigen_read_leb(const struct ubigen_info *ui,
+		    const struct ubigen_vol_info *vi, long long ec, int lnum,
+		    int len, int in, char *peb)
+{
+	char *data = peb + ui->data_offs;
+	int l = len, rd;
+
+	while (l) {
+		rd = read(in, data + len - l, l);
+		if (rd <= 0) {
+			sys_errmsg("cannot read %d bytes from the input file", l);
+			return -1;
+		}
+		l -= rd;
+	}
+
+	memset(peb, 0xFF, ui->data_offs);
+	ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)peb, ec);
+	ubigen_init_vid_hdr(ui, vi, (struct ubi_vid_hdr *)(peb + ui->vid_hdr_offs),
+			    lnum, data, len);
+	memset(data + len, 0xFF, ui->peb_size - ui->data_offs - len);
+	return 0;
+}
+
 int ubigen_write_volume(const struct ubigen_info *ui,
 			const struct ubigen_vol_info *vi, long long ec,
 			long long bytes, int in, int out)
 {
-	int len = vi->usable_leb_size, rd, lnum = 0;
-	char *inbuf, *outbuf;
+	int len = vi->usable_leb_size, lnum = 0;
+	char *outbuf;
 
 	if (vi->id >= ui->max_volumes) {
 		errmsg("too high volume id %d, max. volumes is %d",
@@ -189,73 +213,39 @@ int ubigen_write_volume(const struct ubigen_info *ui,
 		return -1;
 	}
 
-	inbuf = malloc(ui->leb_size);
-	if (!inbuf)
-		return sys_errmsg("cannot allocate %d bytes of memory",
-				  ui->leb_size);
 	outbuf = malloc(ui->peb_size);
-	if (!outbuf) {
-		sys_errmsg("cannot allocate %d bytes of memory", ui->peb_size);
-		goto out_free;
-	}
-
-	memset(outbuf, 0xFF, ui->data_offs);
-	ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)outbuf, ec);
+	if (!outbuf)
+		return sys_errmsg("cannot allocate %d bytes of memory", ui->peb_size);
 
 	while (bytes) {
-		int l;
-		struct ubi_vid_hdr *vid_hdr;
-
 		if (bytes < len)
 			len = bytes;
 		bytes -= len;
 
-		l = len;
-		do {
-			rd = read(in, inbuf + len - l, l);
-			if (rd != l) {
-				sys_errmsg("cannot read %d bytes from the input file", l);
-				goto out_free1;
-			}
-
-			l -= rd;
-		} while (l);
-
-		vid_hdr = (struct ubi_vid_hdr *)(&outbuf[ui->vid_hdr_offs]);
-		ubigen_init_vid_hdr(ui, vi, vid_hdr, lnum, inbuf, len);
-
-		memcpy(outbuf + ui->data_offs, inbuf, len);
-		memset(outbuf + ui->data_offs + len, 0xFF,
-		       ui->peb_size - ui->data_offs - len);
+		if (ubigen_read_leb(ui, vi, ec, lnum, len, in, outbuf))
+			goto out_free;
 
 		if (write(out, outbuf, ui->peb_size) != ui->peb_size) {
 			sys_errmsg("cannot write %d bytes to the output file", ui->peb_size);
-			goto out_free1;
+			goto out_free;
 		}
 
 		lnum += 1;
 	}
 
 	free(outbuf);
-	free(inbuf);
 	return 0;
 
-out_free1:
-	free(outbuf);
 out_free:
-	free(inbuf);
+	free(outbuf);
 	return -1;
 }
 
-int ubigen_write_layout_vol(const struct ubigen_info *ui, int peb1, int peb2,
-			    long long ec1, long long ec2,
-			    struct ubi_vtbl_record *vtbl, int fd)
+void ubigen_init_layout_peb(const struct ubigen_info *ui, int lnum,
+			    long long ec, const struct ubi_vtbl_record *vtbl,
+			    char *peb)
 {
-	int ret;
 	struct ubigen_vol_info vi;
-	char *outbuf;
-	struct ubi_vid_hdr *vid_hdr;
-	off_t seek;
 
 	vi.bytes = ui->leb_size * UBI_LAYOUT_VOLUME_EBS;
 	vi.id = UBI_LAYOUT_VOLUME_ID;
@@ -268,25 +258,35 @@ int ubigen_write_layout_vol(const struct ubigen_info *ui, int peb1, int peb2,
 	vi.name_len = strlen(UBI_LAYOUT_VOLUME_NAME);
 	vi.compat = UBI_LAYOUT_VOLUME_COMPAT;
 
+	memset(peb, 0xFF, ui->data_offs);
+	ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)peb, ec);
+	ubigen_init_vid_hdr(ui, &vi, (struct ubi_vid_hdr *)(peb + ui->vid_hdr_offs),
+			    lnum, NULL, 0);
+	memcpy(peb + ui->data_offs, vtbl, ui->vtbl_size);
+	memset(peb + ui->data_offs + ui->vtbl_size, 0xFF,
+	       ui->peb_size - ui->data_offs - ui->vtbl_size);
+}
+
+int ubigen_write_layout_vol(const struct ubigen_info *ui, int peb1, int peb2,
+			    long long ec1, long long ec2,
+			    struct ubi_vtbl_record *vtbl, int fd)
+{
+	int ret;
+	char *outbuf;
+	off_t seek;
+
 	outbuf = malloc(ui->peb_size);
 	if (!outbuf)
 		return sys_errmsg("failed to allocate %d bytes",
 				  ui->peb_size);
 
-	memset(outbuf, 0xFF, ui->data_offs);
-	vid_hdr = (struct ubi_vid_hdr *)(&outbuf[ui->vid_hdr_offs]);
-	memcpy(outbuf + ui->data_offs, vtbl, ui->vtbl_size);
-	memset(outbuf + ui->data_offs + ui->vtbl_size, 0xFF,
-	       ui->peb_size - ui->data_offs - ui->vtbl_size);
-
 	seek = (off_t) peb1 * ui->peb_size;
 	if (lseek(fd, seek, SEEK_SET) != seek) {
 		sys_errmsg("cannot seek output file");
 		goto out_free;
 	}
 
-	ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)outbuf, ec1);
-	ubigen_init_vid_hdr(ui, &vi, vid_hdr, 0, NULL, 0);
+	ubigen_init_layout_peb(ui, 0, ec1, vtbl, outbuf);
 	ret = write(fd, outbuf, ui->peb_size);
 	if (ret != ui->peb_size) {
 		sys_errmsg("cannot write %d bytes", ui->peb_size);
@@ -298,8 +298,7 @@ int ubigen_write_layout_vol(const struct ubigen_info *ui, int peb1, int peb2,
 		sys_errmsg("cannot seek output file");
 		goto out_free;
 	}
-	ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)outbuf, ec2);
-	ubigen_init_vid_hdr(ui, &vi, vid_hdr, 1, NULL, 0);
+	ubigen_init_layout_peb(ui, 1, ec2, vtbl, outbuf);
 	ret = write(fd, outbuf, ui->peb_size);
 	if (ret != ui->peb_size) {
 		sys_errmsg("cannot write %d bytes", ui->peb_size);
@@ -0,0 +1,210 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/* Asynchronous logger for my_printf/my_fprintf.
+ *
+ * Messages are copied into a lock-free ring (bounded MPMC queue with per slot
+ * sequence numbers) and written to console and syslog by a background thread.
+ * So a stalled syslogd or a slow console can't slow down flashing.
+ * Messages bigger than one slot occupy several consecutive slots.
+ * logger_flush() writes everything queued synchronously, without timeout. It
+ * is called on exit, before fork, before all reboots and by busybox before
+ * writing to stderr directly, so no message is lost or reordered.
+ */
+
+#define LOGGER_SLOTS     1024 // must be a power of 2
+#define LOGGER_SLOT_SIZE 240
+#define LOGGER_MAX_MSG_SLOTS 16
+
+struct logger_slot
+{
+	atomic_ulong seq;
+	FILE* f;
+	unsigned short len;
+	unsigned char more; // message continues in next slot
+	char data[LOGGER_SLOT_SIZE];
+};
+
+static struct logger_slot logger_ring[LOGGER_SLOTS];
+static atomic_ulong logger_head;  // next slot to claim by producers
+static atomic_ulong logger_tail;  // next slot to write by flusher
+static sem_t logger_sem;
+static pthread_t logger_thread;
+static atomic_int logger_running_pid;
+static atomic_int logger_initialized;
+static pthread_mutex_t logger_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t logger_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void logger_output(FILE* f, const char* msg, size_t len)
+{
+	fwrite(msg, 1, len, f);
+	fflush(f);
+	syslog(LOG_INFO, "%.*s", (int)len, msg);
+}
+
+/* Writes all published slots. Only one consumer at a time: the flusher thread
+ * or the caller of logger_flush().
+ */
+static void logger_drain()
+{
+	char msg[LOGGER_MAX_MSG_SLOTS * LOGGER_SLOT_SIZE];
+	size_t len = 0;
+
+	pthread_mutex_lock(&logger_drain_mutex);
+	while (1)
+	{
+		unsigned long pos = atomic_load_explicit(&logger_tail, memory_order_relaxed);
+		struct logger_slot* slot = &logger_ring[pos & (LOGGER_SLOTS - 1)];
+		FILE* f;
+		int more;
+
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+		{
+			if (len == 0)
+				break;
+			// rest of a multi slot message is just being written by the producer
+			sched_yield();
+			continue;
+		}
+
+		memcpy(&msg[len], slot->data, slot->len);
+		len += slot->len;
+		f = slot->f;
+		more = slot->more;
+
+		// release slot for next round
+		atomic_store_explicit(&slot->seq, pos + LOGGER_SLOTS, memory_order_release);
+		atomic_store_explicit(&logger_tail, pos + 1, memory_order_release);
+
+		if (!more)
+		{
+			logger_output(f, msg, len);
+			len = 0;
+		}
+	}
+	pthread_mutex_unlock(&logger_drain_mutex);
+}
+
+static void* logger_thread_main(void* arg)
+{
+	while (1)
+	{
+		while (sem_wait(&logger_sem) == -1 && errno == EINTR)
+			;
+		logger_drain();
+	}
+	return NULL;
+}
+
+static void logger_atfork_prepare()
+{
+	logger_flush();
+}
+
+static void logger_atfork_child()
+{
+	// threads don't survive fork: restart flusher on next message
+	atomic_store(&logger_running_pid, 0);
+	pthread_mutex_init(&logger_start_mutex, NULL);
+	pthread_mutex_init(&logger_drain_mutex, NULL);
+	sem_init(&logger_sem, 0, 0);
+}
+
+static void logger_start()
+{
+	int i;
+
+	pthread_mutex_lock(&logger_start_mutex);
+	if (!atomic_load(&logger_initialized))
+	{
+		for (i = 0; i < LOGGER_SLOTS; i++)
+			atomic_init(&logger_ring[i].seq, i);
+		sem_init(&logger_sem, 0, 0);
+		pthread_atfork(logger_atfork_prepare, NULL, logger_atfork_child);
+		atexit(logger_flush);
+		atomic_store(&logger_initialized, 1);
+	}
+	if (atomic_load(&logger_running_pid) != getpid())
+	{
+		if (pthread_create(&logger_thread, NULL, logger_thread_main, NULL) == 0)
+		{
+			pthread_detach(logger_thread);
+			atomic_store(&logger_running_pid, getpid());
+		}
+	}
+	pthread_mutex_unlock(&logger_start_mutex);
+}
+
+void logger_write(FILE* f, const char* msg, size_t len)
+{
+	unsigned long pos;
+	int slots, i;
+
+	if (atomic_load_explicit(&logger_running_pid, memory_order_relaxed) != getpid())
+	{
+		logger_start();
+		if (atomic_load(&logger_running_pid) != getpid())
+		{
+			// no flusher thread: write synchronously
+			logger_output(f, msg, len);
+			return;
+		}
+	}
+
+	slots = len ? (len + LOGGER_SLOT_SIZE - 1) / LOGGER_SLOT_SIZE : 1;
+	if (slots > LOGGER_MAX_MSG_SLOTS)
+	{
+		slots = LOGGER_MAX_MSG_SLOTS;
+		len = slots * LOGGER_SLOT_SIZE;
+	}
+
+	pos = atomic_fetch_add_explicit(&logger_head, slots, memory_order_relaxed);
+	for (i = 0; i < slots; i++)
+	{
+		struct logger_slot* slot = &logger_ring[(pos + i) & (LOGGER_SLOTS - 1)];
+		size_t chunk = len > LOGGER_SLOT_SIZE ? LOGGER_SLOT_SIZE : len;
+
+		// ring full: wait for flusher
+		while (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + i)
+		{
+			sem_post(&logger_sem);
+			usleep(1000);
+		}
+
+		slot->f = f;
+		slot->len = chunk;
+		slot->more = (i + 1 < slots);
+		memcpy(slot->data, msg, chunk);
+		msg += chunk;
+		len -= chunk;
+		atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+	}
+	sem_post(&logger_sem);
+}
+
+// writes all messages queued so far in the calling thread
+void logger_flush()
+{
+	unsigned long head = atomic_load(&logger_head);
+
+	if (!atomic_load(&logger_initialized))
+		return;
+
+	// drain at least once: the flusher may still write a message it took already
+	logger_drain();
+	while (atomic_load(&logger_tail) < head)
+	{
+		sched_yield(); // slot claimed but not yet published
+		logger_drain();
+	}
+}
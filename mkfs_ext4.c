@@ -0,0 +1,515 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+/* Minimal in-process mke2fs.
+ *
+ * Discards the whole partition and writes an empty ext4 filesystem:
+ * 4k blocks, 256 byte inodes, one inode per 16k, 1% reserved blocks,
+ * extents, dir_index, no periodic fsck and a journal of up to 64 MiB.
+ * Classic layout without flex_bg/uninit_bg, so no checksums are needed:
+ * every group has its bitmaps and inode table in the group itself.
+ * UUID and label of an existing ext filesystem are kept, so fstab and
+ * bootloader entries referring to them still work.
+ */
+
+#define MKFS_BLOCK_SIZE        4096
+#define MKFS_LOG_BLOCK_SIZE    2 // 1024 << 2
+#define MKFS_BLOCKS_PER_GROUP  32768
+#define MKFS_INODE_SIZE        256
+#define MKFS_INODE_RATIO       16384
+#define MKFS_FIRST_INO         11
+#define MKFS_LOST_FOUND_BLOCKS 4
+#define MKFS_MAX_JOURNAL       16384
+#define MKFS_ZERO_SIZE         (1024 * 1024)
+
+#define EXT4_ROOT_INO    2
+#define EXT4_JOURNAL_INO 8
+#define EXT4_LOST_FOUND_INO 11
+
+#define EXT4_COMPAT      (0x0004 | 0x0008 | 0x0020) // has_journal, ext_attr, dir_index
+#define EXT4_INCOMPAT    (0x0002 | 0x0040)          // filetype, extents
+#define EXT4_RO_COMPAT   (0x0001 | 0x0002 | 0x0008 | 0x0020 | 0x0040) // sparse_super, large_file, huge_file, dir_nlink, extra_isize
+#define EXT4_EXTENTS_FL  0x80000
+
+struct mkfs_layout
+{
+	uint32_t blocks;
+	uint32_t groups;
+	uint32_t inodes_per_group;
+	uint32_t gdt_blocks;
+	uint32_t itable_blocks;
+	uint32_t journal_blocks;
+	uint32_t root_block;
+	uint32_t lost_found_block;
+	uint32_t journal_block;
+	uint32_t free_blocks;
+	uint32_t now;
+	unsigned char uuid[16];
+	char label[16];
+};
+
+static void put16(unsigned char* p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(unsigned char* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+// jbd2 is big endian
+static void put32_be(unsigned char* p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static int is_power_of(uint32_t n, uint32_t base)
+{
+	while (n > 1 && n % base == 0)
+		n /= base;
+	return n == 1;
+}
+
+// sparse_super: backups only in group 1 and powers of 3, 5, 7
+static int group_has_super(uint32_t g)
+{
+	return g <= 1 || is_power_of(g, 3) || is_power_of(g, 5) || is_power_of(g, 7);
+}
+
+static uint32_t group_start(uint32_t g)
+{
+	return g * MKFS_BLOCKS_PER_GROUP;
+}
+
+static uint32_t group_blocks(struct mkfs_layout* l, uint32_t g)
+{
+	return g + 1 < l->groups ? MKFS_BLOCKS_PER_GROUP : l->blocks - group_start(g);
+}
+
+static uint32_t group_block_bitmap(struct mkfs_layout* l, uint32_t g)
+{
+	return group_start(g) + (group_has_super(g) ? 1 + l->gdt_blocks : 0);
+}
+
+// first block after bitmaps and inode table
+static uint32_t group_data_start(struct mkfs_layout* l, uint32_t g)
+{
+	return group_block_bitmap(l, g) + 2 + l->itable_blocks;
+}
+
+static uint32_t group_used_blocks(struct mkfs_layout* l, uint32_t g)
+{
+	uint32_t used = group_data_start(l, g) - group_start(g);
+
+	if (g == 0)
+		used += 1 + MKFS_LOST_FOUND_BLOCKS + l->journal_blocks;
+	return used;
+}
+
+static int calc_layout(struct mkfs_layout* l, unsigned long long size)
+{
+	unsigned long long blocks = size / MKFS_BLOCK_SIZE;
+	unsigned long long inodes;
+	uint32_t last, room;
+
+	if (blocks >= 0xffffffffULL || blocks < 1024)
+	{
+		my_printf("Error: partition size %llu is not supported\n", size);
+		return 0;
+	}
+	l->blocks = blocks;
+	l->groups = (l->blocks + MKFS_BLOCKS_PER_GROUP - 1) / MKFS_BLOCKS_PER_GROUP;
+
+	inodes = blocks * MKFS_BLOCK_SIZE / MKFS_INODE_RATIO;
+	l->inodes_per_group = (inodes + l->groups - 1) / l->groups;
+	// whole inode table blocks, at most one inode bitmap block
+	l->inodes_per_group = (l->inodes_per_group + 15) / 16 * 16;
+	if (l->inodes_per_group < 16)
+		l->inodes_per_group = 16;
+	if (l->inodes_per_group > MKFS_BLOCKS_PER_GROUP / 4)
+		l->inodes_per_group = MKFS_BLOCKS_PER_GROUP / 4;
+	l->itable_blocks = l->inodes_per_group * MKFS_INODE_SIZE / MKFS_BLOCK_SIZE;
+	l->gdt_blocks = (l->groups * 32 + MKFS_BLOCK_SIZE - 1) / MKFS_BLOCK_SIZE;
+
+	// a too small last group isn't worth its metadata
+	last = group_blocks(l, l->groups - 1);
+	if (l->groups > 1 && last < group_data_start(l, l->groups - 1) - group_start(l->groups - 1) + 256)
+	{
+		l->blocks -= last;
+		l->groups--;
+	}
+
+	// same journal sizes as mke2fs, but at most 64 MiB
+	if (l->blocks < 2048)
+		l->journal_blocks = 0;
+	else if (l->blocks < 32768)
+		l->journal_blocks = 1024;
+	else if (l->blocks < 256 * 1024)
+		l->journal_blocks = 4096;
+	else if (l->blocks < 512 * 1024)
+		l->journal_blocks = 8192;
+	else
+		l->journal_blocks = MKFS_MAX_JOURNAL;
+
+	l->root_block = group_data_start(l, 0);
+	l->lost_found_block = l->root_block + 1;
+	l->journal_block = l->lost_found_block + MKFS_LOST_FOUND_BLOCKS;
+	room = group_blocks(l, 0) - (l->journal_block - group_start(0));
+	while (l->journal_blocks && l->journal_blocks + 64 > room)
+		l->journal_blocks /= 2;
+	if (l->journal_blocks < 1024)
+		l->journal_blocks = 0;
+	if (group_data_start(l, 0) + 64 > group_blocks(l, 0))
+	{
+		my_printf("Error: partition too small for ext4\n");
+		return 0;
+	}
+
+	l->free_blocks = 0;
+	for (last = 0; last < l->groups; last++)
+		l->free_blocks += group_blocks(l, last) - group_used_blocks(l, last);
+	return 1;
+}
+
+static int write_block(int fd, uint32_t block, const void* buf)
+{
+	return pwrite(fd, buf, MKFS_BLOCK_SIZE, (off_t)block * MKFS_BLOCK_SIZE) == MKFS_BLOCK_SIZE;
+}
+
+static int zero_blocks(int fd, uint32_t block, uint32_t count)
+{
+	uint64_t range[2];
+	static char zero[MKFS_ZERO_SIZE];
+	off_t pos = (off_t)block * MKFS_BLOCK_SIZE;
+	off_t end = pos + (off_t)count * MKFS_BLOCK_SIZE;
+
+	range[0] = pos;
+	range[1] = end - pos;
+	if (ioctl(fd, BLKZEROOUT, range) == 0)
+		return 1;
+	while (pos < end)
+	{
+		size_t len = end - pos > MKFS_ZERO_SIZE ? MKFS_ZERO_SIZE : end - pos;
+		if (pwrite(fd, zero, len, pos) != len)
+			return 0;
+		pos += len;
+	}
+	return 1;
+}
+
+static void fill_superblock(struct mkfs_layout* l, unsigned char* sb, uint32_t group, const unsigned char* journal_inode)
+{
+	unsigned char* jnl_blocks = sb + 268;
+	uint32_t free_inodes = l->inodes_per_group * l->groups - MKFS_FIRST_INO;
+	int i;
+
+	memset(sb, 0, 1024);
+	put32(sb + 0, l->inodes_per_group * l->groups);
+	put32(sb + 4, l->blocks);
+	put32(sb + 8, l->blocks / 100);
+	put32(sb + 12, l->free_blocks);
+	put32(sb + 16, free_inodes);
+	put32(sb + 20, 0);                       // first data block
+	put32(sb + 24, MKFS_LOG_BLOCK_SIZE);
+	put32(sb + 28, MKFS_LOG_BLOCK_SIZE);     // cluster size
+	put32(sb + 32, MKFS_BLOCKS_PER_GROUP);
+	put32(sb + 36, MKFS_BLOCKS_PER_GROUP);
+	put32(sb + 40, l->inodes_per_group);
+	put32(sb + 48, l->now);                  // wtime
+	put16(sb + 54, 0xffff);                  // no fsck after max mount count
+	put16(sb + 56, 0xef53);
+	put16(sb + 58, 1);                       // clean
+	put16(sb + 60, 1);                       // errors: continue
+	put32(sb + 64, l->now);                  // last check
+	put32(sb + 76, 1);                       // dynamic rev
+	put32(sb + 84, MKFS_FIRST_INO);
+	put16(sb + 88, MKFS_INODE_SIZE);
+	put16(sb + 90, group);
+	put32(sb + 92, l->journal_blocks ? EXT4_COMPAT : EXT4_COMPAT & ~0x0004);
+	put32(sb + 96, EXT4_INCOMPAT);
+	put32(sb + 100, EXT4_RO_COMPAT);
+	memcpy(sb + 104, l->uuid, 16);
+	memcpy(sb + 120, l->label, 16);
+	put32(sb + 224, l->journal_blocks ? EXT4_JOURNAL_INO : 0);
+	for (i = 0; i < 16; i++)                 // hash seed
+		sb[236 + i] = l->uuid[15 - i] ^ (l->now >> (i % 4 * 8));
+	sb[252] = 1;                             // half_md4
+	put32(sb + 256, 0x000c);                 // user_xattr, acl
+	put32(sb + 264, l->now);                 // mkfs time
+	if (l->journal_blocks)
+	{
+		sb[253] = 1;                         // s_jnl_blocks contains a copy of i_block
+		memcpy(jnl_blocks, journal_inode + 40, 60);
+		put32(jnl_blocks + 64, l->journal_blocks * MKFS_BLOCK_SIZE);
+	}
+	put16(sb + 348, 32);                     // min extra isize
+	put16(sb + 350, 32);                     // want extra isize
+#ifdef __CHAR_UNSIGNED__
+	put32(sb + 352, 0x0002);                 // unsigned directory hash
+#else
+	put32(sb + 352, 0x0001);                 // signed directory hash
+#endif
+}
+
+static void fill_inode(struct mkfs_layout* l, unsigned char* inode, uint16_t mode, uint16_t links, uint32_t block, uint32_t count)
+{
+	memset(inode, 0, MKFS_INODE_SIZE);
+	put16(inode + 0, mode);
+	put32(inode + 4, count * MKFS_BLOCK_SIZE);
+	put32(inode + 8, l->now);
+	put32(inode + 12, l->now);
+	put32(inode + 16, l->now);
+	put16(inode + 26, links);
+	put32(inode + 28, count * (MKFS_BLOCK_SIZE / 512));
+	put32(inode + 32, EXT4_EXTENTS_FL);
+	// extent tree with one extent in i_block
+	put16(inode + 40, 0xf30a);
+	put16(inode + 42, 1);
+	put16(inode + 44, 4);
+	put16(inode + 46, 0);
+	put32(inode + 52, 0);
+	put16(inode + 56, count);
+	put16(inode + 58, 0);
+	put32(inode + 60, block);
+	put16(inode + 128, 32);                  // extra isize
+	put32(inode + 144, l->now);              // crtime
+}
+
+static unsigned char* add_dirent(unsigned char* p, uint32_t ino, uint16_t rec_len, const char* name)
+{
+	put32(p, ino);
+	put16(p + 4, rec_len);
+	p[6] = strlen(name);
+	p[7] = 2; // directory
+	memcpy(p + 8, name, strlen(name));
+	return p + rec_len;
+}
+
+static int write_groups(int fd, struct mkfs_layout* l, unsigned char* buf, unsigned char* sb)
+{
+	unsigned char* gdt;
+	uint32_t g, i, b;
+	int ret = 0;
+
+	gdt = calloc(l->gdt_blocks, MKFS_BLOCK_SIZE);
+	if (gdt == NULL)
+		return 0;
+	for (g = 0; g < l->groups; g++)
+	{
+		unsigned char* d = gdt + g * 32;
+		uint32_t bb = group_block_bitmap(l, g);
+		put32(d + 0, bb);
+		put32(d + 4, bb + 1);
+		put32(d + 8, bb + 2);
+		put16(d + 12, group_blocks(l, g) - group_used_blocks(l, g));
+		put16(d + 14, l->inodes_per_group - (g == 0 ? MKFS_FIRST_INO : 0));
+		put16(d + 16, g == 0 ? 2 : 0);
+	}
+
+	for (g = 0; g < l->groups; g++)
+	{
+		uint32_t start = group_start(g);
+		uint32_t bb = group_block_bitmap(l, g);
+		uint32_t used = group_used_blocks(l, g);
+
+		if (group_has_super(g))
+		{
+			memset(buf, 0, MKFS_BLOCK_SIZE);
+			fill_superblock(l, g == 0 ? buf + 1024 : buf, g, sb);
+			if (!write_block(fd, start, buf))
+				goto out;
+			for (i = 0; i < l->gdt_blocks; i++)
+				if (!write_block(fd, start + 1 + i, gdt + i * MKFS_BLOCK_SIZE))
+					goto out;
+		}
+
+		// block bitmap: used blocks are at the start of the group, padding behind the group end
+		memset(buf, 0, MKFS_BLOCK_SIZE);
+		for (b = 0; b < MKFS_BLOCKS_PER_GROUP; b++)
+			if (b < used || b >= group_blocks(l, g))
+				buf[b / 8] |= 1 << (b % 8);
+		if (!write_block(fd, bb, buf))
+			goto out;
+
+		// inode bitmap: reserved inodes and padding
+		memset(buf, 0, MKFS_BLOCK_SIZE);
+		for (b = 0; b < MKFS_BLOCK_SIZE * 8; b++)
+			if ((g == 0 && b < MKFS_FIRST_INO) || b >= l->inodes_per_group)
+				buf[b / 8] |= 1 << (b % 8);
+		if (!write_block(fd, bb + 1, buf))
+			goto out;
+
+		if (!zero_blocks(fd, bb + 2, l->itable_blocks))
+			goto out;
+		set_step_progress((g + 1) * 100 / l->groups);
+	}
+	ret = 1;
+out:
+	free(gdt);
+	return ret;
+}
+
+// reads UUID and label of an existing ext2/3/4 filesystem
+static void keep_identity(int fd, struct mkfs_layout* l)
+{
+	unsigned char sb[1024];
+	int i;
+
+	if (pread(fd, sb, sizeof(sb), 1024) == sizeof(sb) && sb[56] == 0x53 && sb[57] == 0xef)
+	{
+		memcpy(l->uuid, sb + 104, 16);
+		memcpy(l->label, sb + 120, 16);
+		return;
+	}
+
+	// new random UUID (version 4)
+	i = open("/dev/urandom", O_RDONLY);
+	if (i < 0 || read(i, l->uuid, 16) != 16)
+	{
+		srand(l->now ^ getpid());
+		for (i = 0; i < 16; i++)
+			l->uuid[i] = rand();
+	}
+	if (i >= 0)
+		close(i);
+	l->uuid[6] = (l->uuid[6] & 0x0f) | 0x40;
+	l->uuid[8] = (l->uuid[8] & 0x3f) | 0x80;
+	memset(l->label, 0, sizeof(l->label));
+}
+
+int mkfs_ext4(char* device, int quiet)
+{
+	struct mkfs_layout l;
+	unsigned long long size, range[2];
+	unsigned char* buf;
+	unsigned char* p;
+	unsigned char journal_inode[MKFS_INODE_SIZE];
+	int fd, i, ret = 0;
+
+	fd = open(device, O_RDWR | O_EXCL);
+	if (fd < 0)
+	{
+		my_printf("Error opening %s: %s\n", device, strerror(errno));
+		return 0;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) != 0)
+	{
+		my_printf("Error getting size of %s\n", device);
+		close(fd);
+		return 0;
+	}
+	memset(&l, 0, sizeof(l));
+	l.now = time(NULL);
+	if (!calc_layout(&l, size))
+	{
+		close(fd);
+		return 0;
+	}
+	keep_identity(fd, &l);
+	buf = malloc(MKFS_BLOCK_SIZE);
+	if (buf == NULL)
+	{
+		close(fd);
+		return 0;
+	}
+
+	if (!quiet)
+		my_printf("Creating ext4 on %s: %u blocks, %u groups, %u inodes, journal %u blocks\n",
+				  device, l.blocks, l.groups, l.inodes_per_group * l.groups, l.journal_blocks);
+
+	// whole partition: gives the card a clean FTL state. Not all devices support it
+	range[0] = 0;
+	range[1] = size;
+	if (ioctl(fd, BLKDISCARD, range) != 0 && !quiet)
+		my_printf("Discard not supported by %s\n", device);
+	telemetry_erase(device, 1);
+
+	fill_inode(&l, journal_inode, 0100600, 1, l.journal_block, l.journal_blocks);
+	if (!write_groups(fd, &l, buf, journal_inode))
+		goto out;
+
+	// inode table block with inodes 1-16
+	{
+		unsigned char* itable = calloc(1, MKFS_BLOCK_SIZE);
+		if (itable == NULL)
+			goto out;
+		fill_inode(&l, itable + (EXT4_ROOT_INO - 1) * MKFS_INODE_SIZE, 040755, 3, l.root_block, 1);
+		if (l.journal_blocks)
+			memcpy(itable + (EXT4_JOURNAL_INO - 1) * MKFS_INODE_SIZE, journal_inode, MKFS_INODE_SIZE);
+		fill_inode(&l, itable + (EXT4_LOST_FOUND_INO - 1) * MKFS_INODE_SIZE, 040700, 2, l.lost_found_block, MKFS_LOST_FOUND_BLOCKS);
+		ret = write_block(fd, group_block_bitmap(&l, 0) + 2, itable);
+		free(itable);
+		if (!ret)
+			goto out;
+		ret = 0;
+	}
+
+	// root directory
+	memset(buf, 0, MKFS_BLOCK_SIZE);
+	p = add_dirent(buf, EXT4_ROOT_INO, 12, ".");
+	p = add_dirent(p, EXT4_ROOT_INO, 12, "..");
+	add_dirent(p, EXT4_LOST_FOUND_INO, MKFS_BLOCK_SIZE - 24, "lost+found");
+	if (!write_block(fd, l.root_block, buf))
+		goto out;
+
+	// lost+found, preallocated like mke2fs does
+	memset(buf, 0, MKFS_BLOCK_SIZE);
+	p = add_dirent(buf, EXT4_LOST_FOUND_INO, 12, ".");
+	add_dirent(p, EXT4_ROOT_INO, MKFS_BLOCK_SIZE - 12, "..");
+	if (!write_block(fd, l.lost_found_block, buf))
+		goto out;
+	memset(buf, 0, MKFS_BLOCK_SIZE);
+	put16(buf + 4, MKFS_BLOCK_SIZE); // empty entry
+	for (i = 1; i < MKFS_LOST_FOUND_BLOCKS; i++)
+		if (!write_block(fd, l.lost_found_block + i, buf))
+			goto out;
+
+	// journal superblock (v2, empty journal). The rest of the journal isn't read
+	if (l.journal_blocks)
+	{
+		memset(buf, 0, MKFS_BLOCK_SIZE);
+		put32_be(buf + 0, 0xc03b3998);
+		put32_be(buf + 4, 4);
+		put32_be(buf + 12, MKFS_BLOCK_SIZE);
+		put32_be(buf + 16, l.journal_blocks);
+		put32_be(buf + 20, 1);               // first log block
+		put32_be(buf + 24, 1);               // sequence
+		memcpy(buf + 48, l.uuid, 16);
+		put32_be(buf + 64, 1);               // nr users
+		if (!write_block(fd, l.journal_block, buf))
+			goto out;
+	}
+
+	if (fsync(fd) != 0)
+	{
+		my_printf("Error syncing %s\n", device);
+		goto out;
+	}
+	ret = 1;
+
+out:
+	if (!ret)
+		my_printf("Error creating ext4 filesystem on %s: %s\n", device, strerror(errno));
+	free(buf);
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,580 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/sysmacros.h>
+
+#include "busybox/include/libbb.h"
+#include "busybox/include/bb_archive.h"
+
+/* Flashing several multiboot slots in one run.
+ *
+ * The rootfs archive is decompressed and parsed only once. Every tar entry
+ * is put into a ring of operations which is consumed by one writer thread
+ * per slot. Each writer extracts into its own slot directory, so all slots
+ * are written in parallel. The ring is bounded: a slow slot slows down the
+ * decompression, but no entry is ever held in memory completely.
+ * Kernels are written one after another at the end.
+ */
+
+#define MULTISLOT_RING_SIZE 64
+#define MULTISLOT_CHUNK_SIZE (64 * 1024)
+
+enum multislot_op_type
+{
+	OP_FILE, OP_DATA, OP_FILE_END, OP_DIR, OP_SYMLINK, OP_HARDLINK, OP_NODE, OP_END
+};
+
+struct multislot_op
+{
+	enum multislot_op_type type;
+	char* name;
+	char* link_target;
+	char* data;
+	size_t len;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	dev_t device;
+};
+
+struct multislot_target
+{
+	int slot;
+	char kernel_device[1000];
+	char kernel_filename[1000];
+	char rootfs_device[1000];
+	char rootfs_filename[1000];
+	char rootfs_sub_dir[1000];
+	enum FlashModeTypeEnum kernel_flash_mode;
+	int found_kernel_device;
+	int stop_neutrino_needed;
+
+	char mount_point[64];
+	char path[1100];
+	int mounted;
+	pthread_t thread;
+	unsigned long read_pos;
+	int errors;
+};
+
+int multislot_cnt = 0;
+static int multislot_slots[MAX_MULTISLOTS];
+static struct multislot_target multislot_targets[MAX_MULTISLOTS];
+
+static struct multislot_op multislot_ring[MULTISLOT_RING_SIZE];
+static unsigned long multislot_write_pos;
+static pthread_mutex_t multislot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t multislot_cond = PTHREAD_COND_INITIALIZER;
+
+// "1,2,4" -> slots. Returns 0 on error.
+int multislot_parse(const char* list)
+{
+	char* end;
+	long val;
+
+	multislot_cnt = 0;
+	while (*list)
+	{
+		errno = 0;
+		val = strtol(list, &end, 10);
+		if (errno != 0 || end == list || val <= 0 || multislot_cnt == MAX_MULTISLOTS)
+			return 0;
+		multislot_slots[multislot_cnt++] = val;
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list != '\0')
+			return 0;
+	}
+	return multislot_cnt > 0;
+}
+
+/* Runs the device and image file detection for every slot.
+ * Afterwards the globals describe the slot which is running (if it's one of the
+ * targets) or the first slot, so the normal checks and umount_rootfs() work as usual.
+ */
+int multislot_prepare(char* image_dir)
+{
+	int i, primary = 0, stop_needed = 0;
+	struct multislot_target* t;
+
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		t = &multislot_targets[i];
+		memset(t, 0, sizeof(*t));
+		t->slot = multislot_slots[i];
+
+		my_printf("\nSearching devices of multiboot partition %d\n", t->slot);
+		multiboot_partition = t->slot;
+		rootfs_sub_dir[0] = '\0';
+		found_kernel_device = 0;
+		found_rootfs_device = 0;
+		kernel_flash_mode = FLASH_MODE_UNKNOWN;
+		rootfs_flash_mode = FLASH_MODE_UNKNOWN;
+		stop_neutrino_needed = 1;
+		if (!find_image_files(image_dir))
+			return 0;
+		find_kernel_rootfs_device();
+
+		if (!found_rootfs_device || rootfs_flash_mode != TARBZ2)
+		{
+			my_printf("Error: multiboot partition %d has no ext4 rootfs device. Only ext4 rootfs can be flashed to several partitions\n", t->slot);
+			return 0;
+		}
+		if (rootfs_filename[0] == '\0' || strcmp(rootfs_filename, rootfs_image_filename) == 0)
+		{
+			my_printf("Error: no rootfs tar archive found for multiboot partition %d\n", t->slot);
+			return 0;
+		}
+		if (i > 0 && strcmp(rootfs_filename, multislot_targets[0].rootfs_filename) != 0)
+		{
+			my_printf("Error: multiboot partition %d uses another rootfs file (%s)\n", t->slot, rootfs_filename);
+			return 0;
+		}
+
+		strcpy(t->kernel_device, kernel_device);
+		strcpy(t->kernel_filename, kernel_filename);
+		strcpy(t->rootfs_device, rootfs_device);
+		strcpy(t->rootfs_filename, rootfs_filename);
+		strcpy(t->rootfs_sub_dir, rootfs_sub_dir);
+		t->kernel_flash_mode = kernel_flash_mode;
+		t->found_kernel_device = found_kernel_device;
+		t->stop_neutrino_needed = stop_neutrino_needed;
+		if (stop_neutrino_needed)
+		{
+			stop_needed = 1;
+			primary = i;
+		}
+		my_printf("Multiboot partition %d: kernel %s rootfs %s %s\n", t->slot, t->kernel_device, t->rootfs_device, t->rootfs_sub_dir);
+	}
+
+	t = &multislot_targets[primary];
+	multiboot_partition = t->slot;
+	strcpy(kernel_device, t->kernel_device);
+	strcpy(kernel_filename, t->kernel_filename);
+	strcpy(rootfs_device, t->rootfs_device);
+	strcpy(rootfs_filename, t->rootfs_filename);
+	strcpy(rootfs_sub_dir, t->rootfs_sub_dir);
+	image_stat(kernel_filename, &kernel_file_stat);
+	image_stat(rootfs_filename, &rootfs_file_stat);
+	kernel_flash_mode = t->kernel_flash_mode;
+	rootfs_flash_mode = TARBZ2;
+	found_kernel_device = t->found_kernel_device;
+	found_rootfs_device = 1;
+	stop_neutrino_needed = stop_needed;
+	return 1;
+}
+
+static void multislot_free_op(struct multislot_op* op)
+{
+	free(op->name);
+	free(op->link_target);
+	free(op->data);
+	memset(op, 0, sizeof(*op));
+}
+
+// producer: waits until the slowest writer has consumed the slot
+static void multislot_put(struct multislot_op* op)
+{
+	struct multislot_op* slot;
+	int i;
+
+	pthread_mutex_lock(&multislot_mutex);
+	while (1)
+	{
+		unsigned long min_pos = multislot_write_pos;
+		for (i = 0; i < multislot_cnt; i++)
+			if (multislot_targets[i].read_pos < min_pos)
+				min_pos = multislot_targets[i].read_pos;
+		if (multislot_write_pos - min_pos < MULTISLOT_RING_SIZE)
+			break;
+		pthread_cond_wait(&multislot_cond, &multislot_mutex);
+	}
+	slot = &multislot_ring[multislot_write_pos % MULTISLOT_RING_SIZE];
+	multislot_free_op(slot);
+	*slot = *op;
+	multislot_write_pos++;
+	pthread_cond_broadcast(&multislot_cond);
+	pthread_mutex_unlock(&multislot_mutex);
+}
+
+static struct multislot_op* multislot_get(struct multislot_target* t)
+{
+	struct multislot_op* op;
+
+	pthread_mutex_lock(&multislot_mutex);
+	while (t->read_pos == multislot_write_pos)
+		pthread_cond_wait(&multislot_cond, &multislot_mutex);
+	op = &multislot_ring[t->read_pos % MULTISLOT_RING_SIZE];
+	pthread_mutex_unlock(&multislot_mutex);
+	return op;
+}
+
+static void multislot_done(struct multislot_target* t)
+{
+	pthread_mutex_lock(&multislot_mutex);
+	t->read_pos++;
+	pthread_cond_broadcast(&multislot_cond);
+	pthread_mutex_unlock(&multislot_mutex);
+}
+
+// creates missing parent directories of name below root_fd
+static void make_parents(int root_fd, const char* name)
+{
+	char dir[PATH_MAX];
+	char* slash;
+
+	strncpy(dir, name, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	for (slash = strchr(dir, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+	{
+		*slash = '\0';
+		mkdirat(root_fd, dir, 0755);
+		*slash = '/';
+	}
+}
+
+static void writer_error(struct multislot_target* t, const char* what, const char* name)
+{
+	if (t->errors++ < 10)
+		my_printf("Error partition %d: %s %s: %s\n", t->slot, what, name, strerror(errno));
+}
+
+static int nftw_remove(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	if (ftw->level > 0)
+		remove(path);
+	return 0;
+}
+
+static void* multislot_writer(void* arg)
+{
+	struct multislot_target* t = arg;
+	struct multislot_op* op;
+	int root_fd, fd = -1;
+
+	// instead of creating new filesystem just delete whole content
+	nftw(t->path, nftw_remove, 32, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+	mkdir(t->path, 0755);
+	root_fd = open(t->path, O_RDONLY | O_DIRECTORY);
+	if (root_fd < 0)
+		writer_error(t, "open", t->path);
+
+	while ((op = multislot_get(t))->type != OP_END)
+	{
+		struct timespec times[2];
+		int ret;
+
+		if (root_fd < 0)
+		{
+			multislot_done(t);
+			continue;
+		}
+
+		switch (op->type)
+		{
+		case OP_FILE:
+			unlinkat(root_fd, op->name, 0);
+			fd = openat(root_fd, op->name, O_WRONLY | O_CREAT | O_TRUNC, op->mode & 07777);
+			if (fd < 0 && errno == ENOENT)
+			{
+				make_parents(root_fd, op->name);
+				fd = openat(root_fd, op->name, O_WRONLY | O_CREAT | O_TRUNC, op->mode & 07777);
+			}
+			if (fd < 0)
+				writer_error(t, "create", op->name);
+			break;
+		case OP_DATA:
+			if (fd >= 0 && full_write(fd, op->data, op->len) != op->len)
+			{
+				writer_error(t, "write", op->name);
+				close(fd);
+				fd = -1;
+			}
+			break;
+		case OP_FILE_END:
+			if (fd < 0)
+				break;
+			fchown(fd, op->uid, op->gid);
+			fchmod(fd, op->mode & 07777);
+			times[0].tv_sec = times[1].tv_sec = op->mtime;
+			times[0].tv_nsec = times[1].tv_nsec = 0;
+			futimens(fd, times);
+			if (close(fd) != 0)
+				writer_error(t, "close", op->name);
+			fd = -1;
+			break;
+		case OP_DIR:
+			ret = mkdirat(root_fd, op->name, op->mode & 07777);
+			if (ret != 0 && errno == ENOENT)
+			{
+				make_parents(root_fd, op->name);
+				ret = mkdirat(root_fd, op->name, op->mode & 07777);
+			}
+			if (ret != 0 && errno != EEXIST)
+				writer_error(t, "mkdir", op->name);
+			fchownat(root_fd, op->name, op->uid, op->gid, AT_SYMLINK_NOFOLLOW);
+			fchmodat(root_fd, op->name, op->mode & 07777, 0);
+			break;
+		case OP_SYMLINK:
+			unlinkat(root_fd, op->name, 0);
+			make_parents(root_fd, op->name);
+			if (symlinkat(op->link_target, root_fd, op->name) != 0)
+				writer_error(t, "symlink", op->name);
+			fchownat(root_fd, op->name, op->uid, op->gid, AT_SYMLINK_NOFOLLOW);
+			break;
+		case OP_HARDLINK:
+			unlinkat(root_fd, op->name, 0);
+			make_parents(root_fd, op->name);
+			if (linkat(root_fd, op->link_target, root_fd, op->name, 0) != 0)
+				writer_error(t, "link", op->name);
+			break;
+		case OP_NODE:
+			unlinkat(root_fd, op->name, 0);
+			make_parents(root_fd, op->name);
+			if (mknodat(root_fd, op->name, op->mode, op->device) != 0)
+				writer_error(t, "mknod", op->name);
+			fchownat(root_fd, op->name, op->uid, op->gid, AT_SYMLINK_NOFOLLOW);
+			fchmodat(root_fd, op->name, op->mode & 07777, 0);
+			break;
+		default:
+			break;
+		}
+		multislot_done(t);
+	}
+	multislot_done(t);
+
+	if (fd >= 0)
+		close(fd);
+	if (root_fd >= 0)
+	{
+		syncfs(root_fd);
+		close(root_fd);
+	}
+	return NULL;
+}
+
+// "./bin/sh" -> "bin/sh"
+static char* strip_dot_slash(char* name)
+{
+	while (name[0] == '.' && name[1] == '/')
+		name += 2;
+	return name;
+}
+
+static void FAST_FUNC multislot_action_data(archive_handle_t* handle)
+{
+	file_header_t* hdr = handle->file_header;
+	struct multislot_op op;
+	char* name = strip_dot_slash(hdr->name);
+	off_t left;
+
+	if (name[0] == '\0' || strcmp(name, ".") == 0)
+	{
+		data_skip(handle);
+		return;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.name = xstrdup(name);
+	op.mode = hdr->mode;
+	op.uid = hdr->uid;
+	op.gid = hdr->gid;
+	op.mtime = hdr->mtime;
+	op.device = hdr->device;
+
+	switch (hdr->mode & S_IFMT)
+	{
+	case S_IFREG:
+		if (hdr->link_target && hdr->size == 0)
+		{
+			op.type = OP_HARDLINK;
+			op.link_target = xstrdup(strip_dot_slash(hdr->link_target));
+			multislot_put(&op);
+			return;
+		}
+		op.type = OP_FILE;
+		multislot_put(&op);
+		for (left = hdr->size; left > 0; left -= op.len)
+		{
+			memset(&op, 0, sizeof(op));
+			op.type = OP_DATA;
+			op.name = xstrdup(name);
+			op.len = left > MULTISLOT_CHUNK_SIZE ? MULTISLOT_CHUNK_SIZE : left;
+			op.data = xmalloc(op.len);
+			archive_xread(handle, op.data, op.len);
+			multislot_put(&op);
+		}
+		memset(&op, 0, sizeof(op));
+		op.type = OP_FILE_END;
+		op.name = xstrdup(name);
+		op.mode = hdr->mode;
+		op.uid = hdr->uid;
+		op.gid = hdr->gid;
+		op.mtime = hdr->mtime;
+		break;
+	case S_IFDIR:
+		op.type = OP_DIR;
+		break;
+	case S_IFLNK:
+		op.type = OP_SYMLINK;
+		op.link_target = xstrdup(hdr->link_target ? hdr->link_target : "");
+		break;
+	default:
+		op.type = OP_NODE;
+		break;
+	}
+	multislot_put(&op);
+}
+
+static int multislot_extract(char* filename)
+{
+	archive_handle_t* handle;
+	struct multislot_op op;
+	int i, ret = 0;
+
+	die_func = &handle_busybox_fatal_error;
+	handle = init_handle();
+	handle->action_data = multislot_action_data;
+	handle->src_fd = open_zipped(filename, 0);
+	if (handle->src_fd < 0)
+	{
+		my_printf("Error opening %s\n", filename);
+		return 0;
+	}
+	// compressed archives are read from a pipe
+	if (lseek(handle->src_fd, 0, SEEK_CUR) == -1)
+		handle->seek = seek_by_read;
+
+	multislot_write_pos = 0;
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		multislot_targets[i].read_pos = 0;
+		if (pthread_create(&multislot_targets[i].thread, NULL, multislot_writer, &multislot_targets[i]) != 0)
+		{
+			my_printf("Error creating writer thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	bb_got_signal = 0;
+	while (get_header_tar(handle) == EXIT_SUCCESS)
+		ret = 1;
+	close(handle->src_fd);
+	free(handle->ofg_buf);
+	check_errors_in_children(0);
+	if (bb_got_signal || !image_streams_ok())
+		ret = 0;
+
+	memset(&op, 0, sizeof(op));
+	op.type = OP_END;
+	multislot_put(&op);
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		pthread_join(multislot_targets[i].thread, NULL);
+		if (multislot_targets[i].errors)
+		{
+			my_printf("Error: %d errors while writing multiboot partition %d\n", multislot_targets[i].errors, multislot_targets[i].slot);
+			ret = 0;
+		}
+	}
+	for (i = 0; i < MULTISLOT_RING_SIZE; i++)
+		multislot_free_op(&multislot_ring[i]);
+	free(handle->file_header);
+	free(handle);
+	return ret;
+}
+
+int multislot_flash(int kernel, int quiet, int no_write)
+{
+	int i, ret = 1;
+	struct stat st;
+
+	set_step("Extracting rootfs to all partitions");
+	set_step_progress(0);
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		struct multislot_target* t = &multislot_targets[i];
+		if (!quiet)
+			my_printf("Rootfs of multiboot partition %d: %s %s\n", t->slot, t->rootfs_device, t->rootfs_sub_dir);
+	}
+	if (no_write)
+		return 1;
+
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		struct multislot_target* t = &multislot_targets[i];
+		sprintf(t->mount_point, "/oldroot_remount_%d", t->slot);
+		mkdir(t->mount_point, 777);
+		if (mount(t->rootfs_device, t->mount_point, "ext4", 0, NULL) != 0)
+		{
+			my_printf("Error mounting %s to %s: %s\n", t->rootfs_device, t->mount_point, strerror(errno));
+			ret = 0;
+			break;
+		}
+		t->mounted = 1;
+		if (current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0) // box with rootSubDir feature
+			sprintf(t->path, "%s/%s", t->mount_point, t->rootfs_sub_dir);
+		else
+			strcpy(t->path, t->mount_point);
+	}
+
+	if (ret && !multislot_extract(multislot_targets[0].rootfs_filename))
+	{
+		my_printf("Error extracting rootfs\n");
+		ret = 0;
+	}
+
+	if (ret)
+	{
+		stats_phase("Syncing rootfs");
+		for (i = 0; i < multislot_cnt; i++)
+		{
+			char path[1200];
+			snprintf(path, sizeof(path), "%s/", multislot_targets[i].path);
+			copy_backup_to_rootfs(path);
+			if (!durable_sync(multislot_targets[i].path))
+				ret = 0;
+		}
+	}
+
+	for (i = 0; i < multislot_cnt; i++)
+	{
+		struct multislot_target* t = &multislot_targets[i];
+		if (t->mounted && umount(t->mount_point) != 0)
+			my_printf("Error umounting %s: %s\n", t->mount_point, strerror(errno));
+		t->mounted = 0;
+	}
+
+	for (i = 0; ret && kernel && i < multislot_cnt; i++)
+	{
+		struct multislot_target* t = &multislot_targets[i];
+		if (!t->found_kernel_device || t->kernel_filename[0] == '\0' || image_stat(t->kernel_filename, &st) != 0)
+		{
+			my_printf("Error: no kernel device or file for multiboot partition %d\n", t->slot);
+			ret = 0;
+			break;
+		}
+		if (!quiet)
+			my_printf("Flashing kernel %s to %s\n", t->kernel_filename, t->kernel_device);
+		if (t->kernel_flash_mode == TARBZ2)
+			ret = flash_ext4_kernel(t->kernel_device, t->kernel_filename, st.st_size, quiet, no_write);
+		else
+			ret = flash_ubi_jffs2_kernel(t->kernel_device, t->kernel_filename, quiet, no_write);
+		durable_track(t->kernel_device);
+	}
+	if (ret && !no_write)
+		ret = durable_commit();
+
+	return ret;
+}
@@ -42,6 +42,7 @@
 
 #include <asm/types.h>
 #include "mtd/mtd-user.h"
+#include "ofgwrite.h"
 #include "common.h"
 #include <libmtd.h>
 
@@ -62,6 +63,7 @@ static void display_help(int status)
 "  -b, --blockalign=1|2|4  Set multiple of eraseblocks to align to\n"
 "      --input-skip=length Skip |length| bytes of the input file\n"
 "      --input-size=length Only read |length| bytes of the input file\n"
+"      --jffs2-summary     Add JFFS2 erase block summaries while writing\n"
 "  -q, --quiet             Don't display progress messages\n"
 "  -h, --help              Display this help and exit\n"
 "      --version           Output version information and exit\n"
@@ -99,11 +101,13 @@ static bool		autoplace = false;
 static bool		noskipbad = false;
 static bool		pad = false;
 static int		blockalign = 1; /* default to using actual block size */
+static bool		jffs2sum = false; // changed for ofgwrite
 
 static void process_options(int argc, char * const argv[])
 {
 	int error = 0;
 	mtdoffset = 0;
+	jffs2sum = false; // changed for ofgwrite
 
 	for (;;) {
 		int option_index = 0;
@@ -113,6 +117,7 @@ static void process_options(int argc, char * const argv[])
 			{"version", no_argument, 0, 0},
 			{"input-skip", required_argument, 0, 0},
 			{"input-size", required_argument, 0, 0},
+			{"jffs2-summary", no_argument, 0, 0}, // changed for ofgwrite
 			{"help", no_argument, 0, 'h'},
 			{"blockalign", required_argument, 0, 'b'},
 			{"markbad", no_argument, 0, 'm'},
@@ -144,6 +149,9 @@ static void process_options(int argc, char * const argv[])
 			case 2: /* --input-size */
 				inputsize = simple_strtoll(optarg, &error);
 				break;
+			case 3: /* --jffs2-summary, changed for ofgwrite */
+				jffs2sum = true;
+				break;
 			}
 			break;
 		case 'q':
@@ -245,6 +253,7 @@ int nandwrite_main(int argc, char * const argv[])
 	long long offs;
 	int ret;
 	bool failed = true;
+	bool corrupt = false; // changed for ofgwrite
 	/* contains all the data read from the file so far for the current eraseblock */
 	unsigned char *filebuf = NULL;
 	size_t filebuf_max = 0;
@@ -257,8 +266,11 @@ int nandwrite_main(int argc, char * const argv[])
 	int ebsize_aligned;
 	uint8_t write_mode;
 	long long ofg_imglen = 1;
+	long long ofg_input_len = 0;
+	struct jffs2_sum *ofg_sum = NULL;
 
 	process_options(argc, argv);
+	stats_phase("nandwrite");
 
 	/* Open the device */
 	if ((fd = open(mtd_device, O_RDWR)) == -1)
@@ -321,10 +333,10 @@ int nandwrite_main(int argc, char * const argv[])
 	if (strcmp(img, standard_input) == 0)
 		ifd = STDIN_FILENO;
 	else
-		ifd = open(img, O_RDONLY);
+		ifd = image_open(img); // changed for ofgwrite: image can be in a zip archive
 
 	if (ifd == -1) {
-		perror(img);
+		my_perror(img);
 		goto closeall;
 	}
 
@@ -339,7 +351,7 @@ int nandwrite_main(int argc, char * const argv[])
 	} else {
 		if (!inputsize) {
 			struct stat st;
-			if (fstat(ifd, &st)) {
+			if (image_stat(img, &st)) { // changed for ofgwrite
 				sys_errmsg("unable to stat input image");
 				goto closeall;
 			}
@@ -348,12 +360,24 @@ int nandwrite_main(int argc, char * const argv[])
 		} else
 			imglen = inputsize;
 
-		if (inputskip && lseek(ifd, inputskip, SEEK_CUR) == -1) {
-			sys_errmsg("lseek input by %lld failed", inputskip);
+		// changed for ofgwrite: summaries are added while reading, the
+		// output length is only known at its end like for stdin
+		if (jffs2sum && !writeoob) {
+			ofg_sum = jffs2_sum_open(ifd, mtd.eb_size);
+			if (ofg_sum == NULL || !jffs2_sum_skip(ofg_sum, inputskip)) {
+				errmsg("adding JFFS2 summaries failed");
+				goto closeall;
+			}
+			imglen = pagelen;
+			ofg_imglen += inputskip; // input skip counts summarized bytes
+		} else if (inputskip && !journal_skip_input(ifd, inputskip)) { // changed for ofgwrite: also pipes
+			sys_errmsg("skipping input by %lld failed", inputskip);
 			goto closeall;
 		}
 	}
 
+	ofg_input_len = imglen; // changed for ofgwrite
+
 	/* Check, if file is page-aligned */
 	if (!pad && (imglen % pagelen) != 0) {
 		my_fprintf(stderr, "Input file is not page-aligned. Use the padding "
@@ -409,6 +433,11 @@ int nandwrite_main(int argc, char * const argv[])
 				erase_buffer(filebuf, filebuf_len);
 				filebuf_len = 0;
 				writebuf = filebuf;
+				// changed for ofgwrite: everything before this block is written
+				if (ofg_sum)
+					journal_progress(mtd_device, blockstart, jffs2_sum_output_pos(ofg_sum));
+				else if (ifd != STDIN_FILENO)
+					journal_progress(mtd_device, blockstart, inputskip + ofg_input_len - imglen);
 			}
 
 			baderaseblock = false;
@@ -427,6 +456,7 @@ int nandwrite_main(int argc, char * const argv[])
 					goto closeall;
 				} else if (ret == 1) {
 					baderaseblock = true;
+					telemetry_bad_block(mtd_device, offs / mtd.eb_size);
 					if (!quiet)
 						my_fprintf(stderr, "Bad block at %llx, %u block(s) "
 								"from %llx will be skipped\n",
@@ -455,14 +485,18 @@ int nandwrite_main(int argc, char * const argv[])
 			ssize_t cnt = 0;
 
 			while (tinycnt < readlen) {
-				cnt = read(ifd, writebuf + tinycnt, readlen - tinycnt);
+				if (ofg_sum) // changed for ofgwrite
+					cnt = jffs2_sum_read(ofg_sum, writebuf + tinycnt, readlen - tinycnt);
+				else
+					cnt = read(ifd, writebuf + tinycnt, readlen - tinycnt);
 				if (cnt == 0) { /* EOF */
 					break;
 				} else if (cnt < 0) {
-					perror("File I/O error on input");
+					my_perror("File I/O error on input");
 					goto closeall;
 				}
 				tinycnt += cnt;
+				io_source_read(ifd, cnt); // changed for ofgwrite
 			}
 
 			/* No padding needed - we are done */
@@ -472,7 +506,7 @@ int nandwrite_main(int argc, char * const argv[])
 				 * the end of the "file". For nonstandard input,
 				 * leave it as-is to detect an early EOF.
 				 */
-				if (ifd == STDIN_FILENO)
+				if (ifd == STDIN_FILENO || ofg_sum)
 					imglen = 0;
 
 				break;
@@ -490,9 +524,16 @@ int nandwrite_main(int argc, char * const argv[])
 			}
 
 			filebuf_len += readlen - alreadyread;
-			if (ifd != STDIN_FILENO) {
+			if (ofg_sum) { // changed for ofgwrite
+				long long done = jffs2_sum_input_pos(ofg_sum);
+				set_step_progress((int)(done * 100 / ofg_imglen));
+				telemetry_progress(mtd_device, done, ofg_imglen);
+				if (cnt == 0)
+					imglen = 0;
+			} else if (ifd != STDIN_FILENO) {
 				imglen -= tinycnt - alreadyread;
 				set_step_progress((int)((long long)(ofg_imglen - imglen) * 100 / (ofg_imglen)));
+				telemetry_progress(mtd_device, ofg_imglen - imglen, ofg_imglen);
 			} else if (cnt == 0) {
 				/* No more bytes - we are done after writing the remaining bytes */
 				imglen = 0;
@@ -514,7 +555,7 @@ int nandwrite_main(int argc, char * const argv[])
 					if (cnt == 0) { /* EOF */
 						break;
 					} else if (cnt < 0) {
-						perror("File I/O error on input");
+						my_perror("File I/O error on input");
 						goto closeall;
 					}
 					tinycnt += cnt;
@@ -562,12 +603,14 @@ int nandwrite_main(int argc, char * const argv[])
 					sys_errmsg("%s: MTD Erase failure", mtd_device);
 					if (errno_tmp != EIO)
 						goto closeall;
-				}
+				} else
+					telemetry_erase(mtd_device, 1);
 			}
 
 			if (markbad) {
 				my_fprintf(stderr, "Marking block at %08llx bad\n",
 						mtdoffset & (~mtd.eb_size + 1));
+				telemetry_bad_block(mtd_device, mtdoffset / mtd.eb_size);
 				if (mtd_mark_bad(&mtd, fd, mtdoffset / mtd.eb_size)) {
 					sys_errmsg("%s: MTD Mark bad block failure", mtd_device);
 					goto closeall;
@@ -577,6 +620,7 @@ int nandwrite_main(int argc, char * const argv[])
 
 			continue;
 		}
+		telemetry_write(mtd_device, 1);
 		mtdoffset += mtd.min_io_size;
 		writebuf += pagelen;
 	}
@@ -584,7 +628,12 @@ int nandwrite_main(int argc, char * const argv[])
 	failed = false;
 
 closeall:
-	close(ifd);
+	jffs2_sum_close(ofg_sum); // changed for ofgwrite
+	// changed for ofgwrite: CRC error of a zip member is known at the end
+	if (ifd == STDIN_FILENO)
+		close(ifd);
+	else
+		corrupt = !image_close(ifd);
 	libmtd_close(mtd_desc);
 	free(filebuf);
 	close(fd);
@@ -592,6 +641,8 @@ closeall:
 	if (failed || (ifd != STDIN_FILENO && imglen > 0)
 		   || (writebuf < filebuf + filebuf_len))
 		sys_errmsg("Data was only partially written due to error");
+	if (corrupt) // changed for ofgwrite
+		return EXIT_FAILURE;
 
 	/* Return happy */
 	return EXIT_SUCCESS;
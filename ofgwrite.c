@@ -60,6 +60,7 @@ struct boot_img_hdr
 
 struct stat kernel_file_stat;
 struct stat rootfs_file_stat;
+struct stat rootfs_image_file_stat;
 
 char kernel_device_arg[1000];
 char rootfs_device_arg[1000];
@@ -89,14 +90,21 @@ int dreamcard = 1;
 int flash_kernel  = 0;
 int flash_rootfs  = 0;
 int no_write      = 0;
+int diff_rootfs   = 0;
+int jffs2_summary = 0;
+int ubi_volume_update = 0;
+int minimal_runtime = 0;
 int force_neutrino_stop = 0;
 int quiet         = 0;
 int show_help     = 0;
 int newroot_mounted = 0;
 char kernel_filename[1000];
 char rootfs_filename[1000];
+char rootfs_image_filename[1000];
+char* image_directory = NULL;
 char rootfs_mount_point[1000];
 char slotname[1000];
+char telemetry_socket[108] = "/tmp/ofgwrite.sock";
 char *boxname = NULL;
 enum RootfsTypeEnum rootfs_type;
 int stop_neutrino_needed = 1;
@@ -138,53 +146,56 @@ int write_padding(int fd, unsigned pagesize, unsigned itemsize)
     }
 }
 
-static void *load_file(const char *fn, unsigned *_sz)
+/* copies the file fn of size bytes to fd and hashes it on the way */
+static int copy_file_hashed(int fd, const char *fn, unsigned size, EVP_MD_CTX *mdctx)
 {
-    char *data;
-    int sz;
-    int fd;
-
-    data = 0;
-    fd = open(fn, O_RDONLY);
-    if(fd < 0) return 0;
-
-    sz = lseek(fd, 0, SEEK_END);
-    if(sz < 0) goto oops;
-
-    if(lseek(fd, 0, SEEK_SET) != 0) goto oops;
-
-    data = (char*) malloc(sz);
-    if(data == 0) goto oops;
-
-    if(read(fd, data, sz) != sz) goto oops;
-    close(fd);
+    static char buf[65536];
+    unsigned done = 0;
+    ssize_t len;
+    int in;
+
+    in = open(fn, O_RDONLY);
+    if(in < 0) return -1;
+
+    while(done < size) {
+        len = read(in, buf, size - done < sizeof(buf) ? size - done : sizeof(buf));
+        if(len < 0 && errno == EINTR) continue;
+        if(len <= 0) break;
+        EVP_DigestUpdate(mdctx, buf, len);
+        if(write(fd, buf, len) != len) break;
+        done += len;
+    }
+    close(in);
+    return done == size ? 0 : -1;
+}
 
-    if(_sz) *_sz = sz;
-    return data;
+static int file_size(const char *fn, unsigned *_sz)
+{
+    struct stat st;
 
-oops:
-    close(fd);
-    if(data != 0) free(data);
+    if(stat(fn, &st) != 0) return -1;
+    *_sz = st.st_size;
     return 0;
 }
 
+/* Writes the boot image to kernelPath, a file or the kernel block device.
+ * Kernel and dtb are streamed to their pages while the id hash is computed,
+ * the header with the hash is written last into the first page.
+ */
 int generate_boot_image(const char *kernelPath)
 {
     boot_img_hdr hdr;
     char *kernel_fn = NULL;
-    void *kernel_data = NULL;
-    char *ramdisk_fn = NULL;
-    void *ramdisk_data = NULL;
     int second_fn_len = snprintf(NULL, 0, "/oldroot_remount/boot/dream%s.dtb", boxname);
     char *second_fn = (char *)malloc(second_fn_len + 1);
-    void *second_data = NULL;
     int cmdline_len = snprintf(NULL, 0, "console=ttyS0,1000000 root=%s rootwait rootfstype=ext4 no_console_suspend", rootfs_device);
     char *cmdline = (char *)malloc(cmdline_len + 1);
     char *bootimg = NULL;
     char *board = "";
     uint32_t pagesize = 2048;
     int fd;
-    const uint8_t* sha;
+    int blockdev;
+    struct stat st;
     uint32_t base           = 0x10000000U;
     uint32_t kernel_offset  = 0x00008000U;
     uint32_t ramdisk_offset = 0x01000000U;
@@ -240,27 +251,21 @@ int generate_boot_image(const char *kernelPath)
         cmdline += (BOOT_ARGS_SIZE - 1);
         strncpy((char *)hdr.extra_cmdline, cmdline, BOOT_EXTRA_ARGS_SIZE);
     }
-    kernel_data = load_file(kernel_fn, &hdr.kernel_size);
-    if(kernel_data == 0) {
+    if(file_size(kernel_fn, &hdr.kernel_size)) {
         my_printf("error: could not load kernel '%s'\n", kernel_fn);
         return EXIT_FAILURE;;
     }
-        ramdisk_data = 0;
         hdr.ramdisk_size = 0;
 
-    if(second_fn) {
-        second_data = load_file(second_fn, &hdr.second_size);
-        if(second_data == 0) {
-            my_printf("error: could not load secondstage '%s'\n", second_fn);
-            return EXIT_FAILURE;;
-        }
+    if(file_size(second_fn, &hdr.second_size)) {
+        my_printf("error: could not load secondstage '%s'\n", second_fn);
+        return EXIT_FAILURE;;
     }
     /* put a hash of the contents in the header so boot images can be
      * differentiated based on their first 2k.
      */
     EVP_MD_CTX *mdctx;
-    const EVP_MD *md;
-    unsigned char hash[SHA_DIGEST_LENGTH];
+    unsigned char hash[EVP_MAX_MD_SIZE];
 
     // Initialize OpenSSL library
     OPENSSL_init_crypto(OPENSSL_INIT_ADD_ALL_DIGESTS, NULL);
@@ -272,57 +277,55 @@ int generate_boot_image(const char *kernelPath)
         return EXIT_FAILURE;;
     }
 
-    // Specify the hash algorithm (SHA-1 in this case)
-    md = EVP_sha1();
-
-    // Initialize the context with the chosen hash algorithm
-    if (1 != EVP_DigestInit_ex(mdctx, md, NULL)) {
+    // SHA-1 over kernel, kernel size, ramdisk size, dtb and dtb size
+    if (1 != EVP_DigestInit_ex(mdctx, EVP_sha1(), NULL)) {
         my_printf("EVP_DigestInit_ex() failed.\n");
+        EVP_MD_CTX_free(mdctx);
         return EXIT_FAILURE;;
     }
-    // Update the hash context with your data
-    // Assuming kernel_data, ramdisk_data, second_data, and hdr are properly defined
-    // hdr.kernel_size, hdr.ramdisk_size, and hdr.second_size are also assumed to be set correctly
-    EVP_DigestUpdate(mdctx, kernel_data, hdr.kernel_size);
-    EVP_DigestUpdate(mdctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
-    EVP_DigestUpdate(mdctx, ramdisk_data, hdr.ramdisk_size);
-    EVP_DigestUpdate(mdctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
-    EVP_DigestUpdate(mdctx, second_data, hdr.second_size);
-    EVP_DigestUpdate(mdctx, &hdr.second_size, sizeof(hdr.second_size));
-    // Finalize the hash and obtain the result
-    if (1 != EVP_DigestFinal_ex(mdctx, hash, NULL)) {
-        my_printf("EVP_DigestFinal_ex() failed.\n");
-        return EXIT_FAILURE;;
-    }
-
-    // Copy the hash result to hdr.id
-    memcpy(hdr.id, hash, SHA_DIGEST_LENGTH);
 
-    // Check if the kernel.img file already exists
-    if (access(bootimg, F_OK) != -1) {
+    // a block device is written in place, a file is created new
+    blockdev = stat(bootimg, &st) == 0 && S_ISBLK(st.st_mode);
+    if (!blockdev && access(bootimg, F_OK) != -1) {
         // If it exists, remove it
         if (remove(bootimg) != 0) {
             my_printf("Failed to delete existing %s\n", bootimg);
-           return EXIT_FAILURE;
+            EVP_MD_CTX_free(mdctx);
+            return EXIT_FAILURE;
         }
         my_printf("Existing %s removed.\n", bootimg);
     }
 
-    fd = open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    fd = blockdev ? open(bootimg, O_WRONLY) : open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
     if(fd < 0) {
         my_printf("error: could not create '%s'\n", bootimg);
+        EVP_MD_CTX_free(mdctx);
         return EXIT_FAILURE;;
     }
-    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
-    if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
-    if(write(fd, kernel_data, hdr.kernel_size) != (ssize_t) hdr.kernel_size) goto fail;
+
+    // data behind the header page(s), padded in place
+    if(lseek(fd, (sizeof(hdr) + pagesize - 1) / pagesize * pagesize, SEEK_SET) < 0) goto fail;
+    if(copy_file_hashed(fd, kernel_fn, hdr.kernel_size, mdctx)) goto fail;
+    EVP_DigestUpdate(mdctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
     if(write_padding(fd, pagesize, hdr.kernel_size)) goto fail;
-    if(write(fd, ramdisk_data, hdr.ramdisk_size) != (ssize_t) hdr.ramdisk_size) goto fail;
-    if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
-    if(second_data) {
-        if(write(fd, second_data, hdr.second_size) != (ssize_t) hdr.second_size) goto fail;
-        if(write_padding(fd, pagesize, hdr.second_size)) goto fail;
+    EVP_DigestUpdate(mdctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
+    if(copy_file_hashed(fd, second_fn, hdr.second_size, mdctx)) goto fail;
+    EVP_DigestUpdate(mdctx, &hdr.second_size, sizeof(hdr.second_size));
+    if(write_padding(fd, pagesize, hdr.second_size)) goto fail;
+
+    if (1 != EVP_DigestFinal_ex(mdctx, hash, NULL)) {
+        my_printf("EVP_DigestFinal_ex() failed.\n");
+        goto fail;
     }
+    memcpy(hdr.id, hash, SHA_DIGEST_LENGTH);
+
+    // header last: the image is only valid when complete
+    if(lseek(fd, 0, SEEK_SET) != 0) goto fail;
+    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
+    if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
+    if(fsync(fd) != 0) goto fail;
+    close(fd);
+    EVP_MD_CTX_free(mdctx);
 
     if (get_id) {
         print_id((uint8_t *) hdr.id, sizeof(hdr.id));
@@ -331,43 +334,59 @@ int generate_boot_image(const char *kernelPath)
     return 0;
 
 fail:
-    unlink(bootimg);
+    if (!blockdev)
+        unlink(bootimg);
     close(fd);
+    EVP_MD_CTX_free(mdctx);
     my_printf("error: failed writing '%s'\n", bootimg);
     return EXIT_FAILURE;;
 }
 
 void my_printf(char const *fmt, ...)
 {
-	va_list ap, ap2;
+	char msg[4096];
+	va_list ap;
+	int len;
+
 	va_start(ap, fmt);
-	va_copy(ap2, ap);
-	// print to console
-	vprintf(fmt, ap);
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
 
-	// print to syslog
-	vsyslog(LOG_INFO, fmt, ap2);
-	va_end(ap2);
+	// print to console and syslog (asynchronous)
+	logger_write(stdout, msg, len);
 }
 
 void my_fprintf(FILE * f, char const *fmt, ...)
 {
-	va_list ap, ap2;
+	char msg[4096];
+	va_list ap;
+	int len;
+
 	va_start(ap, fmt);
-	va_copy(ap2, ap);
-	// print to file (normally stdout or stderr)
-	vfprintf(f, fmt, ap);
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
 
-	// print to syslog
-	vsyslog(LOG_INFO, fmt, ap2);
-	va_end(ap2);
+	// print to file (normally stdout or stderr) and syslog (asynchronous)
+	logger_write(f, msg, len);
+}
+
+// perror() through the logger, so it isn't reordered with queued messages
+void my_perror(const char* s)
+{
+	my_fprintf(stderr, "%s: %s\n", s, strerror(errno));
 }
 
 void printUsage()
 {
-	my_printf("Usage: ofgwrite <parameter> <image_directory>\n");
+	my_printf("Usage: ofgwrite <parameter> <image_directory or image.zip>\n");
 	my_printf("Options:\n");
 	//NI my_printf("   -a --android          create Android boot image header\n");
 	my_printf("   -k --kernel           flash kernel with automatic device recognition(default)\n");
@@ -379,7 +398,14 @@ void printUsage()
 	my_printf("   -rmmcblkxpx --rootfs=mmcblkxpx  use mmcblkxpx device for rootfs flashing\n");
 	my_printf("   -sNN --slotname=NN    user defined slot name\n");
 	my_printf("   -mx --multi=x         flash multiboot partition x (x= 1, 2, 3,...). Only supported by some boxes.\n");
+	my_printf("   -d --diff             update rootfs in place: only files with changed size/mode/owner/mtime are written\n");
+	my_printf("   -dcontent --diff=content  like -d, but compare also content of unchanged files\n");
+	my_printf("   -lx,y --slots=x,y     flash multiboot partitions x, y,... with one decompression of the rootfs\n");
+	my_printf("   -j --jffs2-summary    write JFFS2 erase block summaries while flashing (NAND, faster first mount)\n");
+	my_printf("   -u --ubi-update       update only the rootfs volume if the UBI layout matches the image (NAND UBIFS)\n");
+	my_printf("   -x --minimal-runtime  pivot into a runtime of only ofgwrite (no busybox, shell and libraries)\n");
 	my_printf("   -n --nowrite          show only found image and mtd partitions (no write)\n");
+	my_printf("   -tPATH --telemetry=PATH  send progress events to unix socket PATH (default /tmp/ofgwrite.sock)\n");
 	my_printf("   -f --force            force kill neutrino\n");
 	my_printf("   -q --quiet            show less output\n");
 	my_printf("   -h --help             show help\n");
@@ -418,10 +444,70 @@ char* ReadProcEntry(char *filename)
 	return real_boxtype_name;
 }
 
+// checks whether file name in directory path (ends with /) is an image file
+static void check_image_file(char* path, char* name)
+{
+	if ((strstr(name, "kernel") != NULL
+	  && strstr(name, ".bin")   != NULL)									// ET-xx00, XP1000, VU boxes, DAGS boxes
+	 || strcmp(name, "uImage") == 0									// Spark boxes
+	 || (strcmp(name, "kernel1_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 1)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "kernel2_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 2)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "kernel3_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 3)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "kernel4_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 4))		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	{
+		strcpy(kernel_filename, path);
+		strcpy(&kernel_filename[strlen(path)], name);
+		image_stat(kernel_filename, &kernel_file_stat);
+		my_printf("Found kernel file: %s\n", kernel_filename);
+	}
+/* //NI
+	if (strcmp(name, "rootfs.bin") == 0			// ET-xx00, XP1000
+	 || strcmp(name, "root_cfe_auto.bin") == 0		// Solo2
+	 || strcmp(name, "root_cfe_auto.jffs2") == 0		// other VU boxes
+	 || strcmp(name, "oe_rootfs.bin") == 0			// DAGS boxes
+	 || strcmp(name, "e2jffs2.img") == 0			// Spark boxes
+	 || strcmp(name, "rootfs.tar.bz2") == 0		// solo4k
+	 || strcmp(name, "rootfs.ubi") == 0			// Zgemma H9
+	 || strcmp(name, "rootfs.tar.xz") == 0)		// dream
+	 || strcmp(name, "rootfs-one.tar.bz2") == 0		// dreamone
+	 || strcmp(name, "rootfs-two.tar.bz2") == 0)		// dreamtwo
+*/
+	if (strcmp(name, "rootfs.tar.bz2") == 0
+	 || (strcmp(name, "rootfs1.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 1)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "rootfs2.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 2)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "rootfs3.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 3)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	 || (strcmp(name, "rootfs4.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 4))	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
+	{
+		strcpy(rootfs_filename, path);
+		strcpy(&rootfs_filename[strlen(path)], name);
+		image_stat(rootfs_filename, &rootfs_file_stat);
+		my_printf("Found rootfs file: %s\n", rootfs_filename);
+	}
+	// raw UBIFS image for MTD boxes, ubinized while flashing. A tar archive is preferred
+	if (strcmp(name, "rootfs.ubifs") == 0 && rootfs_filename[0] == '\0')
+	{
+		strcpy(rootfs_filename, path);
+		strcpy(&rootfs_filename[strlen(path)], name);
+		image_stat(rootfs_filename, &rootfs_file_stat);
+		my_printf("Found rootfs file: %s\n", rootfs_filename);
+	}
+	// ext4 image (raw or Android sparse) optionally compressed
+	if (strcmp(name, "rootfs.ext4") == 0
+	 || strcmp(name, "rootfs.ext4.bz2") == 0
+	 || strcmp(name, "rootfs.ext4.xz") == 0)
+	{
+		strcpy(rootfs_image_filename, path);
+		strcpy(&rootfs_image_filename[strlen(path)], name);
+		image_stat(rootfs_image_filename, &rootfs_image_file_stat);
+		my_printf("Found rootfs image file: %s\n", rootfs_image_filename);
+	}
+}
+
 int find_image_files(char* p)
 {
 	DIR *d;
 	struct dirent *entry;
+	struct stat st;
 	char path[4097];
 
 	if (realpath(p, path) == NULL)
@@ -432,68 +518,49 @@ int find_image_files(char* p)
 	my_printf("Searching image files in %s resolved to %s\n", p, path);
 	kernel_filename[0] = '\0';
 	rootfs_filename[0] = '\0';
+	rootfs_image_filename[0] = '\0';
 
-	// add / to the end of the path
-	if (path[strlen(path)-1] != '/')
+	// zip archive: image files are read directly from the archive
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
 	{
-		path[strlen(path)+1] = '\0';
-		path[strlen(path)] = '/';
+		if (!zip_open_image(path))
+			return 0;
+		zip_find_image_files(check_image_file);
 	}
-
-	d = opendir(path);
-
-	if (!d)
+	else
 	{
-		perror("Error reading image_directory");
-		my_printf("\n");
-		return 0;
-	}
+		// add / to the end of the path
+		if (path[strlen(path)-1] != '/')
+		{
+			path[strlen(path)+1] = '\0';
+			path[strlen(path)] = '/';
+		}
 
-	do
-	{
-		entry = readdir(d);
-		if (entry)
+		d = opendir(path);
+
+		if (!d)
 		{
-			if ((strstr(entry->d_name, "kernel") != NULL
-			  && strstr(entry->d_name, ".bin")   != NULL)									// ET-xx00, XP1000, VU boxes, DAGS boxes
-			 || strcmp(entry->d_name, "uImage") == 0									// Spark boxes
-			 || (strcmp(entry->d_name, "kernel1_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 1)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "kernel2_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 2)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "kernel3_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 3)		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "kernel4_auto.bin") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 4))		// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			{
-				strcpy(kernel_filename, path);
-				strcpy(&kernel_filename[strlen(path)], entry->d_name);
-				stat(kernel_filename, &kernel_file_stat);
-				my_printf("Found kernel file: %s\n", kernel_filename);
-			}
-/* //NI
-			if (strcmp(entry->d_name, "rootfs.bin") == 0			// ET-xx00, XP1000
-			 || strcmp(entry->d_name, "root_cfe_auto.bin") == 0		// Solo2
-			 || strcmp(entry->d_name, "root_cfe_auto.jffs2") == 0		// other VU boxes
-			 || strcmp(entry->d_name, "oe_rootfs.bin") == 0			// DAGS boxes
-			 || strcmp(entry->d_name, "e2jffs2.img") == 0			// Spark boxes
-			 || strcmp(entry->d_name, "rootfs.tar.bz2") == 0		// solo4k
-			 || strcmp(entry->d_name, "rootfs.ubi") == 0			// Zgemma H9
-			 || strcmp(entry->d_name, "rootfs.tar.xz") == 0)		// dream
-			 || strcmp(entry->d_name, "rootfs-one.tar.bz2") == 0		// dreamone
-			 || strcmp(entry->d_name, "rootfs-two.tar.bz2") == 0)		// dreamtwo
-*/
-			if (strcmp(entry->d_name, "rootfs.tar.bz2") == 0
-			 || (strcmp(entry->d_name, "rootfs1.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 1)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "rootfs2.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 2)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "rootfs3.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 3)	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			 || (strcmp(entry->d_name, "rootfs4.tar.bz2") == 0 && (!strcmp(vumodel, "solo4k") || !strcmp(vumodel, "duo4k") || !strcmp(vumodel, "duo4kse") || !strcmp(vumodel, "ultimo4k") || !strcmp(vumodel, "uno4k") || !strcmp(vumodel, "uno4kse") || !strcmp(vumodel, "zero4k")) && multiboot_partition == 4))	// vusolo4k/vuduo4k/vuduo4kse/vuultimo4k/vuuno4k/vuuno4kse/vuzero4k multiboot
-			{
-				strcpy(rootfs_filename, path);
-				strcpy(&rootfs_filename[strlen(path)], entry->d_name);
-				stat(rootfs_filename, &rootfs_file_stat);
-				my_printf("Found rootfs file: %s\n", rootfs_filename);
-			}
+			my_perror("Error reading image_directory");
+			my_printf("\n");
+			return 0;
 		}
-	} while (entry);
 
-	closedir(d);
+		do
+		{
+			entry = readdir(d);
+			if (entry)
+				check_image_file(path, entry->d_name);
+		} while (entry);
+
+		closedir(d);
+	}
+
+	// no tar archive: use image. Whether it can be used is checked in select_rootfs_image()
+	if (rootfs_filename[0] == '\0' && rootfs_image_filename[0] != '\0')
+	{
+		strcpy(rootfs_filename, rootfs_image_filename);
+		rootfs_file_stat = rootfs_image_file_stat;
+	}
 
 	return 1;
 }
@@ -504,14 +571,20 @@ int read_args(int argc, char *argv[])
 	int opt;
 	char *endptr;
 	long val;
-	static const char *short_options = "ak::r::ns:m:fqh";
+	static const char *short_options = "ak::r::d::juxns:m:l:t:fqh";
 	static const struct option long_options[] = {
 												{"android"  , no_argument, NULL, 'a'},
 												{"kernel"    , optional_argument, NULL, 'k'},
 												{"rootfs"    , optional_argument, NULL, 'r'},
+												{"diff"      , optional_argument, NULL, 'd'},
+												{"jffs2-summary", no_argument   , NULL, 'j'},
+												{"ubi-update", no_argument      , NULL, 'u'},
+												{"minimal-runtime", no_argument , NULL, 'x'},
 												{"nowrite"   , no_argument      , NULL, 'n'},
 												{"slotname"  , required_argument, NULL, 's'},
 												{"multi"     , required_argument, NULL, 'm'},
+												{"slots"     , required_argument, NULL, 'l'},
+												{"telemetry" , required_argument, NULL, 't'},
 												{"force"     , no_argument      , NULL, 'f'},
 												{"quiet"     , no_argument      , NULL, 'q'},
 												{"help"      , no_argument      , NULL, 'h'},
@@ -585,6 +658,15 @@ int read_args(int argc, char *argv[])
 					}
 				}
 				break;
+			case 'l':
+				if (!multislot_parse(optarg))
+				{
+					my_printf("Error: Wrong multiboot partition list %s. Use e.g. 1,2,3\n", optarg);
+					show_help = 1;
+					return 0;
+				}
+				my_printf("Flashing %d multiboot partitions\n", multislot_cnt);
+				break;
 			case 's':
 				if (optarg) {
 					my_printf("Using user defined slot directory: %s\n", optarg);
@@ -592,6 +674,39 @@ int read_args(int argc, char *argv[])
 					user_slotname = 1;
 				}
 				break;
+			case 't':
+				if (optarg)
+				{
+					if (strlen(optarg) >= sizeof(telemetry_socket))
+					{
+						my_printf("Error: Telemetry socket path too long!\n");
+						show_help = 1;
+						return 0;
+					}
+					strcpy(telemetry_socket, optarg);
+				}
+				break;
+			case 'd':
+				diff_rootfs = DIFF_ROOTFS_METADATA;
+				if (optarg && !strcmp(optarg, "content"))
+					diff_rootfs = DIFF_ROOTFS_CONTENT;
+				else if (optarg)
+				{
+					my_printf("Error: Wrong diff mode %s. Only content is allowed!\n", optarg);
+					show_help = 1;
+					return 0;
+				}
+				my_printf("Updating only changed rootfs files\n");
+				break;
+			case 'j':
+				jffs2_summary = 1;
+				break;
+			case 'u':
+				ubi_volume_update = 1;
+				break;
+			case 'x':
+				minimal_runtime = 1;
+				break;
 			case 'n':
 				no_write = 1;
 				break;
@@ -621,6 +736,7 @@ int read_args(int argc, char *argv[])
 	}
 	else if (optind + 1 == argc)
 	{
+		image_directory = argv[optind];
 		if (!find_image_files(argv[optind]))
 			return 0;
 
@@ -648,7 +764,7 @@ int read_mtd_file()
 	f = fopen("/proc/mtd", "r");
 	if (f == NULL)
 	{ 
-		perror("Error while opening /proc/mtd");
+		my_perror("Error while opening /proc/mtd");
 		// for testing try to open local mtd file
 		f = fopen("./mtd", "r");
 		if (f == NULL)
@@ -856,6 +972,7 @@ int read_mtd_file()
 
 int kernel_flash(char* device, char* filename)
 {
+	durable_track(device);
 	if (kernel_flash_mode == TARBZ2)
 		return flash_ext4_kernel(device, filename, kernel_file_stat.st_size, quiet, no_write);
 	else if (kernel_flash_mode == MTD)
@@ -864,11 +981,21 @@ int kernel_flash(char* device, char* filename)
 
 int rootfs_flash(char* device, char* filename)
 {
-	if (rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD)
+	if ((rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD) && diff_rootfs)
+	{
+		my_printf("Flash rootfs update\n");
+		return flash_sync_rootfs(filename, quiet, no_write);
+	}
+	else if (rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD)
 	{
 		my_printf("Flash rootfs unpack\n");
 		return flash_unpack_rootfs(filename, quiet, no_write);
 	}
+	else if (rootfs_flash_mode == EXT4_IMAGE)
+	{
+		my_printf("Flash rootfs image\n");
+		return flash_ext4_image_rootfs(device, filename, quiet, no_write);
+	}
 	else if (rootfs_flash_mode == MTD)
 	{
 		if (rootfs_type == EXT4) // MTD rootfs with unknown format -> expect ubifs as only ubifs boxes support this
@@ -908,7 +1035,7 @@ int readProcMounts()
 	f = setmntent("/proc/mounts", "r");
 	if (!f)
 	{
-		perror("Error while opening /proc/mounts");
+		my_perror("Error while opening /proc/mounts");
 		return 0;
 	}
 
@@ -984,22 +1111,11 @@ int readProcMounts()
 	return 1;
 }
 
+static const char* const neutrino_procs[] = { "start_neutrino", "neutrino", NULL };
+
 int exec_ps()
 {
-	// call ps
-	optind = 0; // reset getopt_long
-	char* argv[] = {
-		"ps",		// program name
-		NULL
-	};
-	int argc = (int)(sizeof(argv) / sizeof(argv[0])) - 1;
-
-	my_printf("Execute: ps\n");
-	if (ps_main(argc, argv) == 9999)
-	{
-		return 1; // neutrino found
-	}
-	return 0; // neutrino not found
+	return proc_kill(neutrino_procs, NULL, 0) > 0; // neutrino found
 }
 
 int check_neutrino_stopped()
@@ -1016,12 +1132,10 @@ int check_neutrino_stopped()
 		//NI neutrino_found = exec_ps(); //FIXME
 
 		//NI
-		system("killall start_neutrino 2>/dev/null");
-		int ret = system("pidof neutrino >/dev/null");
-		if (ret == 0)
-			neutrino_found = system("killall neutrino && sleep 3");
-		else
-			neutrino_found = 0;
+		int ret = proc_kill(neutrino_procs, NULL, SIGTERM);
+		if (ret > 0)
+			sleep(3);
+		neutrino_found = (ret < 0);
 
 		if (!neutrino_found)
 		{
@@ -1060,19 +1174,9 @@ int check_neutrino_stopped()
 
 int exec_fuser_kill()
 {
-	optind = 0; // reset getopt_long
-	char* argv[] = {
-		"fuser",		// program name
-		"-k",			// kill
-		"-m",			// mount point
-		"/oldroot/",	// rootfs
-		NULL
-	};
-	int argc = (int)(sizeof(argv) / sizeof(argv[0])) - 1;
-
-	my_printf("Execute: fuser -k -m /oldroot/\n");
+	my_printf("Killing processes using /oldroot/\n");
 	if (!no_write)
-		if (fuser_main(argc, argv) != 0)
+		if (proc_kill(NULL, "/oldroot/", SIGKILL) <= 0)
 			return 0;
 
 	return 1;
@@ -1186,11 +1290,21 @@ int umount_rootfs(int steps)
 		return 0;
 	}
 
+	// minimal runtime: the static ofgwrite is also the init of the new root
+	if (minimal_runtime && !runtime_install_init("/newroot/sbin/init"))
+	{
+		my_printf("Minimal runtime not possible, copying busybox and init\n");
+		minimal_runtime = 0;
+	}
+
 	// we need init and libs to be able to exec init u later
-	ret =  system("cp -arf /bin/busybox*     /newroot/bin");
-	ret += system("cp -arf /bin/sh*          /newroot/bin");
-	ret += system("cp -arf /bin/bash*        /newroot/bin");
-	ret += system("cp -arf /sbin/init*       /newroot/sbin");
+	if (!minimal_runtime)
+	{
+		ret =  system("cp -arf /bin/busybox*     /newroot/bin");
+		ret += system("cp -arf /bin/sh*          /newroot/bin");
+		ret += system("cp -arf /bin/bash*        /newroot/bin");
+		ret += system("cp -arf /sbin/init*       /newroot/sbin");
+	}
 
 /* //NI
 	if (multilib)
@@ -1315,6 +1429,17 @@ int umount_rootfs(int steps)
 		return 0;
 	}
 
+	// the old rootfs is still untouched: Neutrino can be started again
+	set_step_without_incr("Checking image");
+	if (!image_check_finish())
+	{
+		my_printf("Error image is corrupted! Abort flashing.\n");
+		set_error_text("Error image is corrupted! Abort flashing.");
+		sleep(5);
+		ret = system("init 3");
+		return 0;
+	}
+
 	// some boxes don't allow to open framebuffer while neutrino is running
 	// reopen framebuffer to show the GUI
 	close_framebuffer();
@@ -1357,6 +1482,7 @@ int umount_rootfs(int steps)
 		set_error_text1("Error move mounts to newroot. Abort flashing!");
 		set_error_text2("Rebooting in 30 seconds!");
 		sleep(30);
+		logger_flush();
 		reboot(LINUX_REBOOT_CMD_RESTART);
 		return 0;
 	}
@@ -1388,8 +1514,11 @@ int umount_rootfs(int steps)
 	}
 
 	// create link for mount/umount for autofs
-	ret = symlink("/bin/busybox", "/bin/mount");
-	ret += symlink("/bin/busybox", "/bin/umount");
+	if (!minimal_runtime)
+	{
+		ret = symlink("/bin/busybox", "/bin/mount");
+		ret += symlink("/bin/busybox", "/bin/umount");
+	}
 
 /* //NI
 	// try to restart autofs
@@ -1401,7 +1530,10 @@ int umount_rootfs(int steps)
 
 */
 	// restart init process
-	ret = system("exec init u");
+	if (minimal_runtime)
+		ret = runtime_init_reexec();
+	else
+		ret = system("exec init u");
 	sleep(3);
 
 	// kill all remaining open processes which prevent umounting rootfs
@@ -1432,6 +1564,7 @@ int umount_rootfs(int steps)
 			set_error_text1("Error remounting root! Abort flashing.");
 			set_error_text2("Rebooting in 30 seconds");
 			sleep(30);
+			logger_flush();
 			reboot(LINUX_REBOOT_CMD_RESTART);
 			return 0;
 		}
@@ -1445,6 +1578,7 @@ int umount_rootfs(int steps)
 			set_error_text1("Error remounting root ro! Abort flashing.");
 			set_error_text2("Rebooting in 30 seconds");
 			sleep(30);
+			logger_flush();
 			reboot(LINUX_REBOOT_CMD_RESTART);
 			return 0;
 		}
@@ -1518,7 +1652,7 @@ void readProcCmdline()
 	f = fopen("/proc/cmdline", "r");
 	if (f == NULL)
 	{
-		perror("Error while opening /proc/cmdline");
+		my_perror("Error while opening /proc/cmdline");
 		return;
 	}
 
@@ -1558,19 +1692,23 @@ void find_kernel_rootfs_device()
 	{
 		found_kernel_device = 0;
 		found_rootfs_device = 0;
-		// get kernel/rootfs from fdisk
-		// call fdisk -l
-		optind = 0; // reset getopt_long
-		char* argv[] = {
-			"fdisk",		// program name
-			"-l",			// list
-			NULL
-		};
-		int argc = (int)(sizeof(argv) / sizeof(argv[0])) - 1;
-
-		my_printf("Execute: fdisk -l\n");
-		if (fdisk_main(argc, argv) != 0)
-			return;
+		// get kernel/rootfs from GPT partition names in sysfs
+		my_printf("Searching partitions\n");
+		if (!find_gpt_partitions())
+		{
+			// no partition info in sysfs -> call fdisk -l
+			optind = 0; // reset getopt_long
+			char* argv[] = {
+				"fdisk",		// program name
+				"-l",			// list
+				NULL
+			};
+			int argc = (int)(sizeof(argv) / sizeof(argv[0])) - 1;
+
+			my_printf("Execute: fdisk -l\n");
+			if (fdisk_main(argc, argv) != 0)
+				return;
+		}
 	}
 
 	if (!found_kernel_device && mtd_kernel_found)
@@ -1739,25 +1877,54 @@ void find_kernel_rootfs_device()
 	}
 }
 
+/* Use ext4 image instead of tar archive if the whole rootfs partition belongs to the flashed image.
+ * Not possible with rootSubDir multiboot (partition is shared by several images) and kexec
+ * (kernel is written into the mounted rootfs).
+ */
+void select_rootfs_image()
+{
+	if (rootfs_image_filename[0] == '\0')
+		return;
+
+	if (rootfs_flash_mode != TARBZ2 || !found_rootfs_device)
+		my_printf("Rootfs image %s can only be flashed to an ext4 rootfs device\n", rootfs_image_filename);
+	else if ((current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0) || strcmp(kexec_mode, "1") == 0)
+		my_printf("Rootfs partition %s is shared with other images. Can't use rootfs image %s\n", rootfs_device, rootfs_image_filename);
+	else
+	{
+		rootfs_flash_mode = EXT4_IMAGE;
+		strcpy(rootfs_filename, rootfs_image_filename);
+		rootfs_file_stat = rootfs_image_file_stat;
+		my_printf("Using rootfs image %s\n", rootfs_filename);
+		return;
+	}
+
+	// the image was taken because there is no tar archive: no rootfs file
+	if (strcmp(rootfs_filename, rootfs_image_filename) == 0)
+		rootfs_filename[0] = '\0';
+}
+
 // Checks whether kernel and rootfs device is bigger than the kernel and rootfs file
 int check_device_size()
 {
 	unsigned long long devsize = 0;
-	int fd = 0;
+	int fd;
 	// check kernel
 	if (found_kernel_device && kernel_filename[0] != '\0' && kernel_flash_mode == TARBZ2 && (strcmp(kexec_mode, "1") != 0))
 	{
 		fd = open(kernel_device, O_RDONLY);
-		if (fd <= 0)
+		if (fd < 0)
 		{
 			my_printf("Unable to open kernel device %s. Aborting\n", kernel_device);
 			return 0;
 		}
 		if (ioctl(fd, BLKGETSIZE64, &devsize))
 		{
+			close(fd);
 			my_printf("Couldn't determine kernel device size. Aborting\n");
 			return 0;
 		}
+		close(fd);
 		if (kernel_file_stat.st_size > devsize)
 		{
 			my_printf("Kernel file(%lld) is bigger than kernel device(%llu). Aborting\n", kernel_file_stat.st_size, devsize);
@@ -1769,16 +1936,18 @@ int check_device_size()
 	if (found_rootfs_device && rootfs_filename[0] != '\0' && rootfs_flash_mode == TARBZ2)
 	{
 		fd = open(rootfs_device, O_RDONLY);
-		if (fd <= 0)
+		if (fd < 0)
 		{
 			my_printf("Unable to open rootfs device %s. Aborting\n", rootfs_device);
 			return 0;
 		}
 		if (ioctl(fd, BLKGETSIZE64, &devsize))
 		{
+			close(fd);
 			my_printf("Couldn't determine rootfs device size. Aborting\n");
 			return 0;
 		}
+		close(fd);
 		if (rootfs_file_stat.st_size > devsize)
 		{
 			my_printf("Rootfs file (%lld) is bigger than rootfs device(%llu). Aborting\n", rootfs_file_stat.st_size, devsize);
@@ -1786,17 +1955,56 @@ int check_device_size()
 		}
 	}
 
+	// check rootfs image: size of contained filesystem
+	if (found_rootfs_device && rootfs_filename[0] != '\0' && rootfs_flash_mode == EXT4_IMAGE)
+	{
+		unsigned long long fssize = ext4_image_size(rootfs_filename);
+		if (fssize == 0)
+		{
+			my_printf("Rootfs image %s is neither an Android sparse nor an ext4 image. Aborting\n", rootfs_filename);
+			return 0;
+		}
+		fd = open(rootfs_device, O_RDONLY);
+		if (fd < 0)
+		{
+			my_printf("Unable to open rootfs device %s. Aborting\n", rootfs_device);
+			return 0;
+		}
+		if (ioctl(fd, BLKGETSIZE64, &devsize))
+		{
+			close(fd);
+			my_printf("Couldn't determine rootfs device size. Aborting\n");
+			return 0;
+		}
+		close(fd);
+		if (fssize > devsize)
+		{
+			my_printf("Rootfs image filesystem (%llu) is bigger than rootfs device(%llu). Aborting\n", fssize, devsize);
+			return 0;
+		}
+	}
+
 	return 1;
 }
 
+// send final telemetry events and write phase statistics
+void report_flash_result(int success)
+{
+	telemetry_finish(success);
+	stats_report();
+	logger_flush();
+}
+
 void handle_busybox_fatal_error()
 {
 	my_printf("Error flashing rootfs! System won't boot. Please flash backup! System will reboot in 60 seconds\n");
 	set_error_text1("Error untar rootfs. System won't boot!");
 	set_error_text2("Please flash backup! Rebooting in 60 sec");
+	report_flash_result(0);
 	if (stop_neutrino_needed)
 	{
 		sleep(60);
+		logger_flush();
 		reboot(LINUX_REBOOT_CMD_RESTART);
 	}
 	sleep(30);
@@ -1806,12 +2014,20 @@ void handle_busybox_fatal_error()
 
 int main(int argc, char *argv[])
 {
+	// init of the minimal runtime
+	if (getpid() == 1)
+		return runtime_init();
+
 	// Check if running on a box or on a PC. Stop working on PC to prevent overwriting important files
 #if defined(__i386) || defined(__x86_64__)
 	my_printf("You're running ofgwrite on a PC. Aborting...\n");
 	exit(EXIT_FAILURE);
 #endif
 
+	// minimal runtime: continue from a memfd before anything is done
+	if (runtime_wanted(argc, argv))
+		runtime_reexec(argv);
+
 	strcpy(vumodel, "");
 	FILE *fvu = fopen("/proc/stb/info/vumodel", "r");
 	if (fvu) {
@@ -1824,6 +2040,7 @@ int main(int argc, char *argv[])
 
 	// Open log
 	openlog("ofgwrite", LOG_CONS | LOG_NDELAY, LOG_USER);
+	stats_phase("Startup");
 
 	my_printf("\nofgwrite Utility v%s NI-Edition\n", ofgwrite_version); //NI
 	if (strcmp(vumodel, ""))
@@ -1848,6 +2065,8 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	telemetry_init(telemetry_socket);
+
 	// set rootfs type and more
 	if (!readProcMounts())
 		return EXIT_FAILURE;
@@ -1856,6 +2075,12 @@ int main(int argc, char *argv[])
 	my_printf("\n");
 	read_mtd_file();
 	find_kernel_rootfs_device();
+	select_rootfs_image();
+	if (multislot_cnt && (!flash_rootfs || !multislot_prepare(image_directory)))
+	{
+		my_printf("Error: Cannot flash several multiboot partitions\n");
+		return EXIT_FAILURE;
+	}
 
 	if (flash_kernel && (!found_kernel_device || kernel_filename[0] == '\0'))
 	{
@@ -1911,6 +2136,7 @@ int main(int argc, char *argv[])
 			set_error_text2("Please flash backup! Go back to Neutrino in 60 sec");
 			sleep(60);
 		}
+		report_flash_result(ret == EXIT_SUCCESS);
 		closelog();
 		close_framebuffer();
 		return ret;
@@ -1920,6 +2146,10 @@ int main(int argc, char *argv[])
 	{
 		ret = 0;
 
+		// check the image files while the processes are stopped
+		if (!no_write)
+			image_check_start(flash_kernel ? kernel_filename : NULL, rootfs_filename);
+
 		// Check whether /newroot exists and is mounted as tmpfs
 		if (!check_env() && (!strcmp(current_rootfs_device, "sda") || !strcmp(current_rootfs_device, "sdb")))
 		{
@@ -1971,11 +2201,10 @@ int main(int argc, char *argv[])
 			// ignore return values, because the processes might not run
 		}
 
-		// sync filesystem
+		// sync filesystem of the running system
 		my_printf("Syncing filesystem\n");
 		set_step("Syncing filesystem");
 		sync();
-		sleep(1);
 
 		set_step("init 2");
 		if (!no_write && stop_neutrino_needed)
@@ -1993,8 +2222,18 @@ int main(int argc, char *argv[])
 				return EXIT_FAILURE;
 			}
 		}
+		// nothing was written yet
+		if (!no_write && !image_check_finish())
+		{
+			my_printf("Error image is corrupted! Abort flashing.\n");
+			set_error_text1("Error image is corrupted! Abort flashing.");
+			sleep(3);
+			closelog();
+			close_framebuffer();
+			return EXIT_FAILURE;
+		}
 		// if not running rootfs is flashed then we need to mount it before start flashing
-		if (!no_write && !stop_neutrino_needed && (rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD))
+		if (!no_write && !stop_neutrino_needed && !multislot_cnt && (rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD))
 		{
 			set_step("Mount rootfs");
 			my_printf("Mount rootfs\n");
@@ -2009,10 +2248,8 @@ int main(int argc, char *argv[])
 			else if (errno == EINVAL && rootfs_flash_mode != TARBZ2_MTD)
 			{
 				// most likely partition is not formatted -> format it
-				char mkfs_cmd[100];
-				sprintf(mkfs_cmd, "mkfs.ext4 -F %s", rootfs_device);
 				my_printf("Formatting %s\n", rootfs_device);
-				ret = system(mkfs_cmd);
+				ret = !mkfs_ext4(rootfs_device, 0);
 				if (!ret)
 				{ // try to mount it again
 					ret = mount(rootfs_device, "/oldroot_remount/", "ext4", 0, NULL);
@@ -2030,51 +2267,73 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		if (!no_write) {
+		if (!no_write && !multislot_cnt) {
 			char tmp[1016];
 			sprintf(tmp, "/oldroot_remount/%s", rootfs_sub_dir);
 			my_printf("Creating directory %s recursively\n", rootfs_sub_dir);
 			bb_make_directory(tmp, -1, FILEUTILS_RECUR);
 		}
 
-		// Flash rootfs
-		if (!rootfs_flash(rootfs_device, rootfs_filename))
+		// kernel on another device: write it while rootfs is flashed
+		int kernel_job = flash_kernel && !multislot_cnt && !no_write && kernel_job_start(kernel_device, rootfs_device, kernel_filename);
+
+		// eraseblocks failing while writing are tracked beside the image
+		torture_report_open(image_directory);
+
+		// resumable after power loss
+		int journal = !no_write && !multislot_cnt && !diff_rootfs
+			&& (rootfs_flash_mode == MTD || rootfs_flash_mode == TARBZ2 || rootfs_flash_mode == TARBZ2_MTD);
+		if (journal)
+			journal_open(image_directory, rootfs_filename, rootfs_device);
+
+		// Flash rootfs (and kernels of all partitions in multislot mode)
+		if (multislot_cnt ? !multislot_flash(flash_kernel, quiet, no_write) : !rootfs_flash(rootfs_device, rootfs_filename))
 		{
+			if (journal)
+				journal_close(0);
+			if (kernel_job)
+				kernel_job_finish(0);
 			my_printf("Error flashing rootfs! System won't boot. Please flash backup! System will reboot in 60 seconds\n");
 			set_error_text1("Error flashing rootfs. System won't boot!");
 			set_error_text2("Please flash backup! Rebooting in 60 sec");
+			report_flash_result(0);
 			if (stop_neutrino_needed)
 			{
 				sleep(60);
+				logger_flush();
 				reboot(LINUX_REBOOT_CMD_RESTART);
 			}
 			sleep(3);
 			close_framebuffer();
 			return EXIT_FAILURE;
 		}
+		if (journal)
+			journal_close(1);
 		my_printf("Successfully flashed rootfs!\n");
 
 		//Flash kernel
-		if (flash_kernel)
+		if (flash_kernel && !multislot_cnt)
 		{
 			if (!quiet)
 				my_printf("Flashing kernel ...\n");
 
-			if (!kernel_flash(kernel_device, kernel_filename))
+			if ((kernel_job ? !kernel_job_finish(1) : !kernel_flash(kernel_device, kernel_filename))
+				|| (!no_write && !durable_commit()))
 			{
 				my_printf("Error flashing kernel. System won't boot. Please flash backup! Starting Neutrino in 60 seconds\n");
 				set_error_text1("Error flashing kernel. System won't boot!");
 				set_error_text2("Please flash backup! Starting Neutrino in 60 sec");
+				report_flash_result(0);
 				if (stop_neutrino_needed)
 				{
 					sleep(60);
+					logger_flush();
 					reboot(LINUX_REBOOT_CMD_RESTART);
 				}
 				sleep(3);
 				close_framebuffer();
 				return EXIT_FAILURE;
 			}
-			sync();
 			my_printf("Successfully flashed kernel!\n");
 		}
 
@@ -2121,8 +2380,6 @@ int main(int argc, char *argv[])
 				}
 				if (dreamcard) {
 					ret = umount(dreamcard_device);
-					sync();
-					sleep(1);
 					if (mount(dreamcard_device, dreamcard_mount, "vfat", 0, NULL) == -1) {
 						my_printf("Error: dreamcard device '%s' not mounted to '%s':%s.\n",dreamcard_device, dreamcard_mount, strerror(errno));
 						rmdir(dreamcard_mount);
@@ -2139,21 +2396,32 @@ int main(int argc, char *argv[])
 					snprintf(filename, sizeof(filename), "/dreamcard/kernel%d.img", kernelnr);
 					my_printf("start generate %s image on %s\n", filename, dreamcard_device);
 					generate_boot_image(filename);
-					sync();
-					sleep(1);
+					durable_sync(dreamcard_mount);
 					ret = umount2(dreamcard_mount, MNT_DETACH);
 					ret = rmdir(dreamcard_mount);
 				}
 			}
 			my_printf("start generate /oldroot_remount/boot/kernel.img image on device %s\n", rootfs_device);
 			generate_boot_image("/oldroot_remount/boot/kernel.img");
-			sync();
-			sleep(1);
 		}
 */
 
-		sync();
-		sleep(1);
+		if (!no_write && !durable_commit())
+		{
+			my_printf("Error syncing flashed image! System might not boot. Please flash backup! System will reboot in 60 seconds\n");
+			set_error_text1("Error syncing image. System might not boot!");
+			set_error_text2("Please flash backup! Rebooting in 60 sec");
+			report_flash_result(0);
+			if (stop_neutrino_needed)
+			{
+				sleep(60);
+				logger_flush();
+				reboot(LINUX_REBOOT_CMD_RESTART);
+			}
+			sleep(3);
+			close_framebuffer();
+			return EXIT_FAILURE;
+		}
 
 		if (!stop_neutrino_needed)
 		{
@@ -2169,6 +2437,7 @@ int main(int argc, char *argv[])
 			ret = umount("/oldroot_remount/");
 			set_step("Successfully flashed!"); //NI
 		}
+		report_flash_result(1);
 		fflush(stdout);
 		fflush(stderr);
 		sleep(3);
@@ -2178,6 +2447,7 @@ int main(int argc, char *argv[])
 			my_printf("Rebooting in 3 seconds...\n");
 			set_step("Successfully flashed! Rebooting in 3 seconds...");
 			sleep(3);
+			logger_flush();
 			reboot(LINUX_REBOOT_CMD_RESTART);
 		}
 	}
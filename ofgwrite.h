@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 
 extern struct stat kernel_file_stat;
@@ -20,8 +22,26 @@ extern char current_kernel_device[1000];
 extern char current_rootfs_sub_dir[1000];
 extern char ubi_fs_name[1000];
 extern char vumodel[63];
+extern char kernel_filename[1000];
+extern char rootfs_filename[1000];
+extern char rootfs_image_filename[1000];
+extern int stop_neutrino_needed;
+extern int diff_rootfs;
+extern int jffs2_summary;
+extern int ubi_volume_update;
 
 void handle_busybox_fatal_error();
+int find_image_files(char* p);
+void find_kernel_rootfs_device();
+void ext4_kernel_dev_found(const char* dev, int partition_number);
+void ext4_rootfs_dev_found(const char* dev, int partition_number);
+void my_printf(char const *fmt, ...);
+void my_fprintf(FILE * f, char const *fmt, ...);
+void my_perror(const char* s);
+
+// fb.c
+void set_step(char* str);
+void set_step_progress(int percent);
 
 enum RootfsTypeEnum
 {
@@ -30,9 +50,132 @@ enum RootfsTypeEnum
 
 enum FlashModeTypeEnum
 {
-	FLASH_MODE_UNKNOWN, MTD, TARBZ2, TARBZ2_MTD
+	FLASH_MODE_UNKNOWN, MTD, TARBZ2, TARBZ2_MTD, EXT4_IMAGE
 };
 // TARBZ2, TARBZ2_MTD is also used for xz compressed rootfs
+// EXT4_IMAGE: rootfs.ext4 image is written to the whole TARBZ2 rootfs partition
 
 extern enum FlashModeTypeEnum kernel_flash_mode;
 extern enum FlashModeTypeEnum rootfs_flash_mode;
+
+// flash_ext4.c
+void copy_backup_to_rootfs(char* path);
+
+// flash_ext4_image.c
+unsigned long long ext4_image_size(char* filename);
+int flash_ext4_image_rootfs(char* device, char* filename, int quiet, int no_write);
+
+// sync_rootfs.c
+#define DIFF_ROOTFS_METADATA 1
+#define DIFF_ROOTFS_CONTENT  2
+int flash_sync_rootfs(char* filename, int quiet, int no_write);
+
+// multislot.c
+#define MAX_MULTISLOTS 8
+extern int multislot_cnt;
+int multislot_parse(const char* list);
+int multislot_prepare(char* image_dir);
+int multislot_flash(int kernel, int quiet, int no_write);
+
+// flash_jobs.c
+int kernel_job_start(char* kernel_dev, char* rootfs_dev, char* filename);
+int kernel_job_finish(int commit);
+
+// mkfs_ext4.c
+int mkfs_ext4(char* device, int quiet);
+
+// durable.c
+void durable_track(const char* path);
+int durable_sync(const char* path);
+int durable_commit();
+
+// journal.c
+void journal_open(const char* image_dir, const char* filename, const char* device);
+void journal_close(int success);
+int journal_resume(const char* device, long long* pos, long long* input);
+void journal_progress(const char* device, long long pos, long long input);
+long long journal_tar_start(const char* device, const char* sync_path);
+int journal_tar_skip();
+void journal_tar_entry();
+void journal_tar_stop();
+int journal_skip_input(int fd, long long len);
+
+// io_cache.c
+void io_throttle();
+void io_source_open(int fd);
+void io_source_read(int fd, long long len);
+void io_target_written(int fd, off_t pos);
+void io_target_done(int fd);
+
+// zip_image.c
+int zip_open_image(const char* path);
+void zip_find_image_files(void (*found)(char* dir, char* name));
+int image_stat(const char* filename, struct stat* st);
+int image_open(const char* filename);
+int image_unread(int fd, const void* buf, size_t len);
+void image_stream_add(int fd, pid_t pid);
+int image_close(int fd);
+int image_streams_ok();
+
+// telemetry.c
+int telemetry_init(const char* path);
+void telemetry_step(const char* name);
+void telemetry_progress(const char* device, long long bytes_done, long long bytes_total);
+void telemetry_erase(const char* device, int count);
+void telemetry_write(const char* device, int count);
+void telemetry_counters(long long* erase_cnt, long long* write_cnt);
+void telemetry_bad_block(const char* device, long long eraseblock);
+void telemetry_error(const char* text);
+void telemetry_finish(int success);
+void telemetry_detach();
+
+// mtd-utils
+int flash_erase_main(int argc, char* argv[]);
+int nandwrite_main(int argc, char* const argv[]);
+
+// stats.c
+void stats_phase(const char* name);
+void stats_report();
+
+// logger.c
+void logger_write(FILE* f, const char* msg, size_t len);
+void logger_flush();
+
+// partitions.c
+int build_partition_index();
+int find_gpt_partitions();
+
+// procscan.c
+int proc_kill(const char* const* names, const char* mount_point, int sig);
+
+// flash_ubi_volume.c
+int flash_ubi_volume(char* device, char* filename, int quiet, int no_write);
+
+// image_check.c
+int image_check_start(char* kernel, char* rootfs);
+int image_check_finish();
+
+// runtime.c
+int runtime_wanted(int argc, char* argv[]);
+void runtime_reexec(char* argv[]);
+int runtime_install_init(const char* path);
+int runtime_init_reexec();
+int runtime_init();
+
+// fec_image.c
+int fec_image_open(const char* filename, int fd);
+int fec_sidecar_create(const char* image, int chunk_size, int k, int m);
+
+// jffs2_summary.c
+struct jffs2_sum;
+struct jffs2_sum* jffs2_sum_open(int fd, int eb_size);
+ssize_t jffs2_sum_read(struct jffs2_sum* s, void* buf, size_t len);
+int jffs2_sum_skip(struct jffs2_sum* s, long long len);
+long long jffs2_sum_input_pos(struct jffs2_sum* s);
+long long jffs2_sum_output_pos(struct jffs2_sum* s);
+void jffs2_sum_close(struct jffs2_sum* s);
+
+// torture.c
+struct mtd_dev_info;
+void torture_report_open(const char* image_dir);
+int torture_eraseblock(void* libmtd, const struct mtd_dev_info* mtd, int fd, int eb, const char* device);
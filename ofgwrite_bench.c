@@ -0,0 +1,192 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <libubigen.h>
+
+/* Benchmark runner for the flash backends, used by ofgwrite_benchmark.
+ *
+ * It is linked against all ofgwrite objects (ofgwrite.c without its main)
+ * and calls the backends directly, without box detection and pivot_root:
+ *   ofgwrite_bench run <results> <name> <backend> <args...>
+ *     backends: ubiformat, nandwrite, flashcp, flash_erase (args like the
+ *     applets) and unpack <block device> <tar image>
+ *   ofgwrite_bench mkubi <out> <peb size> <min io size> <volume data>
+ *   ofgwrite_bench mkfec <image> [<chunk size> <k> <m>]
+ *     creates the FEC sidecar <image>.fec (default 65536 32 2)
+ * Every run appends one JSON object per line to the results file.
+ */
+
+int ubiformat_main(int argc, char* argv[]);
+int flashcp_main(int argc, char* argv[]);
+int flash_unpack_rootfs(char* filename, int quiet, int no_write);
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the newly flashed rootfs is mounted at /oldroot_remount like in ofgwrite
+/* Not timed: mounts the old rootfs like ofgwrite finds it. It's only
+ * formatted if there is no filesystem yet, the unpack formats it anyway.
+ */
+static int bench_prepare_unpack(char* device, char* filename)
+{
+	strncpy(rootfs_device, device, sizeof(rootfs_device) - 1);
+	rootfs_flash_mode = TARBZ2;
+	stop_neutrino_needed = 0; // not the running rootfs
+	if (stat(filename, &rootfs_file_stat) != 0)
+	{
+		my_printf("Error: %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	mkdir("/oldroot_remount", 0777);
+	umount("/oldroot_remount/");
+	if (mount(device, "/oldroot_remount/", "ext4", 0, NULL) != 0
+	 && (!mkfs_ext4(device, 1) || mount(device, "/oldroot_remount/", "ext4", 0, NULL) != 0))
+	{
+		my_printf("Error preparing %s\n", device);
+		return 1;
+	}
+	return 0;
+}
+
+static int bench_unpack(char* filename)
+{
+	int ret;
+
+	ret = !flash_unpack_rootfs(filename, 1, 0);
+	umount("/oldroot_remount/");
+	return ret;
+}
+
+static int bench_backend(int argc, char* argv[])
+{
+	optind = 0; // reset getopt_long
+	if (strcmp(argv[0], "ubiformat") == 0)
+		return ubiformat_main(argc, argv);
+	if (strcmp(argv[0], "nandwrite") == 0)
+		return nandwrite_main(argc, argv);
+	if (strcmp(argv[0], "flashcp") == 0)
+		return flashcp_main(argc, argv);
+	if (strcmp(argv[0], "flash_erase") == 0)
+		return flash_erase_main(argc, argv);
+	if (strcmp(argv[0], "unpack") == 0 && argc == 3)
+		return bench_unpack(argv[2]);
+	my_printf("Unknown backend %s\n", argv[0]);
+	return -1;
+}
+
+// setup of a backend which isn't part of its time
+static int bench_prepare(int argc, char* argv[])
+{
+	if (strcmp(argv[0], "unpack") == 0 && argc == 3)
+		return bench_prepare_unpack(argv[1], argv[2]);
+	return 0;
+}
+
+static int bench_run(char* results, char* name, int argc, char* argv[])
+{
+	char line[1024];
+	long long erase_cnt, write_cnt;
+	double start, seconds;
+	FILE* f;
+	int ret;
+
+	if (bench_prepare(argc, argv) != 0)
+		return 1;
+	start = bench_now();
+	ret = bench_backend(argc, argv);
+	seconds = bench_now() - start;
+	telemetry_counters(&erase_cnt, &write_cnt);
+	logger_flush();
+
+	snprintf(line, sizeof(line),
+			 "{\"name\":\"%s\",\"backend\":\"%s\",\"rc\":%d,\"seconds\":%.3f,\"erases\":%lld,\"writes\":%lld}\n",
+			 name, argv[0], ret, seconds, erase_cnt, write_cnt);
+	f = fopen(results, "a");
+	if (f == NULL)
+	{
+		perror(results);
+		return 1;
+	}
+	fputs(line, f);
+	fclose(f);
+	fputs(line, stderr);
+	return ret != 0;
+}
+
+// UBI image with the layout volume and one dynamic volume "rootfs"
+static int bench_mkubi(char* out, int peb_size, int min_io_size, char* data)
+{
+	struct ubigen_info ui;
+	struct ubigen_vol_info vi;
+	struct ubi_vtbl_record* vtbl;
+	struct stat st;
+	int in, fd, ret = 1;
+
+	ubigen_info_init(&ui, peb_size, min_io_size, min_io_size, 0, 1, 0x12345678);
+	vtbl = ubigen_create_empty_vtbl(&ui);
+	in = open(data, O_RDONLY);
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (vtbl == NULL || in < 0 || fd < 0 || fstat(in, &st) != 0)
+	{
+		my_printf("Error creating %s\n", out);
+		goto out;
+	}
+
+	memset(&vi, 0, sizeof(vi));
+	vi.id = 0;
+	vi.type = UBI_VID_DYNAMIC;
+	vi.alignment = 1;
+	vi.usable_leb_size = ui.leb_size;
+	vi.name = "rootfs";
+	vi.name_len = strlen(vi.name);
+	vi.used_ebs = (st.st_size + ui.leb_size - 1) / ui.leb_size;
+	vi.bytes = (long long)vi.used_ebs * ui.leb_size;
+	vi.flags = UBI_VTBL_AUTORESIZE_FLG;
+	if (ubigen_add_volume(&ui, &vi, vtbl)
+	 || ubigen_write_layout_vol(&ui, 0, 1, 0, 0, vtbl, fd)
+	 || lseek(fd, 2LL * peb_size, SEEK_SET) != 2LL * peb_size
+	 || ubigen_write_volume(&ui, &vi, 0, st.st_size, in, fd))
+	{
+		my_printf("Error writing %s\n", out);
+		goto out;
+	}
+	ret = 0;
+out:
+	free(vtbl);
+	if (in >= 0)
+		close(in);
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 5 && strcmp(argv[1], "run") == 0)
+		return bench_run(argv[2], argv[3], argc - 4, argv + 4);
+	if (argc == 6 && strcmp(argv[1], "mkubi") == 0)
+		return bench_mkubi(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5]);
+	if (argc == 3 && strcmp(argv[1], "mkfec") == 0)
+		return !fec_sidecar_create(argv[2], 65536, 32, 2);
+	if (argc == 6 && strcmp(argv[1], "mkfec") == 0)
+		return !fec_sidecar_create(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]));
+
+	fprintf(stderr, "Usage: ofgwrite_bench run <results> <name> <backend> <args...>\n"
+					"       ofgwrite_bench mkubi <out> <peb size> <min io size> <volume data>\n"
+					"       ofgwrite_bench mkfec <image> [<chunk size> <k> <m>]\n");
+	return 1;
+}
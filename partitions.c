@@ -0,0 +1,454 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <endian.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+/* Partition discovery without fdisk.
+ *
+ * Builds a name -> device index once from /proc/partitions,
+ * /sys/class/block/<dev>/{partition,uevent} and /dev/block/by-name.
+ * Only if the kernel doesn't provide PARTNAME the GPT is read directly.
+ * find_gpt_partitions() then does the same kernel/rootfs selection as the
+ * fdisk based gpt_list_table() and calls ext4_kernel_dev_found() and
+ * ext4_rootfs_dev_found().
+ */
+
+#define MAX_PARTITIONS 256
+#define GPT_NAME_LEN 36
+#define BLK_NAME_LEN 64 // kernel disk names have at most 31 chars
+
+struct blk_partition
+{
+	char dev[BLK_NAME_LEN];  // e.g. mmcblk0p3
+	char disk[BLK_NAME_LEN]; // e.g. mmcblk0
+	int number;
+	char name[GPT_NAME_LEN + 1];
+};
+
+static struct blk_partition partition_index[MAX_PARTITIONS];
+static int partition_cnt = 0;
+static char disk_index[16][BLK_NAME_LEN];
+static int disk_cnt = 0;
+static int partition_index_built = 0;
+
+static int read_sys_file(const char* dev, const char* file, char* buf, int size)
+{
+	char path[PATH_MAX];
+	int fd, len;
+
+	if (snprintf(path, sizeof(path), "/sys/class/block/%s/%s", dev, file) >= sizeof(path))
+		return -1;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return len;
+}
+
+static struct blk_partition* find_partition(const char* disk, int number)
+{
+	int i;
+
+	for (i = 0; i < partition_cnt; i++)
+		if (partition_index[i].number == number && strcmp(partition_index[i].disk, disk) == 0)
+			return &partition_index[i];
+	return NULL;
+}
+
+static void add_disk(const char* disk)
+{
+	int i;
+
+	for (i = 0; i < disk_cnt; i++)
+		if (strcmp(disk_index[i], disk) == 0)
+			return;
+	if (disk_cnt < sizeof(disk_index) / sizeof(disk_index[0]))
+		strcpy(disk_index[disk_cnt++], disk);
+}
+
+// fallback for kernels without PARTNAME in uevent: read GPT header and partition entries
+static void read_gpt_names(const char* disk)
+{
+	struct gpt_hdr
+	{
+		uint64_t magic;
+		uint32_t revision;
+		uint32_t hdr_size;
+		uint32_t hdr_crc32;
+		uint32_t reserved;
+		uint64_t current_lba;
+		uint64_t backup_lba;
+		uint64_t first_usable_lba;
+		uint64_t last_usable_lba;
+		uint8_t  disk_guid[16];
+		uint64_t first_part_lba;
+		uint32_t n_parts;
+		uint32_t part_entry_len;
+		uint32_t part_array_crc32;
+	} __attribute__((packed)) hdr;
+	char path[PATH_MAX];
+	int fd, sector_size = 512;
+	unsigned int i, n_parts, entry_len;
+	unsigned char* buf;
+	size_t buf_len = 34 * 4096; // enough for header and 128 entries with 4k sectors
+	ssize_t len;
+	uint64_t array_offset;
+
+	if (snprintf(path, sizeof(path), "/dev/%s", disk) >= sizeof(path))
+		return;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	ioctl(fd, BLKSSZGET, &sector_size);
+
+	buf = malloc(buf_len);
+	if (buf == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	// one read for protective MBR, GPT header and (normally) the whole partition array
+	len = pread(fd, buf, buf_len, 0);
+	if (len < 2 * sector_size)
+		goto out;
+	memcpy(&hdr, &buf[sector_size], sizeof(hdr));
+	if (le64toh(hdr.magic) != 0x5452415020494645ULL)
+		goto out;
+
+	n_parts = le32toh(hdr.n_parts);
+	entry_len = le32toh(hdr.part_entry_len);
+	if (n_parts > 256 || entry_len < 128 || (size_t)n_parts * entry_len > buf_len)
+		goto out;
+
+	array_offset = le64toh(hdr.first_part_lba) * sector_size;
+	if (array_offset + (uint64_t)n_parts * entry_len > len)
+	{
+		len = pread(fd, buf, (size_t)n_parts * entry_len, array_offset);
+		if (len != (ssize_t)n_parts * entry_len)
+			goto out;
+		array_offset = 0;
+	}
+
+	for (i = 0; i < n_parts; i++)
+	{
+		unsigned char* entry = &buf[array_offset + i * entry_len];
+		struct blk_partition* part = find_partition(disk, i + 1);
+		uint64_t lba_start;
+		int k;
+
+		memcpy(&lba_start, &entry[32], sizeof(lba_start));
+		if (!lba_start || part == NULL || part->name[0] != '\0')
+			continue;
+		// name is UTF-16LE: ignore upper byte as we only need us ascii chars
+		for (k = 0; k < GPT_NAME_LEN; k++)
+			part->name[k] = (char)entry[56 + 2 * k];
+		part->name[GPT_NAME_LEN] = '\0';
+	}
+
+out:
+	free(buf);
+	close(fd);
+}
+
+static void read_by_name_links()
+{
+	DIR* d;
+	struct dirent* entry;
+	char path[PATH_MAX];
+	char target[PATH_MAX];
+	int len, i;
+
+	d = opendir("/dev/block/by-name");
+	if (d == NULL)
+		return;
+
+	while ((entry = readdir(d)) != NULL)
+	{
+		char* dev;
+		// longer names can't be GPT partition names
+		if (entry->d_name[0] == '.' || strlen(entry->d_name) > GPT_NAME_LEN)
+			continue;
+		snprintf(path, sizeof(path), "/dev/block/by-name/%s", entry->d_name);
+		len = readlink(path, target, sizeof(target) - 1);
+		if (len <= 0)
+			continue;
+		target[len] = '\0';
+		dev = strrchr(target, '/');
+		dev = dev ? dev + 1 : target;
+		for (i = 0; i < partition_cnt; i++)
+			if (partition_index[i].name[0] == '\0' && strcmp(partition_index[i].dev, dev) == 0)
+				strcpy(partition_index[i].name, entry->d_name);
+	}
+	closedir(d);
+}
+
+// returns 0 if no partition information is available (e.g. /sys is not mounted)
+int build_partition_index()
+{
+	FILE* f;
+	char line[200];
+	char name[BLK_NAME_LEN];
+	char buf[PATH_MAX];
+	char link[PATH_MAX];
+	char* pos;
+	int major, minor, i, j, len;
+	unsigned long long blocks;
+
+	if (partition_index_built)
+		return partition_cnt > 0;
+	partition_index_built = 1;
+
+	f = fopen("/proc/partitions", "r");
+	if (f == NULL)
+		return 0;
+
+	while (fgets(line, sizeof(line), f) != NULL && partition_cnt < MAX_PARTITIONS)
+	{
+		struct blk_partition* part;
+
+		if (sscanf(line, " %d %d %llu %63s", &major, &minor, &blocks, name) != 4)
+			continue;
+		if (read_sys_file(name, "partition", buf, sizeof(buf)) <= 0)
+			continue; // whole disk or no sysfs
+
+		part = &partition_index[partition_cnt];
+		memset(part, 0, sizeof(*part));
+		strcpy(part->dev, name);
+		part->number = atoi(buf);
+
+		// parent directory in sysfs is the disk
+		snprintf(buf, sizeof(buf), "/sys/class/block/%s", name);
+		len = readlink(buf, link, sizeof(link) - 1);
+		if (len <= 0)
+			continue;
+		link[len] = '\0';
+		if ((pos = strrchr(link, '/')) == NULL)
+			continue;
+		*pos = '\0';
+		pos = strrchr(link, '/');
+		pos = pos ? pos + 1 : link;
+		if (strlen(pos) >= sizeof(part->disk))
+			continue;
+		strcpy(part->disk, pos);
+
+		if (read_sys_file(name, "uevent", buf, sizeof(buf)) > 0 && (pos = strstr(buf, "PARTNAME=")) != NULL)
+		{
+			pos += 9;
+			for (j = 0; j < GPT_NAME_LEN && pos[j] != '\n' && pos[j] != '\0'; j++)
+				part->name[j] = pos[j];
+		}
+
+		add_disk(part->disk);
+		partition_cnt++;
+	}
+	fclose(f);
+
+	if (partition_cnt == 0)
+		return 0;
+
+	read_by_name_links();
+
+	for (i = 0; i < disk_cnt; i++)
+	{
+		int named = 0;
+		for (j = 0; j < partition_cnt; j++)
+			if (partition_index[j].name[0] != '\0' && strcmp(partition_index[j].disk, disk_index[i]) == 0)
+				named = 1;
+		if (!named)
+			read_gpt_names(disk_index[i]);
+	}
+
+	return 1;
+}
+
+// returns GPT partition name of partition number on disk or NULL
+static const char* partition_name(const char* disk, int number)
+{
+	struct blk_partition* part = find_partition(disk, number);
+
+	if (part == NULL || part->name[0] == '\0')
+		return NULL;
+	return part->name;
+}
+
+// same selection as gpt_list_table() in busybox/fdisk_gpt.c
+static void select_disk_partitions(const char* disk)
+{
+	char disk_device[PATH_MAX];
+	char kernel_name[19];
+	char rootfs_name[19];
+	const char* partname;
+	int found_kernel = 0;
+	int found_rootfs = 0;
+	int i;
+
+	if (snprintf(disk_device, sizeof(disk_device), "/dev/%s", disk) >= sizeof(disk_device))
+		return;
+
+	if (multiboot_partition != -1 && current_rootfs_sub_dir[0] == '\0')
+	{
+		sprintf(kernel_name, "kernel%d", multiboot_partition);
+		sprintf(rootfs_name, "rootfs%d", multiboot_partition);
+	}
+	else if (multiboot_partition != -1 && current_rootfs_sub_dir[0] != '\0') // box with rootSubDir feature
+	{
+		if (multiboot_partition == 1)
+		{
+			strcpy(kernel_name, "linuxkernel");
+			strcpy(rootfs_name, "linuxrootfs");
+		}
+		else
+		{
+			sprintf(kernel_name, "linuxkernel%d", multiboot_partition);
+			strcpy(rootfs_name, "userdata");
+		}
+		sprintf(rootfs_sub_dir, "linuxrootfs%d", multiboot_partition);
+	}
+	else
+	{
+		strcpy(kernel_name, "kernel");
+		strcpy(rootfs_name, "rootfs");
+	}
+
+	for (i = 0; i < partition_cnt; i++)
+	{
+		if (strcmp(partition_index[i].disk, disk) != 0 || partition_index[i].name[0] == '\0')
+			continue;
+		partname = partition_index[i].name;
+		if (strcmp(partname, kernel_name) == 0)
+		{
+			ext4_kernel_dev_found(disk_device, partition_index[i].number);
+			found_kernel = 1;
+		}
+		if (strcmp(partname, rootfs_name) == 0)
+		{
+			ext4_rootfs_dev_found(disk_device, partition_index[i].number);
+			found_rootfs = 1;
+		}
+		if ((user_kernel || user_rootfs) && (strcmp(partname, "bp30") == 0 || strcmp(partname, "bp31") == 0))
+		{
+			char dummy_device[PATH_MAX];
+			snprintf(dummy_device, sizeof(dummy_device), "%sp%d", disk, partition_index[i].number);
+			if ( (user_kernel && (strcmp(kernel_device_arg, dummy_device) == 0))
+			  || (user_rootfs && (strcmp(rootfs_device_arg, dummy_device) == 0)) )
+			{
+				my_printf("User specified device is a bp30/bp31 partition. These partitions shouldn't be used. Never!\nAborting...\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	// If kernel OR rootfs found, return. If one is missing, handle error later. Don't search for other partitions.
+	// If multiboot partition was specified, return also as user wanted to use a specific partition which was not found.
+	if (found_kernel || found_rootfs || multiboot_partition != -1)
+		return;
+
+	my_printf("No matching partition names are found. Use current kernel and rootfs devices\n");
+
+	// find partition name of current rootfs device
+	int part_num = -1;
+	if (sscanf(current_rootfs_device, "%*[a-z/]%*dp%d", &part_num) == EOF)
+		return;
+
+	// No partition number found. Device name is not as expected
+	if (part_num == -1)
+	{
+		my_printf("Error: Partition number not found. Device name: %s\n", current_rootfs_device);
+		return;
+	}
+
+	if ((partname = partition_name(disk, part_num)) != NULL)
+	{
+		if (current_rootfs_sub_dir[0] == '\0')
+		{
+			// expecting names starting with "rootfs" and after that a number. So e.g. rootfs3
+			if (sscanf(partname, "%*[a-z]%d", &multiboot_partition) == EOF)
+				return;
+			my_printf("Using current multiboot partition %d\n", multiboot_partition);
+		}
+		else // box with rootSubDir feature, part name is either linuxrootfs or userdata
+		{
+			if (strcmp(partname, "linuxrootfs") == 0)
+			{
+				multiboot_partition = 1;
+				my_printf("Using current multiboot partition %d\n", multiboot_partition);
+			}
+			else
+			{
+				multiboot_partition = -1;
+				my_printf("Using current multiboot partition userdata\n");
+			}
+		}
+	}
+
+	if (multiboot_partition != -1 && current_rootfs_sub_dir[0] == '\0')
+	{
+		sprintf(kernel_name, "kernel%d", multiboot_partition);
+		sprintf(rootfs_name, "rootfs%d", multiboot_partition);
+	}
+	else if (current_rootfs_sub_dir[0] != '\0')
+	{
+		if (multiboot_partition == 1)
+		{
+			strcpy(kernel_name, "linuxkernel");
+			strcpy(rootfs_name, "linuxrootfs");
+		}
+		else
+		{
+			strncpy(kernel_name, current_kernel_device, sizeof(kernel_name) - 1);
+			kernel_name[sizeof(kernel_name) - 1] = '\0';
+			strcpy(rootfs_name, "userdata");
+		}
+		strcpy(rootfs_sub_dir, current_rootfs_sub_dir);
+	}
+	else
+		return;
+
+	// now search for both partitions as we need to call both ext4_..._dev_found functions
+	for (i = 0; i < partition_cnt; i++)
+	{
+		if (strcmp(partition_index[i].disk, disk) != 0 || partition_index[i].name[0] == '\0')
+			continue;
+		if (strcmp(partition_index[i].name, kernel_name) == 0)
+			ext4_kernel_dev_found(disk_device, partition_index[i].number);
+		if (strcmp(partition_index[i].name, rootfs_name) == 0)
+			ext4_rootfs_dev_found(disk_device, partition_index[i].number);
+	}
+}
+
+/* Searches kernel and rootfs partitions on all disks with named (GPT) partitions.
+ * Returns 0 if the partition index couldn't be built. Caller should use fdisk then.
+ */
+int find_gpt_partitions()
+{
+	int i, j;
+
+	if (!build_partition_index())
+		return 0;
+
+	for (i = 0; i < disk_cnt; i++)
+	{
+		for (j = 0; j < partition_cnt; j++)
+			if (partition_index[j].name[0] != '\0' && strcmp(partition_index[j].disk, disk_index[i]) == 0)
+				break;
+		if (j == partition_cnt)
+			continue; // no GPT
+		select_disk_partitions(disk_index[i]);
+	}
+
+	return 1;
+}
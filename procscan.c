@@ -0,0 +1,263 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/* Single pass over /proc for stopping processes before pivot_root.
+ *
+ * Replaces the killall/pidof shells and the busybox ps and fuser applets:
+ * every pid directory is opened once and only the files needed for the
+ * requested checks are read relative to it. A process matches by its name
+ * (comm, or argv[0] for names longer than comm) or by using a file on the
+ * filesystem of a mount point (exe, cwd, root, open fds, mappings). All
+ * matches are signalled after the scan.
+ */
+
+#define PROC_MAX_PIDS 4096
+#define PROC_DENTS_SIZE 16384
+
+struct proc_dirent64
+{
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// processes on the rootfs which must survive until the flash is done
+static const char* const proc_keep_exe[] = {
+	"/oldroot/usr/bin/dvb_server",
+	"/oldroot/usr/bin/init_client",
+	"/oldroot/usr/bin/ntfs-3g",
+	"/oldroot/usr/share/platform/dvb_init",
+	"/oldroot/usr/bin/nxserver",
+	"/oldroot/usr/bin/init_driver",
+	"/oldroot/usr/share/platform/dvb_init.bin",
+	"/oldroot/usr/share/platform/nxserver",
+	"/oldroot/usr/bin/showiframe",
+	"/oldroot/sbin/mount.exfat-fuse",
+	NULL
+};
+
+// calls found for every numeric entry of the directory dir_fd
+static int proc_for_each(int dir_fd, int (*found)(int dir_fd, const char* name, void* data), void* data)
+{
+	char buf[PROC_DENTS_SIZE];
+	long len, pos;
+
+	while ((len = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf))) > 0)
+	{
+		for (pos = 0; pos < len; pos += ((struct proc_dirent64*)(buf + pos))->d_reclen)
+		{
+			const char* name = ((struct proc_dirent64*)(buf + pos))->d_name;
+			if (name[0] >= '0' && name[0] <= '9' && found(dir_fd, name, data))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int proc_read(int pid_fd, const char* name, char* buf, size_t size)
+{
+	ssize_t len;
+	int fd = openat(pid_fd, name, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return len;
+}
+
+static int proc_name_matches(int pid_fd, const char* const* names)
+{
+	char comm[64], cmdline[256];
+	char* p;
+	int i, len;
+
+	len = proc_read(pid_fd, "comm", comm, sizeof(comm));
+	if (len <= 0)
+		return 0;
+	if (comm[len - 1] == '\n')
+		comm[--len] = '\0';
+	for (i = 0; names[i]; i++)
+		if (strcmp(comm, names[i]) == 0)
+			return 1;
+
+	// comm is cut to 15 characters, the full name is in argv[0]
+	if (len < 15 || proc_read(pid_fd, "cmdline", cmdline, sizeof(cmdline)) <= 0)
+		return 0;
+	p = strrchr(cmdline, '/');
+	p = p ? p + 1 : cmdline;
+	for (i = 0; names[i]; i++)
+		if (strcmp(p, names[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static int proc_keep(int pid_fd)
+{
+	char exe[1000];
+	ssize_t len;
+	int i;
+
+	len = readlinkat(pid_fd, "exe", exe, sizeof(exe) - 1);
+	if (len <= 0)
+		return 0;
+	exe[len] = '\0';
+	for (i = 0; proc_keep_exe[i]; i++)
+		if (strcmp(exe, proc_keep_exe[i]) == 0)
+			break;
+	if (proc_keep_exe[i] == NULL
+	 && !(strncmp(exe, "/oldroot/lib/modules/", 21) == 0 && strstr(exe, "/extra/hi_play.ko") != NULL))
+		return 0;
+	my_printf("found vu or gb or octagon or ntfs process %s -> don't kill\n", exe);
+	return 1;
+}
+
+static int proc_fd_on_dev(int dir_fd, const char* name, void* data)
+{
+	struct stat st;
+
+	return fstatat(dir_fd, name, &st, 0) == 0 && st.st_dev == *(dev_t*)data;
+}
+
+static int proc_maps_on_dev(int pid_fd, dev_t dev)
+{
+	char line[512];
+	unsigned int major, minor;
+	unsigned long long inode;
+	int ret = 0;
+	int fd = openat(pid_fd, "maps", O_RDONLY);
+	FILE* f;
+
+	if (fd < 0)
+		return 0;
+	f = fdopen(fd, "r");
+	if (f == NULL)
+	{
+		close(fd);
+		return 0;
+	}
+	while (!ret && fgets(line, sizeof(line), f))
+		ret = sscanf(line, "%*s %*s %*s %x:%x %llu", &major, &minor, &inode) == 3
+			  && inode != 0 && makedev(major, minor) == dev;
+	fclose(f);
+	return ret;
+}
+
+static int proc_uses_dev(int pid_fd, dev_t dev)
+{
+	static const char* const links[] = { "exe", "cwd", "root", NULL };
+	struct stat st;
+	int i, fd, ret;
+
+	for (i = 0; links[i]; i++)
+		if (fstatat(pid_fd, links[i], &st, 0) == 0 && st.st_dev == dev)
+			return 1;
+
+	fd = openat(pid_fd, "fd", O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+	{
+		ret = proc_for_each(fd, proc_fd_on_dev, &dev);
+		close(fd);
+		if (ret)
+			return 1;
+	}
+	return proc_maps_on_dev(pid_fd, dev);
+}
+
+struct proc_scan
+{
+	const char* const* names;
+	int check_dev;
+	dev_t dev;
+	pid_t self;
+	pid_t pids[PROC_MAX_PIDS];
+	int cnt;
+};
+
+static int proc_check(int proc_fd, const char* name, void* data)
+{
+	struct proc_scan* scan = data;
+	pid_t pid = atoi(name);
+	int pid_fd, match = 0;
+
+	if (pid == scan->self || scan->cnt == PROC_MAX_PIDS)
+		return 0;
+	pid_fd = openat(proc_fd, name, O_RDONLY | O_DIRECTORY);
+	if (pid_fd < 0)
+		return 0; // already gone
+	if (scan->names && proc_name_matches(pid_fd, scan->names))
+		match = 1;
+	else if (scan->check_dev && proc_uses_dev(pid_fd, scan->dev) && !proc_keep(pid_fd))
+		match = 1;
+	close(pid_fd);
+	if (match)
+		scan->pids[scan->cnt++] = pid;
+	return 0;
+}
+
+/* Sends sig (0: just look) to all processes named like one of names (NULL
+ * terminated, NULL: no name check) or using the filesystem mounted at
+ * mount_point (NULL: no check). Returns the number of matching processes,
+ * -1 on error.
+ */
+int proc_kill(const char* const* names, const char* mount_point, int sig)
+{
+	struct proc_scan* scan;
+	struct stat st;
+	int proc_fd, i, ret;
+
+	scan = calloc(1, sizeof(*scan));
+	if (scan == NULL)
+		return -1;
+	scan->names = names;
+	scan->self = getpid();
+	if (mount_point)
+	{
+		if (stat(mount_point, &st) != 0)
+		{
+			my_printf("Error: %s: %s\n", mount_point, strerror(errno));
+			free(scan);
+			return -1;
+		}
+		scan->check_dev = 1;
+		scan->dev = st.st_dev;
+	}
+
+	proc_fd = open("/proc", O_RDONLY | O_DIRECTORY);
+	if (proc_fd < 0)
+	{
+		my_printf("Error opening /proc: %s\n", strerror(errno));
+		free(scan);
+		return -1;
+	}
+	proc_for_each(proc_fd, proc_check, scan);
+	close(proc_fd);
+
+	ret = scan->cnt;
+	for (i = 0; sig && i < scan->cnt; i++)
+	{
+		if (kill(scan->pids[i], sig) != 0 && errno != ESRCH)
+		{
+			my_printf("Error killing pid %d: %s\n", scan->pids[i], strerror(errno));
+			ret = -1;
+		}
+	}
+	if (sig && scan->cnt)
+		my_printf("Sent signal %d to %d processes\n", sig, scan->cnt);
+	free(scan);
+	return ret;
+}
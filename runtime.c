@@ -0,0 +1,171 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* Minimal runtime for flashing the running rootfs (--minimal-runtime).
+ *
+ * ofgwrite is linked statically, so it needs nothing from the rootfs. It
+ * re-executes itself from a memfd at start, then its binary doesn't belong to
+ * any filesystem. The new root gets no busybox, shell, init and libraries:
+ * /sbin/init is a link to the ofgwrite binary, which runs as a minimal init
+ * stub when init re-executes itself after pivot_root.
+ */
+
+#define RUNTIME_MEMFD_NAME "ofgwrite"
+
+#define INIT_MAGIC      0x03091969
+#define INIT_CMD_RUNLVL 1
+
+// request to sysvinit like telinit sends it
+struct init_request
+{
+	int magic;
+	int cmd;
+	int runlevel;
+	int sleeptime;
+	char data[368];
+};
+
+extern char** environ;
+
+// 1 if ofgwrite runs from a memfd
+static int runtime_in_memfd()
+{
+	char exe[100];
+	ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+
+	if (len <= 0)
+		return 0;
+	exe[len] = '\0';
+	return strncmp(exe, "/memfd:", 7) == 0;
+}
+
+// 1 if the minimal runtime is requested on the command line
+int runtime_wanted(int argc, char* argv[])
+{
+	int i;
+
+	for (i = 1; i < argc && strcmp(argv[i], "--") != 0; i++)
+		if (strcmp(argv[i], "--minimal-runtime") == 0 || strcmp(argv[i], "-x") == 0)
+			return 1;
+	return 0;
+}
+
+/* Executes ofgwrite again from a copy in a memfd. The copy in /newroot made
+ * by the start script is removed then. Returns only on errors.
+ */
+void runtime_reexec(char* argv[])
+{
+	char exe[1000];
+	struct stat st;
+	off_t offs = 0;
+	ssize_t len;
+	int in, fd;
+
+	if (runtime_in_memfd())
+		return;
+	len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (len <= 0)
+		return;
+	exe[len] = '\0';
+
+	in = open("/proc/self/exe", O_RDONLY);
+	fd = memfd_create(RUNTIME_MEMFD_NAME, MFD_CLOEXEC);
+	if (in < 0 || fd < 0 || fstat(in, &st) != 0)
+		goto error;
+	while (offs < st.st_size)
+		if (sendfile(fd, in, &offs, st.st_size - offs) <= 0)
+			goto error;
+	close(in);
+
+	if (strncmp(exe, "/newroot/", 9) == 0)
+		unlink(exe);
+	fexecve(fd, argv, environ);
+	in = -1;
+error:
+	my_printf("Error executing ofgwrite from memfd: %s\n", strerror(errno));
+	if (in >= 0)
+		close(in);
+	if (fd >= 0)
+		close(fd);
+}
+
+/* Creates path as link to the ofgwrite binary in the memfd, which stays
+ * valid after pivot_root as long as ofgwrite is running.
+ */
+int runtime_install_init(const char* path)
+{
+	char target[64];
+
+	if (!runtime_in_memfd())
+	{
+		my_printf("ofgwrite doesn't run from memfd\n");
+		return 0;
+	}
+	sprintf(target, "/proc/%d/exe", (int)getpid());
+	unlink(path);
+	if (symlink(target, path) != 0)
+	{
+		my_printf("Error creating %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	my_printf("Using ofgwrite as init of the minimal runtime\n");
+	return 1;
+}
+
+/* Lets init re-execute itself (telinit u), so it runs the stub from the new
+ * root and releases the old rootfs.
+ */
+int runtime_init_reexec()
+{
+	static const char* const fifos[] = { "/dev/initctl", "/run/initctl", "/oldroot/run/initctl", "/oldroot/dev/initctl", NULL };
+	struct init_request req;
+	int i, fd;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = INIT_MAGIC;
+	req.cmd = INIT_CMD_RUNLVL;
+	req.runlevel = 'u';
+	for (i = 0; fifos[i]; i++)
+	{
+		fd = open(fifos[i], O_WRONLY | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+		if (write(fd, &req, sizeof(req)) == sizeof(req))
+		{
+			close(fd);
+			my_printf("Requested init to re-execute itself (%s)\n", fifos[i]);
+			return 1;
+		}
+		close(fd);
+	}
+	my_printf("Error: init can't be re-executed, old rootfs stays busy\n");
+	return 0;
+}
+
+/* Minimal init (pid 1) after the re-execution of init. It only reaps orphaned
+ * processes, ofgwrite reboots when flashing is done.
+ */
+int runtime_init()
+{
+	sigset_t set;
+
+	sigfillset(&set);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	for (;;)
+	{
+		if (waitpid(-1, NULL, 0) < 0 && errno == ECHILD)
+			sleep(1);
+	}
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* Per phase timing and I/O accounting.
+ *
+ * A phase starts with every set_step() and with stats_phase() calls inside
+ * the flash backends and ends when the next one starts. At the end a JSON
+ * report is written to STATS_REPORT_FILE and to the log.
+ */
+
+#define STATS_REPORT_FILE "/tmp/ofgwrite_stats.json"
+#define STATS_MAX_PHASES 64
+
+struct stats_counters
+{
+	long long wall_us;
+	long long cpu_us;
+	long long read_bytes;     // rchar: all bytes read via read()-like syscalls
+	long long write_bytes;    // wchar
+	long long read_syscalls;  // syscr
+	long long write_syscalls; // syscw
+	long long erase_cnt;
+	long long write_cnt;
+};
+
+struct stats_phase
+{
+	char name[64];
+	struct stats_counters start;
+	struct stats_counters sum;
+};
+
+static struct stats_phase stats_phases[STATS_MAX_PHASES];
+static int stats_phase_cnt = 0;
+static int stats_dropped = 0; // phases beyond STATS_MAX_PHASES
+static struct stats_phase* stats_current = NULL;
+
+static long long timeval_us(struct timeval* tv)
+{
+	return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void stats_read(struct stats_counters* c)
+{
+	struct timespec ts;
+	struct rusage self, children;
+	FILE* f;
+	char key[32];
+	long long value;
+
+	memset(c, 0, sizeof(*c));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	c->wall_us = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	// children: system() calls like cp, init, killall
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	c->cpu_us = timeval_us(&self.ru_utime) + timeval_us(&self.ru_stime)
+			  + timeval_us(&children.ru_utime) + timeval_us(&children.ru_stime);
+
+	f = fopen("/proc/self/io", "r");
+	if (f)
+	{
+		while (fscanf(f, "%31s %lld", key, &value) == 2)
+		{
+			if (!strcmp(key, "rchar:"))
+				c->read_bytes = value;
+			else if (!strcmp(key, "wchar:"))
+				c->write_bytes = value;
+			else if (!strcmp(key, "syscr:"))
+				c->read_syscalls = value;
+			else if (!strcmp(key, "syscw:"))
+				c->write_syscalls = value;
+		}
+		fclose(f);
+	}
+
+	telemetry_counters(&c->erase_cnt, &c->write_cnt);
+}
+
+// after daemonize() the counters of the new process start again at zero
+static long long delta(long long start, long long end)
+{
+	return end >= start ? end - start : end;
+}
+
+static void stats_close_phase()
+{
+	struct stats_counters now;
+
+	if (stats_current == NULL)
+		return;
+
+	stats_read(&now);
+	stats_current->sum.wall_us        += now.wall_us - stats_current->start.wall_us;
+	stats_current->sum.cpu_us         += delta(stats_current->start.cpu_us, now.cpu_us);
+	stats_current->sum.read_bytes     += delta(stats_current->start.read_bytes, now.read_bytes);
+	stats_current->sum.write_bytes    += delta(stats_current->start.write_bytes, now.write_bytes);
+	stats_current->sum.read_syscalls  += delta(stats_current->start.read_syscalls, now.read_syscalls);
+	stats_current->sum.write_syscalls += delta(stats_current->start.write_syscalls, now.write_syscalls);
+	stats_current->sum.erase_cnt      += now.erase_cnt - stats_current->start.erase_cnt;
+	stats_current->sum.write_cnt      += now.write_cnt - stats_current->start.write_cnt;
+	stats_current = NULL;
+}
+
+void stats_phase(const char* name)
+{
+	// set_step() followed by stats_phase() of the same step
+	if (stats_current && strncmp(stats_current->name, name, sizeof(stats_current->name) - 1) == 0)
+		return;
+
+	stats_close_phase();
+
+	if (stats_phase_cnt == STATS_MAX_PHASES)
+	{
+		if (stats_dropped++ == 0)
+			my_printf("Phase statistics: more than %d phases, ignoring %s and later ones\n", STATS_MAX_PHASES, name);
+		return;
+	}
+
+	stats_current = &stats_phases[stats_phase_cnt++];
+	memset(stats_current, 0, sizeof(*stats_current));
+	strncpy(stats_current->name, name, sizeof(stats_current->name) - 1);
+	stats_read(&stats_current->start);
+}
+
+static void stats_print(FILE* f, void (*print)(char const *fmt, ...))
+{
+	int i;
+	char line[512];
+	struct stats_counters total;
+
+	memset(&total, 0, sizeof(total));
+	snprintf(line, sizeof(line), "{\"phases\":[\n");
+	if (f) fputs(line, f); else print("%s", line);
+
+	for (i = 0; i < stats_phase_cnt; i++)
+	{
+		struct stats_counters* c = &stats_phases[i].sum;
+		char name[64];
+		int j, k = 0;
+
+		// step texts don't contain control chars, only quotes need escaping
+		for (j = 0; stats_phases[i].name[j] && k < sizeof(name) - 2; j++)
+		{
+			if (stats_phases[i].name[j] == '"' || stats_phases[i].name[j] == '\\')
+				name[k++] = '\\';
+			name[k++] = stats_phases[i].name[j];
+		}
+		name[k] = '\0';
+
+		snprintf(line, sizeof(line),
+				 " {\"name\":\"%s\",\"wall_ms\":%lld,\"cpu_ms\":%lld,\"read_bytes\":%lld,\"write_bytes\":%lld,"
+				 "\"read_syscalls\":%lld,\"write_syscalls\":%lld,\"erase_cnt\":%lld,\"write_cnt\":%lld}%s\n",
+				 name, c->wall_us / 1000, c->cpu_us / 1000, c->read_bytes, c->write_bytes,
+				 c->read_syscalls, c->write_syscalls, c->erase_cnt, c->write_cnt,
+				 i + 1 < stats_phase_cnt ? "," : "");
+		if (f) fputs(line, f); else print("%s", line);
+
+		total.wall_us        += c->wall_us;
+		total.cpu_us         += c->cpu_us;
+		total.read_bytes     += c->read_bytes;
+		total.write_bytes    += c->write_bytes;
+		total.read_syscalls  += c->read_syscalls;
+		total.write_syscalls += c->write_syscalls;
+		total.erase_cnt      += c->erase_cnt;
+		total.write_cnt      += c->write_cnt;
+	}
+
+	snprintf(line, sizeof(line),
+			 "],\"total\":{\"wall_ms\":%lld,\"cpu_ms\":%lld,\"read_bytes\":%lld,\"write_bytes\":%lld,"
+			 "\"read_syscalls\":%lld,\"write_syscalls\":%lld,\"erase_cnt\":%lld,\"write_cnt\":%lld}}\n",
+			 total.wall_us / 1000, total.cpu_us / 1000, total.read_bytes, total.write_bytes,
+			 total.read_syscalls, total.write_syscalls, total.erase_cnt, total.write_cnt);
+	if (f) fputs(line, f); else print("%s", line);
+}
+
+// closes the running phase and writes the report to STATS_REPORT_FILE and the log
+void stats_report()
+{
+	FILE* f;
+
+	stats_close_phase();
+	if (stats_phase_cnt == 0)
+		return;
+
+	my_printf("Phase statistics:\n");
+	if (stats_dropped)
+		my_printf("(%d phases beyond the first %d are missing)\n", stats_dropped, STATS_MAX_PHASES);
+	stats_print(NULL, my_printf);
+
+	f = fopen(STATS_REPORT_FILE, "w");
+	if (f == NULL)
+	{
+		my_printf("Error: Cannot write %s\n", STATS_REPORT_FILE);
+		return;
+	}
+	stats_print(f, NULL);
+	fclose(f);
+	my_printf("Phase statistics written to %s\n", STATS_REPORT_FILE);
+}
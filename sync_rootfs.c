@@ -0,0 +1,398 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "busybox/include/libbb.h"
+#include "busybox/include/bb_archive.h"
+
+/* Differential rootfs update.
+ *
+ * Instead of deleting the whole rootfs and extracting every file again the
+ * tar archive is streamed and each entry is compared with the existing file:
+ * - regular files with same size, mode, owner and mtime are skipped.
+ *   With diff_rootfs == DIFF_ROOTFS_CONTENT the content is compared too.
+ * - changed regular files are written to a temp file which is renamed
+ * - all other entries are (re)created by busybox data_extract_all()
+ * At the end all files which are not in the archive are deleted.
+ */
+
+#define SYNC_TMP_SUFFIX ".ofgwrite-tmp"
+#define SYNC_BUF_SIZE (64 * 1024)
+
+struct sync_stats
+{
+	long long skipped;
+	long long written;
+	long long other;
+	long long deleted;
+};
+
+static char** sync_names = NULL; // open addressing hash set of all archive paths
+static unsigned int sync_names_size = 0;
+static unsigned int sync_names_cnt = 0;
+static struct sync_stats sync_stats;
+static int sync_compare_content = 0;
+static dev_t sync_root_dev;
+
+static unsigned int name_hash(const char* name)
+{
+	unsigned int h = 2166136261u; // FNV-1a
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static char** name_slot(char** table, unsigned int size, const char* name)
+{
+	unsigned int i = name_hash(name) & (size - 1);
+
+	while (table[i] != NULL && strcmp(table[i], name) != 0)
+		i = (i + 1) & (size - 1);
+	return &table[i];
+}
+
+static int name_known(const char* name)
+{
+	return sync_names_size && *name_slot(sync_names, sync_names_size, name) != NULL;
+}
+
+static void name_add_one(const char* name, size_t len)
+{
+	char** slot;
+	char* copy = xstrndup(name, len);
+
+	if (sync_names_cnt * 2 >= sync_names_size)
+	{
+		unsigned int i, new_size = sync_names_size ? sync_names_size * 2 : 4096;
+		char** table = xzalloc(new_size * sizeof(*table));
+		for (i = 0; i < sync_names_size; i++)
+			if (sync_names[i] != NULL)
+				*name_slot(table, new_size, sync_names[i]) = sync_names[i];
+		free(sync_names);
+		sync_names = table;
+		sync_names_size = new_size;
+	}
+
+	slot = name_slot(sync_names, sync_names_size, copy);
+	if (*slot != NULL)
+	{
+		free(copy);
+		return;
+	}
+	*slot = copy;
+	sync_names_cnt++;
+}
+
+// adds name and all its parent directories
+static void name_add(const char* name)
+{
+	const char* slash;
+
+	for (slash = strchr(name, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+		name_add_one(name, slash - name);
+	name_add_one(name, strlen(name));
+}
+
+static void names_free()
+{
+	unsigned int i;
+
+	for (i = 0; i < sync_names_size; i++)
+		free(sync_names[i]);
+	free(sync_names);
+	sync_names = NULL;
+	sync_names_size = 0;
+	sync_names_cnt = 0;
+}
+
+// "./bin/sh" -> "bin/sh", "./" -> ""
+static char* normalize_name(char* name)
+{
+	while (name[0] == '.' && name[1] == '/')
+		name += 2;
+	if (strcmp(name, ".") == 0)
+		name += 1;
+	return name;
+}
+
+static void set_file_attributes(int fd, const char* name, file_header_t* hdr)
+{
+	struct timeval t[2];
+
+	if (fchown(fd, hdr->uid, hdr->gid) != 0 && errno != EPERM)
+		my_printf("Error: chown %s: %s\n", name, strerror(errno));
+	fchmod(fd, hdr->mode & 07777);
+	t[1].tv_sec = t[0].tv_sec = hdr->mtime;
+	t[1].tv_usec = t[0].tv_usec = 0;
+	futimes(fd, t);
+}
+
+/* Writes the file data to a temp file and renames it.
+ * The first "done" bytes are identical to the existing file and were already consumed from the archive.
+ */
+static void replace_file(archive_handle_t* handle, const char* name, off_t done, const char* buf, size_t buf_len)
+{
+	file_header_t* hdr = handle->file_header;
+	char* tmp_name = xasprintf("%s" SYNC_TMP_SUFFIX, name);
+	int fd;
+
+	fd = xopen3(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, hdr->mode & 07777);
+	if (done > 0)
+	{
+		int old_fd = xopen(name, O_RDONLY);
+		bb_copyfd_exact_size(old_fd, fd, done);
+		close(old_fd);
+	}
+	if (buf_len)
+		xwrite(fd, buf, buf_len);
+	archive_copy(handle, fd, hdr->size - done - buf_len);
+	set_file_attributes(fd, tmp_name, hdr);
+	xclose(fd);
+	xrename(tmp_name, name);
+	free(tmp_name);
+	sync_stats.written++;
+}
+
+// compares archive data with the existing file. Replaces the file at the first difference.
+static void compare_file(archive_handle_t* handle, const char* name)
+{
+	file_header_t* hdr = handle->file_header;
+	char* archive_buf = xmalloc(SYNC_BUF_SIZE);
+	char* file_buf = xmalloc(SYNC_BUF_SIZE);
+	off_t done = 0;
+	int fd = xopen(name, O_RDONLY);
+
+	while (done < hdr->size)
+	{
+		size_t len = hdr->size - done > SYNC_BUF_SIZE ? SYNC_BUF_SIZE : hdr->size - done;
+		archive_xread(handle, archive_buf, len);
+		if (full_read(fd, file_buf, len) != len || memcmp(archive_buf, file_buf, len) != 0)
+		{
+			close(fd);
+			fd = -1;
+			replace_file(handle, name, done, archive_buf, len);
+			break;
+		}
+		done += len;
+	}
+	if (fd != -1)
+	{
+		close(fd);
+		sync_stats.skipped++;
+	}
+	free(archive_buf);
+	free(file_buf);
+}
+
+static void FAST_FUNC sync_action_data(archive_handle_t* handle)
+{
+	file_header_t* hdr = handle->file_header;
+	char* name = normalize_name(hdr->name);
+	struct stat st;
+	int exists;
+
+	if (name[0] == '\0') // root directory itself
+	{
+		data_skip(handle);
+		return;
+	}
+	name_add(name);
+
+	exists = lstat(name, &st) == 0;
+	// type changed: remove old entry (a directory recursively)
+	if (exists && (st.st_mode & S_IFMT) != (hdr->mode & S_IFMT))
+	{
+		remove_file(name, FILEUTILS_RECUR | FILEUTILS_FORCE);
+		exists = 0;
+	}
+
+	if (S_ISREG(hdr->mode) && !(hdr->link_target && hdr->size == 0))
+	{
+		char* slash = strrchr(name, '/');
+		if (!exists && slash)
+		{
+			*slash = '\0';
+			bb_make_directory(name, -1, FILEUTILS_RECUR);
+			*slash = '/';
+		}
+
+		if (exists
+		 && st.st_size == hdr->size
+		 && (st.st_mode & 07777) == (hdr->mode & 07777)
+		 && st.st_uid == hdr->uid
+		 && st.st_gid == hdr->gid
+		 && st.st_mtime == hdr->mtime)
+		{
+			if (sync_compare_content)
+				compare_file(handle, name);
+			else
+			{
+				data_skip(handle);
+				sync_stats.skipped++;
+			}
+			return;
+		}
+		replace_file(handle, name, 0, NULL, 0);
+		return;
+	}
+
+	// hard link which already points to the right file
+	if (S_ISREG(hdr->mode) && exists)
+	{
+		struct stat target;
+		if (lstat(hdr->link_target, &target) == 0 && target.st_ino == st.st_ino && target.st_dev == st.st_dev)
+		{
+			sync_stats.skipped++;
+			return;
+		}
+	}
+
+	// symlink with same target
+	if (S_ISLNK(hdr->mode) && exists && hdr->link_target)
+	{
+		char* target = xmalloc_readlink(name);
+		int same = target && strcmp(target, hdr->link_target) == 0;
+		free(target);
+		if (same)
+		{
+			sync_stats.skipped++;
+			return;
+		}
+	}
+
+	// directories, changed links and device nodes: use tar extraction
+	data_extract_all(handle);
+	sync_stats.other++;
+}
+
+// deletes everything below dir which isn't in the archive
+static void remove_obsolete(char* dir, size_t len)
+{
+	DIR* d;
+	struct dirent* entry;
+	struct stat st;
+
+	d = opendir(len ? dir : ".");
+	if (d == NULL)
+		return;
+
+	while ((entry = readdir(d)) != NULL)
+	{
+		size_t name_len = strlen(entry->d_name);
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (len + name_len + 2 > PATH_MAX)
+			continue;
+
+		if (len)
+			dir[len] = '/';
+		memcpy(&dir[len ? len + 1 : 0], entry->d_name, name_len + 1);
+
+		// don't touch other mounted filesystems
+		if (lstat(dir, &st) == 0 && st.st_dev == sync_root_dev)
+		{
+			if (!name_known(dir))
+			{
+				if (remove_file(dir, FILEUTILS_RECUR | FILEUTILS_FORCE) == 0)
+					sync_stats.deleted++;
+			}
+			else if (S_ISDIR(st.st_mode))
+				remove_obsolete(dir, len ? len + 1 + name_len : name_len);
+		}
+		dir[len] = '\0';
+	}
+	closedir(d);
+}
+
+int flash_sync_rootfs(char* filename, int quiet, int no_write)
+{
+	archive_handle_t* handle;
+	char path[1000];
+	char* dir;
+	struct stat st;
+	int ret;
+
+	strcpy(path, "/oldroot_remount/");
+	if (current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0) // box with rootSubDir feature
+	{
+		strcat(path, rootfs_sub_dir);
+		strcat(path, "/");
+	}
+
+	set_step("Updating rootfs");
+	set_step_progress(0);
+	if (!quiet)
+		my_printf("Update rootfs in %s from %s\n", path, filename);
+	if (no_write)
+		return 1;
+
+	if (current_rootfs_sub_dir[0] != '\0' && rootsubdir_check == 0)
+		mkdir(path, 777); // directory is maybe not present
+	if (chdir(path) != 0 || stat(".", &st) != 0)
+	{
+		my_printf("Error: can't change to %s\n", path);
+		return 0;
+	}
+	sync_root_dev = st.st_dev;
+	sync_compare_content = (diff_rootfs == DIFF_ROOTFS_CONTENT);
+	memset(&sync_stats, 0, sizeof(sync_stats));
+
+	die_func = &handle_busybox_fatal_error;
+	handle = init_handle();
+	handle->ah_flags = ARCHIVE_CREATE_LEADING_DIRS | ARCHIVE_RESTORE_DATE | ARCHIVE_UNLINK_OLD;
+	handle->action_data = sync_action_data;
+	handle->src_fd = open_zipped(filename, 0);
+	if (handle->src_fd < 0)
+	{
+		my_printf("Error opening %s\n", filename);
+		free(handle->file_header);
+		free(handle);
+		return 0;
+	}
+	// compressed archives are read from a pipe
+	if (lseek(handle->src_fd, 0, SEEK_CUR) == -1)
+		handle->seek = seek_by_read;
+
+	ret = 0;
+	bb_got_signal = 0;
+	while (get_header_tar(handle) == EXIT_SUCCESS)
+		ret = 1;
+	close(handle->src_fd);
+	free(handle->ofg_buf);
+	check_errors_in_children(0);
+	if (bb_got_signal || !image_streams_ok())
+		ret = 0;
+	if (!ret)
+	{
+		my_printf("Error reading %s\n", filename);
+		names_free();
+		return 0;
+	}
+
+	set_step("Removing obsolete files");
+	dir = xzalloc(PATH_MAX);
+	remove_obsolete(dir, 0);
+	free(dir);
+	names_free();
+
+	my_printf("Rootfs update: %lld files unchanged, %lld files written, %lld other entries, %lld obsolete entries deleted\n",
+			  sync_stats.skipped, sync_stats.written, sync_stats.other, sync_stats.deleted);
+
+	stats_phase("Syncing rootfs");
+	copy_backup_to_rootfs(path);
+	durable_track("/oldroot_remount/");
+	if (!no_write && !durable_sync("/oldroot_remount/"))
+		return 0;
+
+	ret = chdir("/"); // needed to be able to umount filesystem
+	return 1;
+}
@@ -0,0 +1,280 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Machine readable progress events for external frontends.
+ *
+ * Every event is sent as one JSON object per datagram to a unix socket which
+ * has to be bound by the frontend (default /tmp/ofgwrite.sock). Nothing is
+ * buffered: if nobody listens the datagram is simply dropped, so the cost
+ * during flashing is one failing send() per event.
+ * The socket is connected as early as possible: after pivot_root the path
+ * doesn't lead to the frontend's socket anymore, the connection still does.
+ */
+
+#define TELEMETRY_MAX_DEVICES 8
+#define TELEMETRY_PROGRESS_INTERVAL_MS 250
+
+struct telemetry_device
+{
+	char name[64];
+	long long erase_cnt;
+	long long write_cnt;
+	long long bad_blocks;
+	long long bytes_written;
+};
+
+static int telemetry_fd = -1;
+static struct sockaddr_un telemetry_addr;
+static socklen_t telemetry_addr_len;
+static int telemetry_connected = 0;
+
+static int telemetry_step_nr = 0;
+static char telemetry_step_name[100];
+static long long telemetry_step_start_ms;
+static long long telemetry_last_progress_ms;
+static int telemetry_last_percent = -1;
+static int telemetry_errors = 0;
+
+static struct telemetry_device telemetry_devices[TELEMETRY_MAX_DEVICES];
+static int telemetry_device_cnt = 0;
+
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// copy str to dest as JSON string content (without quotes)
+static void json_escape(char* dest, size_t size, const char* str)
+{
+	size_t i = 0;
+
+	for (; str && *str && i + 7 < size; str++)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+		{
+			dest[i++] = '\\';
+			dest[i++] = c;
+		}
+		else if (c < 0x20)
+			i += sprintf(&dest[i], "\\u%04x", c);
+		else
+			dest[i++] = c;
+	}
+	dest[i] = '\0';
+}
+
+static void telemetry_connect()
+{
+	telemetry_connected = connect(telemetry_fd, (struct sockaddr*)&telemetry_addr, telemetry_addr_len) == 0;
+}
+
+static void telemetry_send(const char* fmt, ...)
+{
+	char msg[512];
+	va_list ap;
+	int len;
+
+	if (telemetry_fd == -1)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if (len <= 0)
+		return;
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
+
+	// ignore errors: frontend is maybe not running (yet)
+	if (!telemetry_connected)
+		telemetry_connect();
+	if (telemetry_connected
+	 && send(telemetry_fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno == ECONNREFUSED)
+		telemetry_connected = 0; // frontend has gone
+}
+
+static struct telemetry_device* telemetry_get_device(const char* device)
+{
+	int i;
+
+	if (device == NULL)
+		device = "";
+	for (i = 0; i < telemetry_device_cnt; i++)
+		if (strcmp(telemetry_devices[i].name, device) == 0)
+			return &telemetry_devices[i];
+
+	if (telemetry_device_cnt == TELEMETRY_MAX_DEVICES)
+		return &telemetry_devices[TELEMETRY_MAX_DEVICES - 1];
+
+	strncpy(telemetry_devices[telemetry_device_cnt].name, device, sizeof(telemetry_devices[0].name) - 1);
+	return &telemetry_devices[telemetry_device_cnt++];
+}
+
+int telemetry_init(const char* path)
+{
+	if (telemetry_fd != -1)
+		return 1;
+
+	if (strlen(path) >= sizeof(telemetry_addr.sun_path))
+	{
+		my_printf("Error: Telemetry socket path too long: %s\n", path);
+		return 0;
+	}
+
+	telemetry_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (telemetry_fd == -1)
+	{
+		my_printf("Error: Cannot create telemetry socket: %s\n", strerror(errno));
+		return 0;
+	}
+
+	memset(&telemetry_addr, 0, sizeof(telemetry_addr));
+	telemetry_addr.sun_family = AF_UNIX;
+	strcpy(telemetry_addr.sun_path, path);
+	telemetry_addr_len = offsetof(struct sockaddr_un, sun_path) + strlen(path) + 1;
+	telemetry_connect();
+
+	telemetry_send("{\"event\":\"start\",\"pid\":%d}", getpid());
+	return 1;
+}
+
+// no events from this process (background processes which don't flash)
+void telemetry_detach()
+{
+	if (telemetry_fd != -1)
+		close(telemetry_fd);
+	telemetry_fd = -1;
+}
+
+static void telemetry_step_end()
+{
+	if (telemetry_step_nr == 0)
+		return;
+
+	telemetry_send("{\"event\":\"step_end\",\"step\":%d,\"name\":\"%s\",\"duration_ms\":%lld}",
+				   telemetry_step_nr, telemetry_step_name, now_ms() - telemetry_step_start_ms);
+}
+
+void telemetry_step(const char* name)
+{
+	telemetry_step_end();
+
+	telemetry_step_nr++;
+	json_escape(telemetry_step_name, sizeof(telemetry_step_name), name);
+	telemetry_step_start_ms = now_ms();
+	telemetry_last_progress_ms = 0;
+	telemetry_last_percent = -1;
+
+	telemetry_send("{\"event\":\"step_start\",\"step\":%d,\"name\":\"%s\"}",
+				   telemetry_step_nr, telemetry_step_name);
+}
+
+/* bytes_done/bytes_total of the current step on device.
+ * Events are rate limited, the last one (bytes_done == bytes_total) is always sent.
+ */
+void telemetry_progress(const char* device, long long bytes_done, long long bytes_total)
+{
+	struct telemetry_device* dev = telemetry_get_device(device);
+	long long now = now_ms();
+	long long elapsed = now - telemetry_step_start_ms;
+	int percent = bytes_total > 0 ? (int)(bytes_done * 100 / bytes_total) : 0;
+	char name[128];
+
+	if (bytes_done > dev->bytes_written)
+		dev->bytes_written = bytes_done;
+
+	if (telemetry_fd == -1)
+		return;
+	if (bytes_done < bytes_total
+	 && percent == telemetry_last_percent
+	 && now - telemetry_last_progress_ms < TELEMETRY_PROGRESS_INTERVAL_MS)
+		return;
+	telemetry_last_percent = percent;
+	telemetry_last_progress_ms = now;
+
+	json_escape(name, sizeof(name), dev->name);
+	telemetry_send("{\"event\":\"progress\",\"step\":%d,\"device\":\"%s\",\"bytes_done\":%lld,\"bytes_total\":%lld,"
+				   "\"mb_per_s\":%.2f,\"erase_cnt\":%lld,\"write_cnt\":%lld,\"bad_blocks\":%lld}",
+				   telemetry_step_nr, name, bytes_done, bytes_total,
+				   elapsed > 0 ? bytes_done / 1048576.0 / (elapsed / 1000.0) : 0.0,
+				   dev->erase_cnt, dev->write_cnt, dev->bad_blocks);
+}
+
+void telemetry_erase(const char* device, int count)
+{
+	telemetry_get_device(device)->erase_cnt += count;
+}
+
+void telemetry_write(const char* device, int count)
+{
+	telemetry_get_device(device)->write_cnt += count;
+}
+
+// sum of erase and write operations over all devices
+void telemetry_counters(long long* erase_cnt, long long* write_cnt)
+{
+	int i;
+
+	*erase_cnt = 0;
+	*write_cnt = 0;
+	for (i = 0; i < telemetry_device_cnt; i++)
+	{
+		*erase_cnt += telemetry_devices[i].erase_cnt;
+		*write_cnt += telemetry_devices[i].write_cnt;
+	}
+}
+
+void telemetry_bad_block(const char* device, long long eraseblock)
+{
+	struct telemetry_device* dev = telemetry_get_device(device);
+	char name[128];
+
+	dev->bad_blocks++;
+	json_escape(name, sizeof(name), dev->name);
+	telemetry_send("{\"event\":\"bad_block\",\"device\":\"%s\",\"eraseblock\":%lld}", name, eraseblock);
+}
+
+void telemetry_error(const char* text)
+{
+	char msg[256];
+
+	telemetry_errors++;
+	json_escape(msg, sizeof(msg), text);
+	telemetry_send("{\"event\":\"error\",\"step\":%d,\"message\":\"%s\"}", telemetry_step_nr, msg);
+}
+
+// sends end of last step, device statistics and overall result
+void telemetry_finish(int success)
+{
+	int i;
+	char name[128];
+
+	telemetry_step_end();
+	telemetry_step_nr = 0;
+
+	for (i = 0; i < telemetry_device_cnt; i++)
+	{
+		json_escape(name, sizeof(name), telemetry_devices[i].name);
+		telemetry_send("{\"event\":\"device_stats\",\"device\":\"%s\",\"bytes_written\":%lld,"
+					   "\"erase_cnt\":%lld,\"write_cnt\":%lld,\"bad_blocks\":%lld}",
+					   name, telemetry_devices[i].bytes_written, telemetry_devices[i].erase_cnt,
+					   telemetry_devices[i].write_cnt, telemetry_devices[i].bad_blocks);
+	}
+	telemetry_send("{\"event\":\"finish\",\"success\":%s,\"errors\":%d}",
+				   success ? "true" : "false", telemetry_errors);
+
+	close(telemetry_fd);
+	telemetry_fd = -1;
+}
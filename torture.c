@@ -0,0 +1,238 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <libmtd.h>
+
+/* Torture test of eraseblocks after a write failure (replaces mtd_torture).
+ *
+ * The eraseblock is erased, written and read back with every pattern like
+ * before, but the pattern buffers are filled once and kept, the read back is
+ * done in chunks compared a word at a time, and the test stops at the first
+ * bad chunk. Every result is appended to a report beside the image, so
+ * eraseblocks failing on every flash can be recognized:
+ *   <time> <mtd name> <eraseblock> <pass|fail> <detail>
+ */
+
+#define TORTURE_REPORT_NAME ".ofgwrite_torture"
+#define TORTURE_CHUNK_SIZE  (64 * 1024)
+#define TORTURE_ALIGN       64
+
+static const uint8_t torture_patterns[] = {0xa5, 0x5a, 0x0};
+#define TORTURE_PATTERN_CNT (int)(sizeof(torture_patterns) / sizeof(torture_patterns[0]))
+
+static uint8_t* torture_pattern_buf[TORTURE_PATTERN_CNT];
+static uint8_t* torture_read_buf;
+static int torture_buf_size;
+static char torture_report_path[1100];
+
+// 1 if size bytes of buf (size a multiple of 8) are all patt
+static int torture_check(const uint8_t* buf, uint8_t patt, int size)
+{
+	const uint64_t* p = (const uint64_t*)buf;
+	const uint64_t* end = (const uint64_t*)(buf + size);
+	uint64_t word = patt * 0x0101010101010101ULL;
+
+	for (; p + 4 <= end; p += 4)
+		if ((p[0] ^ word) | (p[1] ^ word) | (p[2] ^ word) | (p[3] ^ word))
+			return 0;
+	for (; p < end; p++)
+		if (*p != word)
+			return 0;
+	return 1;
+}
+
+static int torture_alloc(int eb_size)
+{
+	int i;
+
+	if (torture_buf_size == eb_size)
+		return 1;
+	for (i = 0; i < TORTURE_PATTERN_CNT; i++)
+	{
+		free(torture_pattern_buf[i]);
+		torture_pattern_buf[i] = NULL;
+	}
+	free(torture_read_buf);
+	torture_read_buf = NULL;
+	torture_buf_size = 0;
+
+	for (i = 0; i < TORTURE_PATTERN_CNT; i++)
+	{
+		if (posix_memalign((void**)&torture_pattern_buf[i], TORTURE_ALIGN, eb_size) != 0)
+			return 0;
+		memset(torture_pattern_buf[i], torture_patterns[i], eb_size);
+	}
+	if (posix_memalign((void**)&torture_read_buf, TORTURE_ALIGN, TORTURE_CHUNK_SIZE) != 0)
+		return 0;
+	torture_buf_size = eb_size;
+	return 1;
+}
+
+/* Reads the eraseblock back and compares it with patt. Returns the offset of
+ * the first chunk which differs, -1 if all is fine and -2 on read errors.
+ */
+static int torture_verify(const struct mtd_dev_info* mtd, int fd, int eb, uint8_t patt)
+{
+	int chunk = TORTURE_CHUNK_SIZE / mtd->min_io_size * mtd->min_io_size;
+	int offs, len;
+
+	if (chunk == 0 || chunk > mtd->eb_size)
+		chunk = mtd->eb_size < TORTURE_CHUNK_SIZE ? mtd->eb_size : mtd->min_io_size;
+	for (offs = 0; offs < mtd->eb_size; offs += len)
+	{
+		len = mtd->eb_size - offs < chunk ? mtd->eb_size - offs : chunk;
+		if (mtd_read(mtd, fd, eb, offs, torture_read_buf, len) != 0)
+			return -2;
+		if (!torture_check(torture_read_buf, patt, len))
+			return offs;
+	}
+	return -1;
+}
+
+// mtd name as one field of the report
+static const char* torture_name(const struct mtd_dev_info* mtd)
+{
+	return mtd->name[0] && !strchr(mtd->name, ' ') ? mtd->name : "-";
+}
+
+// number of earlier torture tests and failures of the eraseblock in the report
+static void torture_history(const struct mtd_dev_info* mtd, int eb, int* tested, int* failed)
+{
+	char line[300], name[128], result[16];
+	long long time;
+	int line_eb;
+	FILE* f;
+
+	*tested = *failed = 0;
+	if (torture_report_path[0] == '\0' || (f = fopen(torture_report_path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "%lld %127s %d %15s", &time, name, &line_eb, result) == 4
+		 && line_eb == eb && strcmp(name, torture_name(mtd)) == 0)
+		{
+			(*tested)++;
+			if (strcmp(result, "fail") == 0)
+				(*failed)++;
+		}
+	}
+	fclose(f);
+}
+
+static void torture_record(const struct mtd_dev_info* mtd, int eb, int passed, const char* detail)
+{
+	char line[300];
+	int fd, len;
+
+	if (torture_report_path[0] == '\0')
+		return;
+	len = snprintf(line, sizeof(line), "%lld %s %d %s %s\n", (long long)time(NULL),
+				   torture_name(mtd), eb, passed ? "pass" : "fail", detail);
+	fd = open(torture_report_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0 || write(fd, line, len) != len)
+		my_printf("Error writing torture report %s\n", torture_report_path);
+	if (fd >= 0)
+		close(fd);
+}
+
+// torture results are reported beside the image, for a zip beside the zip file
+void torture_report_open(const char* image_dir)
+{
+	char dir[1000];
+	struct stat st;
+
+	torture_report_path[0] = '\0';
+	if (image_dir == NULL)
+		return;
+	strncpy(dir, image_dir, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	if (stat(dir, &st) == 0 && S_ISREG(st.st_mode))
+		strcpy(dir, dirname(dir));
+	snprintf(torture_report_path, sizeof(torture_report_path), "%s/%s", dir, TORTURE_REPORT_NAME);
+}
+
+/* Tortures eraseblock eb of device. Returns 0 if it passed and -1 if it is
+ * bad (errno is set). Note: mtd_torture returned -1 in any case, so every
+ * tortured eraseblock was marked bad. A passing eraseblock is left erased and
+ * the caller writes it again.
+ */
+int torture_eraseblock(libmtd_t desc, const struct mtd_dev_info* mtd, int fd, int eb, const char* device)
+{
+	char detail[100] = "";
+	int i, tested, failed, offs;
+
+	torture_history(mtd, eb, &tested, &failed);
+	if (tested)
+		my_printf("run torture test for PEB %d (tested %d times before, failed %d times)\n", eb, tested, failed);
+	else
+		my_printf("run torture test for PEB %d\n", eb);
+
+	if (mtd->eb_size % 8 || !torture_alloc(mtd->eb_size))
+	{
+		my_printf("Error: torture test for PEB %d not possible\n", eb);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < TORTURE_PATTERN_CNT; i++)
+	{
+		if (mtd_erase(desc, mtd, fd, eb) != 0)
+		{
+			snprintf(detail, sizeof(detail), "erase");
+			break;
+		}
+		telemetry_erase(device, 1);
+
+		// the eraseblock must contain only 0xff bytes
+		offs = torture_verify(mtd, fd, eb, 0xff);
+		if (offs != -1)
+		{
+			snprintf(detail, sizeof(detail), offs == -2 ? "read-erased" : "erased@%d", offs);
+			break;
+		}
+
+		telemetry_write(device, 1);
+		if (mtd_write(desc, mtd, fd, eb, 0, torture_pattern_buf[i], mtd->eb_size, NULL, 0, 0) != 0)
+		{
+			snprintf(detail, sizeof(detail), "write-%02x", torture_patterns[i]);
+			break;
+		}
+
+		offs = torture_verify(mtd, fd, eb, torture_patterns[i]);
+		if (offs != -1)
+		{
+			snprintf(detail, sizeof(detail), offs == -2 ? "read-%02x" : "pattern-%02x@%d", torture_patterns[i], offs);
+			break;
+		}
+	}
+
+	// leave it erased like torture_peb() of the kernel
+	if (i == TORTURE_PATTERN_CNT)
+	{
+		if (mtd_erase(desc, mtd, fd, eb) != 0)
+			snprintf(detail, sizeof(detail), "erase");
+		else
+			telemetry_erase(device, 1);
+	}
+
+	if (detail[0] != '\0')
+	{
+		my_printf("PEB %d failed torture test: %s\n", eb, detail);
+		torture_record(mtd, eb, 0, detail);
+		errno = EIO;
+		return -1;
+	}
+
+	// failed the test on an earlier flash: likely to fail again
+	torture_record(mtd, eb, 1, failed ? "marginal" : "-");
+	my_printf("PEB %d passed torture test, do not mark it a bad%s\n", eb, failed ? " (marginal)" : "");
+	return 0;
+}
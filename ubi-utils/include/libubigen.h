@@ -154,6 +154,24 @@ int ubigen_add_volume(const struct ubigen_info *ui,
 		      const struct ubigen_vol_info *vi,
 		      struct ubi_vtbl_record *vtbl);
 
+/**
+ * ubigen_read_leb - read a logical eraseblock and create its PEB.
+ * @ui: libubigen information
+ * @vi: volume information
+ * @ec: erase counter value to put to the EC header
+ * @lnum: logical eraseblock number
+ * @len: how many bytes of LEB data to read from @in
+ * @in: input file descriptor
+ * @peb: buffer of @ui->peb_size bytes
+ *
+ * This function reads the data directly to its place behind the headers in
+ * @peb, so it is not copied again, and pads the rest with 0xFF. Returns zero
+ * on success and %-1 on failure.
+ */
+int ubigen_read_leb(const struct ubigen_info *ui,
+		    const struct ubigen_vol_info *vi, long long ec, int lnum,
+		    int len, int in, char *peb);
+
 /**
  * ubigen_write_volume - write UBI volume.
  * @ui: libubigen information
@@ -171,6 +189,18 @@ int ubigen_write_volume(const struct ubigen_info *ui,
 			const struct ubigen_vol_info *vi, long long ec,
 			long long bytes, int in, int out);
 
+/**
+ * ubigen_init_layout_peb - create a PEB of the UBI layout volume.
+ * @ui: libubigen information
+ * @lnum: logical eraseblock number of the layout volume (0 or 1)
+ * @ec: erase counter value to put to the EC header
+ * @vtbl: volume table
+ * @peb: buffer of @ui->peb_size bytes
+ */
+void ubigen_init_layout_peb(const struct ubigen_info *ui, int lnum,
+			    long long ec, const struct ubi_vtbl_record *vtbl,
+			    char *peb);
+
 /**
  * ubigen_write_layout_vol - write UBI layout volume
  * @ui: libubigen information
@@ -44,6 +44,7 @@
 #include <libubigen.h>
 #include <mtd_swab.h>
 #include <crc32.h>
+#include "ofgwrite.h"
 #include "common.h"
 #include "ubiutils-common.h"
 
@@ -334,11 +335,11 @@ static int open_file(off_t *sz)
 	} else {
 		struct stat st;
 
-		if (stat(args.image, &st))
+		if (image_stat(args.image, &st)) // changed for ofgwrite: image can be in a zip archive
 			return sys_errmsg("cannot open \"%s\"", args.image);
 
 		*sz = st.st_size;
-		fd  = open(args.image, O_RDONLY);
+		fd  = image_open(args.image); // changed for ofgwrite
 		if (fd == -1)
 			return sys_errmsg("cannot open \"%s\"", args.image);
 	}
@@ -353,6 +354,7 @@ static int read_all(int fd, void *buf, size_t len)
 		if (l == 0)
 			return errmsg("eof reached; %zu bytes remaining", len);
 		else if (l > 0) {
+			io_source_read(fd, l); // changed for ofgwrite
 			buf += l;
 			len -= l;
 		} else if (errno == EINTR || errno == EAGAIN)
@@ -414,6 +416,7 @@ static int mark_bad(const struct mtd_dev_info *mtd, struct ubi_scan_info *si, in
 		return errmsg("bad blocks not supported by this flash");
 	}
 
+	telemetry_bad_block(args.node, eb);
 	err = mtd_mark_bad(mtd, args.node_fd, eb);
 	if (err)
 		return err;
@@ -424,19 +427,124 @@ static int mark_bad(const struct mtd_dev_info *mtd, struct ubi_scan_info *si, in
 	return consecutive_bad_check(eb);
 }
 
+/*
+ * changed for ofgwrite: in-process ubinize. A raw UBIFS image (mkfs.ubifs
+ * output) is flashed like ubinize would pack it: the layout volume and one
+ * dynamic autoresize volume. The PEBs are generated while flashing, image
+ * PEB 0 and 1 are the layout volume and image PEB 2 + n is LEB n.
+ */
+#define UBIFS_NODE_MAGIC 0x06101831
+#define UBIFS_SB_NODE    6
+
+struct ubinize {
+	struct ubigen_vol_info vi;
+	struct ubi_vtbl_record *vtbl; /* NULL: the image is a UBI image */
+	long long bytes;
+};
+
+static int ubinize_open(const struct ubigen_info *ui, off_t st_size,
+			struct ubinize *un)
+{
+	unsigned char sb[40];
+	const char *name;
+	int fd, rd, len = 0, leb_size;
+
+	un->vtbl = NULL;
+	if (!strcmp(args.image, "-"))
+		return 0;
+
+	/* peek at the superblock node, the image stream can't be rewound */
+	fd = image_open(args.image);
+	if (fd < 0)
+		return sys_errmsg("cannot open \"%s\"", args.image);
+	while (len < sizeof(sb) && (rd = read(fd, sb + len, sizeof(sb) - len)) > 0)
+		len += rd;
+	image_close(fd);
+	if (len < sizeof(sb)
+	 || le32_to_cpu(*(uint32_t *)sb) != UBIFS_NODE_MAGIC
+	 || sb[20] != UBIFS_SB_NODE)
+		return 0;
+
+	leb_size = le32_to_cpu(*(uint32_t *)(sb + 36));
+	if (leb_size != ui->leb_size)
+		return errmsg("UBIFS image \"%s\" has LEB size %d, but the flash needs %d",
+			      args.image, leb_size, ui->leb_size);
+
+	/* volume name like the mounted rootfs "ubi0:rootfs" */
+	name = strchr(ubi_fs_name, ':');
+	name = name && name[1] ? name + 1 : "rootfs";
+
+	memset(&un->vi, 0, sizeof(un->vi));
+	un->vi.id = 0;
+	un->vi.type = UBI_VID_DYNAMIC;
+	un->vi.alignment = 1;
+	un->vi.usable_leb_size = ui->leb_size;
+	un->vi.name = name;
+	un->vi.name_len = strlen(name);
+	un->vi.used_ebs = (st_size + ui->leb_size - 1) / ui->leb_size;
+	un->vi.bytes = (long long)un->vi.used_ebs * ui->leb_size;
+	un->vi.flags = UBI_VTBL_AUTORESIZE_FLG;
+	un->bytes = st_size;
+
+	un->vtbl = ubigen_create_empty_vtbl(ui);
+	if (!un->vtbl)
+		return -1;
+	if (ubigen_add_volume(ui, &un->vi, un->vtbl)) {
+		free(un->vtbl);
+		un->vtbl = NULL;
+		return -1;
+	}
+	if (!args.quiet)
+		normsg("UBIFS image: creating volume \"%s\" with %d LEBs while flashing",
+		       name, un->vi.used_ebs);
+	return 0;
+}
+
+/* creates image PEB n, LEB data is read straight into its place in buf */
+static int ubinize_peb(const struct ubigen_info *ui, struct ubinize *un,
+		       int fd, int n, char *buf)
+{
+	long long pos;
+	int len;
+
+	if (n < UBI_LAYOUT_VOLUME_EBS) {
+		ubigen_init_layout_peb(ui, n, 0, un->vtbl, buf);
+		return 0;
+	}
+
+	n -= UBI_LAYOUT_VOLUME_EBS;
+	pos = (long long)n * ui->leb_size;
+	len = un->bytes - pos < ui->leb_size ? un->bytes - pos : ui->leb_size;
+	if (ubigen_read_leb(ui, &un->vi, 0, n, len, fd, buf))
+		return -1;
+	io_source_read(fd, len);
+	return 0;
+}
+
 static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 		       const struct ubigen_info *ui, struct ubi_scan_info *si)
 {
 	set_step("Flashing UBI image");
 
 	int fd, img_ebs, eb, written_ebs = 0, divisor, skip_data_read = 0;
+	int first_eb = 0;
+	int retry_eb; // changed for ofgwrite
+	long long resume_eb, resume_ebs, skip;
 	off_t st_size;
+	struct ubinize un;
 
 	fd = open_file(&st_size);
 	if (fd < 0)
 		return fd;
 
-	img_ebs = st_size / mtd->eb_size;
+	// changed for ofgwrite: raw UBIFS images are ubinized on the fly
+	if (ubinize_open(ui, st_size, &un))
+		goto out_close;
+	if (un.vtbl) {
+		img_ebs = UBI_LAYOUT_VOLUME_EBS + un.vi.used_ebs;
+		st_size = (off_t)img_ebs * mtd->eb_size; /* progress in image PEBs */
+	} else
+		img_ebs = st_size / mtd->eb_size;
 
 	if (img_ebs > si->good_cnt) {
 		sys_errmsg("file \"%s\" is too large (%lld bytes)",
@@ -451,18 +559,39 @@ static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 	}
 
 	verbose(args.verbose, "will write %d eraseblocks", img_ebs);
+
+	// changed for ofgwrite: continue an interrupted flash
+	if (journal_resume(args.node, &resume_eb, &resume_ebs)
+	 && resume_ebs < img_ebs && resume_eb < mtd->eb_cnt) {
+		if (!un.vtbl)
+			skip = resume_ebs * mtd->eb_size;
+		else if (resume_ebs > UBI_LAYOUT_VOLUME_EBS)
+			skip = (resume_ebs - UBI_LAYOUT_VOLUME_EBS) * ui->leb_size;
+		else
+			skip = 0;
+		if (!journal_skip_input(fd, skip)) {
+			sys_errmsg("cannot skip %lld eraseblocks of \"%s\"", resume_ebs, args.image);
+			goto out_close;
+		}
+		first_eb = resume_eb;
+		written_ebs = resume_ebs;
+	}
+
 	divisor = img_ebs;
-	for (eb = 0; eb < mtd->eb_cnt; eb++) {
+	retry_eb = -1;
+	for (eb = first_eb; eb < mtd->eb_cnt; eb++) {
 		int err, new_len;
 		char buf[mtd->eb_size];
 		long long ec;
 
 		if (!args.quiet && !args.verbose) {
+			logger_flush(); // changed for ofgwrite
 			printf("\r" PROGRAM_NAME ": flashing eraseblock %d -- %2lld %% complete  ",
 			       eb, (long long)(eb + 1) * 100 / divisor);
 			set_step_progress((int)((long long)(eb + 1) * 100 / divisor));
 			fflush(stdout);
 		}
+		telemetry_progress(args.node, (long long)written_ebs * mtd->eb_size, st_size);
 
 		if (si->ec[eb] == EB_BAD) {
 			divisor += 1;
@@ -488,9 +617,13 @@ static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 
 			continue;
 		}
+		telemetry_erase(args.node, 1);
 
 		if (!skip_data_read) {
-			err = read_all(fd, buf, mtd->eb_size);
+			if (un.vtbl) // changed for ofgwrite
+				err = ubinize_peb(ui, &un, fd, written_ebs, buf);
+			else
+				err = read_all(fd, buf, mtd->eb_size);
 			if (err) {
 				sys_errmsg("failed to read eraseblock %d from \"%s\"",
 					   written_ebs, args.image);
@@ -525,6 +658,7 @@ static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 
 		new_len = drop_ffs(mtd, buf, mtd->eb_size);
 
+		telemetry_write(args.node, 1);
 		err = mtd_write(libmtd, mtd, args.node_fd, eb, 0, buf, new_len,
 				NULL, 0, 0);
 		if (err) {
@@ -533,10 +667,14 @@ static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 			if (errno != EIO)
 				goto out_close;
 
-			err = mtd_torture(libmtd, mtd, args.node_fd, eb);
+			/* changed for ofgwrite: a passing eraseblock is written again once */
+			err = eb == retry_eb ? -1 : torture_eraseblock(libmtd, mtd, args.node_fd, eb, args.node);
 			if (err) {
 				if (mark_bad(mtd, si, eb))
 					goto out_close;
+			} else {
+				retry_eb = eb;
+				eb--;
 			}
 
 			/*
@@ -547,17 +685,24 @@ static int flash_image(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 			skip_data_read = 1;
 			continue;
 		}
-		if (++written_ebs >= img_ebs)
+		written_ebs++;
+		journal_progress(args.node, eb + 1, written_ebs); // changed for ofgwrite
+		if (written_ebs >= img_ebs)
 			break;
 	}
+	telemetry_progress(args.node, (long long)written_ebs * mtd->eb_size, st_size);
 
 	if (!args.quiet && !args.verbose)
 		my_printf("\n");
-	close(fd);
+	free(un.vtbl);
+	/* changed for ofgwrite: CRC error of a zip member is known at the end */
+	if (!image_close(fd))
+		return -1;
 	return eb + 1;
 
 out_close:
-	close(fd);
+	free(un.vtbl);
+	image_close(fd);
 	return -1;
 }
 
@@ -572,6 +717,7 @@ static int format(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 	struct ubi_vtbl_record *vtbl;
 	int eb1 = -1, eb2 = -1;
 	long long ec1 = -1, ec2 = -1;
+	int retry_eb = -1; // changed for ofgwrite
 
 	write_size = UBI_EC_HDR_SIZE + mtd->subpage_size - 1;
 	write_size /= mtd->subpage_size;
@@ -585,6 +731,7 @@ static int format(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 		long long ec;
 
 		if (!args.quiet && !args.verbose) {
+			logger_flush(); // changed for ofgwrite
 			printf("\r" PROGRAM_NAME ": formatting eraseblock %d -- %2lld %% complete  ",
 			       eb, (long long)(eb + 1 - start_eb) * 100 / (mtd->eb_cnt - start_eb));
 			set_step_progress((int)((long long)(eb + 1 - start_eb) * 100 / (mtd->eb_cnt - start_eb)));
@@ -620,6 +767,7 @@ static int format(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 				goto out_free;
 			continue;
 		}
+		telemetry_erase(args.node, 1);
 
 		if ((eb1 == -1 || eb2 == -1) && !novtbl) {
 			if (eb1 == -1) {
@@ -639,6 +787,7 @@ static int format(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 			fflush(stdout);
 		}
 
+		telemetry_write(args.node, 1);
 		err = mtd_write(libmtd, mtd, args.node_fd, eb, 0, hdr,
 				write_size, NULL, 0, 0);
 		if (err) {
@@ -654,10 +803,14 @@ static int format(libmtd_t libmtd, const struct mtd_dev_info *mtd,
 				goto out_free;
 			}
 
-			err = mtd_torture(libmtd, mtd, args.node_fd, eb);
+			/* changed for ofgwrite: a passing eraseblock is formatted again once */
+			err = eb == retry_eb ? -1 : torture_eraseblock(libmtd, mtd, args.node_fd, eb, args.node);
 			if (err) {
 				if (mark_bad(mtd, si, eb))
 					goto out_free;
+			} else {
+				retry_eb = eb;
+				eb--;
 			}
 			continue;
 
@@ -822,6 +975,7 @@ int ubiformat_main(int argc, char * const argv[])
 		verbose = 2;
 	else
 		verbose = 1;
+	stats_phase("UBI scan");
 	err = ubi_scan(&mtd, args.node_fd, &si, verbose);
 	if (err) {
 		errmsg("failed to scan mtd%d (%s)", mtd.mtd_num, args.node);
@@ -34,9 +34,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include <libubi.h>
+#include <mtd/ubi-media.h>
+#include <mtd_swab.h>
+#include "ofgwrite.h"
 #include "common.h"
 
 struct args {
@@ -48,6 +52,7 @@ struct args {
 	long long size;
 	long long skip;
 	int use_stdin;
+	int peb_size; /* changed for ofgwrite: input is a UBI image */
 };
 
 static struct args args;
@@ -59,6 +64,8 @@ static const char optionsstr[] =
 "-t, --truncate             truncate volume (wipe it out)\n"
 "-s, --size=<bytes>         bytes to read from input\n"
 "    --skip=<bytes>         leading bytes to skip from input\n"
+"    --peb-size=<bytes>     input is a UBI image with this PEB size,\n"
+"                           write the data of its eraseblocks\n"
 "-h, --help                 print help message\n"
 "-V, --version              print program version";
 
@@ -71,6 +78,7 @@ static const char usage[] =
 static const struct option long_options[] = {
 	/* Order matters for opts w/val=0; see option_index below. */
 	{ .name = "skip",     .has_arg = 1, .flag = NULL, .val = 0 },
+	{ .name = "peb-size", .has_arg = 1, .flag = NULL, .val = 0 }, /* changed for ofgwrite */
 	{ .name = "truncate", .has_arg = 0, .flag = NULL, .val = 't' },
 	{ .name = "help",     .has_arg = 0, .flag = NULL, .val = 'h' },
 	{ .name = "version",  .has_arg = 0, .flag = NULL, .val = 'V' },
@@ -95,6 +103,11 @@ static int parse_opt(int argc, char * const argv[])
 				if (error || args.skip < 0)
 					return errmsg("bad skip: " "\"%s\"", optarg);
 				break;
+			case 1: /* --peb-size */
+				args.peb_size = simple_strtoul(optarg, &error);
+				if (error || args.peb_size <= 0)
+					return errmsg("bad PEB size: " "\"%s\"", optarg);
+				break;
 			}
 			break;
 
@@ -194,27 +207,136 @@ static int ubi_write(int fd, const void *buf, int len)
 	return 0;
 }
 
-static int update_volume(libubi_t libubi, struct ubi_vol_info *vol_info)
-{
-	int err, fd, ifd;
+/*
+ * changed for ofgwrite: the input is read by a thread into one buffer while
+ * the other one is written to the volume, so reading the image and writing
+ * the flash overlap.
+ */
+struct upd_buf {
+	char *mem;
+	char *data;	/* LEB data in mem */
+	int len;	/* 0: end of input, -1: error */
+	int full;
+};
+
+struct upd_pipe {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct upd_buf buf[2];
+	int ifd;
+	int leb_size;
 	long long bytes;
-	char *buf;
+	int stop;
+};
+
+static int read_full(int fd, char *buf, int len)
+{
+	int done = 0;
+
+	while (done < len) {
+		ssize_t ret = read(fd, buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -1 : done;
+		done += ret;
+	}
+	return done;
+}
+
+/* reads the next LEB: from a plain volume image or a PEB of a UBI image */
+static int read_leb(struct upd_pipe *p, struct upd_buf *b, int lnum, long long left)
+{
+	int len = min(p->leb_size, left);
+	struct ubi_ec_hdr *ec;
+	struct ubi_vid_hdr *vid;
+
+	b->data = b->mem;
+	if (!args.peb_size) {
+		if (read_full(p->ifd, b->mem, len) != len)
+			return sys_errmsg("cannot read %d bytes from \"%s\"", len, args.img);
+		return len;
+	}
 
-	buf = malloc(vol_info->leb_size);
-	if (!buf)
-		return errmsg("cannot allocate %d bytes of memory", vol_info->leb_size);
+	if (read_full(p->ifd, b->mem, args.peb_size) != args.peb_size)
+		return sys_errmsg("cannot read PEB %d from \"%s\"", lnum, args.img);
+	ec = (struct ubi_ec_hdr *)b->mem;
+	if (be32_to_cpu(ec->magic) != UBI_EC_HDR_MAGIC
+	 || be32_to_cpu(ec->data_offset) + p->leb_size != args.peb_size
+	 || be32_to_cpu(ec->vid_hdr_offset) + sizeof(*vid) > args.peb_size)
+		return errmsg("bad EC header for LEB %d in \"%s\"", lnum, args.img);
+	vid = (struct ubi_vid_hdr *)(b->mem + be32_to_cpu(ec->vid_hdr_offset));
+	if (be32_to_cpu(vid->magic) != UBI_VID_HDR_MAGIC || be32_to_cpu(vid->lnum) != lnum)
+		return errmsg("LEB %d missing in \"%s\"", lnum, args.img);
+	b->data = b->mem + be32_to_cpu(ec->data_offset);
+	return len;
+}
+
+static void *upd_reader(void *arg)
+{
+	struct upd_pipe *p = arg;
+	long long left = p->bytes;
+	int i = 0, lnum = 0, len;
+
+	for (;;) {
+		struct upd_buf *b = &p->buf[i];
+
+		pthread_mutex_lock(&p->lock);
+		while (b->full && !p->stop)
+			pthread_cond_wait(&p->cond, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+		if (p->stop)
+			break;
+
+		len = left ? read_leb(p, b, lnum, left) : 0;
+		if (len > 0)
+			io_source_read(p->ifd, len);
+
+		pthread_mutex_lock(&p->lock);
+		b->len = len;
+		b->full = 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		if (len <= 0)
+			break;
+		left -= len;
+		lnum += 1;
+		i ^= 1;
+	}
+	return NULL;
+}
+
+static int update_volume(libubi_t libubi, struct ubi_vol_info *vol_info)
+{
+	int err = -1, fd, ifd, i, buf_size;
+	long long bytes, written = 0;
+	struct upd_pipe p;
+	pthread_t reader;
+
+	memset(&p, 0, sizeof(p));
+	buf_size = args.peb_size ? args.peb_size : vol_info->leb_size;
+	for (i = 0; i < 2; i++) {
+		p.buf[i].mem = malloc(buf_size);
+		if (!p.buf[i].mem) {
+			errmsg("cannot allocate %d bytes of memory", buf_size);
+			goto out_free;
+		}
+	}
 
 	if (!args.size) {
 		struct stat st;
-		err = stat(args.img, &st);
+		err = image_stat(args.img, &st); // changed for ofgwrite
 		if (err < 0) {
 			errmsg("stat failed on \"%s\"", args.img);
 			goto out_free;
 		}
 
 		bytes = st.st_size - args.skip;
+		if (args.peb_size)
+			bytes = bytes / args.peb_size * vol_info->leb_size;
 	} else
 		bytes = args.size;
+	err = -1;
 
 	if (bytes > vol_info->rsvd_bytes) {
 		errmsg("\"%s\" (size %lld) will not fit volume \"%s\" (size %lld)",
@@ -235,14 +357,14 @@ static int update_volume(libubi_t libubi, struct ubi_vol_info *vol_info)
 			goto out_close1;
 		}
 	} else {
-		ifd = open(args.img, O_RDONLY);
+		ifd = image_open(args.img); // changed for ofgwrite: image can be in a zip archive
 		if (ifd == -1) {
 			sys_errmsg("cannot open \"%s\"", args.img);
 			goto out_close1;
 		}
 
-		if (args.skip && lseek(ifd, args.skip, SEEK_CUR) == -1) {
-			sys_errmsg("lseek input by %lld failed", args.skip);
+		if (args.skip && !journal_skip_input(ifd, args.skip)) {
+			sys_errmsg("skipping input by %lld failed", args.skip);
 			goto out_close;
 		}
 	}
@@ -253,40 +375,61 @@ static int update_volume(libubi_t libubi, struct ubi_vol_info *vol_info)
 		goto out_close;
 	}
 
-	while (bytes) {
-		ssize_t ret;
-		int to_copy = min(vol_info->leb_size, bytes);
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.cond, NULL);
+	p.ifd = ifd;
+	p.leb_size = vol_info->leb_size;
+	p.bytes = bytes;
+	if (pthread_create(&reader, NULL, upd_reader, &p)) {
+		err = errmsg("cannot start reader thread");
+		goto out_close;
+	}
 
-		ret = read(ifd, buf, to_copy);
-		if (ret <= 0) {
-			if (errno == EINTR) {
-				warnmsg("do not interrupt me!");
-				continue;
-			} else {
-				sys_errmsg("cannot read %d bytes from \"%s\"",
-						to_copy, args.img);
-				goto out_close;
-			}
+	for (i = 0; ; i ^= 1) {
+		struct upd_buf *b = &p.buf[i];
+
+		pthread_mutex_lock(&p.lock);
+		while (!b->full)
+			pthread_cond_wait(&p.cond, &p.lock);
+		pthread_mutex_unlock(&p.lock);
+		if (b->len <= 0) {
+			err = b->len;
+			break;
 		}
 
-		err = ubi_write(fd, buf, ret);
+		err = ubi_write(fd, b->data, b->len);
 		if (err)
-			goto out_close;
-		bytes -= ret;
+			break;
+		written += b->len;
+		set_step_progress((int)(written * 100 / bytes));
+		telemetry_progress(args.node, written, bytes);
+
+		pthread_mutex_lock(&p.lock);
+		b->full = 0;
+		pthread_cond_broadcast(&p.cond);
+		pthread_mutex_unlock(&p.lock);
 	}
 
-	close(ifd);
-	close(fd);
-	free(buf);
-	return 0;
+	pthread_mutex_lock(&p.lock);
+	p.stop = 1;
+	pthread_cond_broadcast(&p.cond);
+	pthread_mutex_unlock(&p.lock);
+	pthread_join(reader, NULL);
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.lock);
 
 out_close:
-	close(ifd);
+	// changed for ofgwrite: CRC error of a zip member is known at the end
+	if (ifd == STDIN_FILENO)
+		close(ifd);
+	else if (!image_close(ifd) && !err)
+		err = -1;
 out_close1:
 	close(fd);
 out_free:
-	free(buf);
-	return -1;
+	free(p.buf[0].mem);
+	free(p.buf[1].mem);
+	return err ? -1 : 0;
 }
 
 int ubiupdatevol_main(int argc, char * const argv[])
@@ -295,6 +438,7 @@ int ubiupdatevol_main(int argc, char * const argv[])
 	libubi_t libubi;
 	struct ubi_vol_info vol_info;
 
+	memset(&args, 0, sizeof(args)); // changed for ofgwrite
 	err = parse_opt(argc, argv);
 	if (err)
 		return -1;
@@ -0,0 +1,495 @@
+#include "ofgwrite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "busybox/include/libbb.h"
+
+/* Image files inside a .zip archive.
+ *
+ * The central directory is indexed once (mmap). Members are addressed as
+ * "<zip file>/<member name>", so all flash backends just get a filename.
+ * They open the files with image_open() and get the size with image_stat():
+ * - small members (kernel, NOR images) are extracted into a memfd, which is
+ *   seekable like a normal file.
+ * - big members (rootfs) are streamed through a pipe by a child process.
+ *   Its CRC check is only known when it exits: image_close() reaps it.
+ * Stored and deflated members are supported.
+ */
+
+#define ZIP_MEMFD_MAX (32 * 1024 * 1024)
+#define ZIP_BUF_SIZE  (128 * 1024)
+#define IMAGE_STREAM_MAX 16
+
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+struct zip_member
+{
+	char* name;
+	int method;
+	unsigned int crc;
+	unsigned long long comp_size;
+	unsigned long long size;
+	unsigned long long header_offset;
+};
+
+// child process which writes into the pipe fd
+struct image_stream
+{
+	int fd;
+	pid_t pid;
+};
+
+static struct image_stream image_streams[IMAGE_STREAM_MAX];
+static int image_stream_cnt = 0;
+
+static char zip_path[4097];
+static struct stat zip_stat;
+static struct zip_member* zip_members = NULL;
+static int zip_member_cnt = 0;
+
+static unsigned int get16(const unsigned char* p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned int get32(const unsigned char* p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+static unsigned long long get64(const unsigned char* p)
+{
+	return get32(p) | (unsigned long long)get32(p + 4) << 32;
+}
+
+static void zip_free()
+{
+	int i;
+
+	for (i = 0; i < zip_member_cnt; i++)
+		free(zip_members[i].name);
+	free(zip_members);
+	zip_members = NULL;
+	zip_member_cnt = 0;
+	zip_path[0] = '\0';
+}
+
+// zip64: real values of the fields which are 0xffffffff are in extra field 1
+static void zip64_extra(const unsigned char* p, unsigned int len, struct zip_member* m)
+{
+	const unsigned char* end = p + len;
+
+	while (p + 4 <= end)
+	{
+		unsigned int id = get16(p), size = get16(p + 2);
+		const unsigned char* v = p + 4;
+		p += 4 + size;
+		if (id != 1 || p > end)
+			continue;
+		if (m->size == 0xffffffff && v + 8 <= p)
+			m->size = get64(v), v += 8;
+		if (m->comp_size == 0xffffffff && v + 8 <= p)
+			m->comp_size = get64(v), v += 8;
+		if (m->header_offset == 0xffffffff && v + 8 <= p)
+			m->header_offset = get64(v);
+	}
+}
+
+// reads the central directory of a zip archive
+int zip_open_image(const char* path)
+{
+	const unsigned char *map, *p, *end, *eocd = NULL;
+	unsigned long long cd_cnt, cd_size, cd_offset, i;
+	int fd;
+
+	zip_free();
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &zip_stat) != 0 || zip_stat.st_size < 22)
+	{
+		my_printf("Error opening zip archive %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	map = mmap(NULL, zip_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		my_printf("Error mapping zip archive %s\n", path);
+		return 0;
+	}
+	end = map + zip_stat.st_size;
+
+	// end of central directory record is at the end, followed by up to 64k comment
+	for (p = end - 22; p >= map && end - p <= 22 + 0xffff; p--)
+		if (get32(p) == 0x06054b50)
+		{
+			eocd = p;
+			break;
+		}
+	if (eocd == NULL)
+	{
+		my_printf("Error: %s is no zip archive\n", path);
+		goto error;
+	}
+	cd_cnt = get16(eocd + 10);
+	cd_size = get32(eocd + 12);
+	cd_offset = get32(eocd + 16);
+	if (eocd - 20 >= map && get32(eocd - 20) == 0x07064b50) // zip64 locator
+	{
+		unsigned long long eocd64 = get64(eocd - 20 + 8);
+		if (eocd64 + 56 <= zip_stat.st_size && get32(map + eocd64) == 0x06064b50)
+		{
+			cd_cnt = get64(map + eocd64 + 32);
+			cd_size = get64(map + eocd64 + 40);
+			cd_offset = get64(map + eocd64 + 48);
+		}
+	}
+	if (cd_offset + cd_size > zip_stat.st_size)
+	{
+		my_printf("Error: central directory of %s is corrupt\n", path);
+		goto error;
+	}
+
+	zip_members = xzalloc((cd_cnt ? cd_cnt : 1) * sizeof(*zip_members));
+	p = map + cd_offset;
+	for (i = 0; i < cd_cnt; i++)
+	{
+		struct zip_member* m = &zip_members[zip_member_cnt];
+		unsigned int name_len, extra_len, comment_len;
+
+		if (p + 46 > end || get32(p) != 0x02014b50)
+		{
+			my_printf("Error: central directory of %s is corrupt\n", path);
+			goto error;
+		}
+		name_len = get16(p + 28);
+		extra_len = get16(p + 30);
+		comment_len = get16(p + 32);
+		if (p + 46 + name_len + extra_len > end)
+		{
+			my_printf("Error: central directory of %s is corrupt\n", path);
+			goto error;
+		}
+
+		// skip directories and encrypted members
+		if (name_len && p[46 + name_len - 1] != '/' && !(get16(p + 8) & 1))
+		{
+			m->name = xstrndup((const char*)p + 46, name_len);
+			m->method = get16(p + 10);
+			m->crc = get32(p + 16);
+			m->comp_size = get32(p + 20);
+			m->size = get32(p + 24);
+			m->header_offset = get32(p + 42);
+			zip64_extra(p + 46 + name_len, extra_len, m);
+			zip_member_cnt++;
+		}
+		p += 46 + name_len + extra_len + comment_len;
+	}
+
+	munmap((void*)map, zip_stat.st_size);
+	strcpy(zip_path, path);
+	my_printf("Found zip archive %s with %d files\n", path, zip_member_cnt);
+	return 1;
+
+error:
+	munmap((void*)map, zip_stat.st_size);
+	zip_free();
+	return 0;
+}
+
+// calls found(dir, name) for each member. dir is "<zip file>/<member directory>/"
+void zip_find_image_files(void (*found)(char* dir, char* name))
+{
+	char dir[4097 + 1000];
+	int i;
+
+	for (i = 0; i < zip_member_cnt; i++)
+	{
+		char* name = zip_members[i].name;
+		char* base = strrchr(name, '/');
+		base = base ? base + 1 : name;
+		if (strlen(zip_path) + strlen(name) + 2 > sizeof(dir) || strlen(base) >= 1000)
+			continue;
+		sprintf(dir, "%s/%.*s", zip_path, (int)(base - name), name);
+		found(dir, base);
+	}
+}
+
+static struct zip_member* zip_find(const char* filename)
+{
+	size_t len = strlen(zip_path);
+	int i;
+
+	if (len == 0 || strncmp(filename, zip_path, len) != 0 || filename[len] != '/')
+		return NULL;
+	for (i = 0; i < zip_member_cnt; i++)
+		if (strcmp(zip_members[i].name, &filename[len + 1]) == 0)
+			return &zip_members[i];
+	return NULL;
+}
+
+// writes the uncompressed member to out_fd
+static int zip_extract(struct zip_member* m, int out_fd)
+{
+	unsigned char header[30];
+	unsigned char* in_buf = NULL;
+	unsigned char* out_buf = NULL;
+	unsigned long long pos, left = m->comp_size, written = 0;
+	unsigned int crc = crc32(0, NULL, 0);
+	z_stream z;
+	int in_fd, z_ret = Z_OK, ret = 0;
+
+	memset(&z, 0, sizeof(z));
+	in_fd = open(zip_path, O_RDONLY);
+	if (in_fd < 0 || pread(in_fd, header, sizeof(header), m->header_offset) != sizeof(header) || get32(header) != 0x04034b50)
+	{
+		my_printf("Error reading %s from %s\n", m->name, zip_path);
+		goto out;
+	}
+	pos = m->header_offset + 30 + get16(header + 26) + get16(header + 28);
+	if (m->method != ZIP_STORED && m->method != ZIP_DEFLATED)
+	{
+		my_printf("Error: compression method %d of %s is not supported\n", m->method, m->name);
+		goto out;
+	}
+	if (m->method == ZIP_DEFLATED && inflateInit2(&z, -MAX_WBITS) != Z_OK)
+		goto out;
+
+	in_buf = xmalloc(ZIP_BUF_SIZE);
+	out_buf = xmalloc(ZIP_BUF_SIZE);
+	while (left > 0 && z_ret != Z_STREAM_END)
+	{
+		ssize_t len = pread(in_fd, in_buf, left > ZIP_BUF_SIZE ? ZIP_BUF_SIZE : left, pos);
+		if (len <= 0)
+		{
+			my_printf("Error reading %s from %s\n", m->name, zip_path);
+			goto out;
+		}
+		pos += len;
+		left -= len;
+
+		if (m->method == ZIP_STORED)
+		{
+			crc = crc32(crc, in_buf, len);
+			written += len;
+			if (full_write(out_fd, in_buf, len) != len)
+				goto write_error;
+			continue;
+		}
+
+		z.next_in = in_buf;
+		z.avail_in = len;
+		while (z.avail_in > 0 && z_ret != Z_STREAM_END)
+		{
+			size_t out_len;
+			z.next_out = out_buf;
+			z.avail_out = ZIP_BUF_SIZE;
+			z_ret = inflate(&z, Z_NO_FLUSH);
+			if (z_ret != Z_OK && z_ret != Z_STREAM_END)
+			{
+				my_printf("Error decompressing %s: %s\n", m->name, z.msg ? z.msg : "corrupt data");
+				goto out;
+			}
+			out_len = ZIP_BUF_SIZE - z.avail_out;
+			crc = crc32(crc, out_buf, out_len);
+			written += out_len;
+			if (full_write(out_fd, out_buf, out_len) != out_len)
+				goto write_error;
+		}
+	}
+
+	if (written != m->size || crc != m->crc)
+		my_printf("Error: %s in %s is corrupt (CRC error)\n", m->name, zip_path);
+	else
+		ret = 1;
+	goto out;
+
+write_error:
+	// reader stopped early (e.g. end of tar archive reached): not an error here
+	if (errno == EPIPE)
+		ret = 1;
+	else
+		my_printf("Error writing %s: %s\n", m->name, strerror(errno));
+out:
+	if (m->method == ZIP_DEFLATED)
+		inflateEnd(&z);
+	if (in_fd >= 0)
+		close(in_fd);
+	free(in_buf);
+	free(out_buf);
+	return ret;
+}
+
+void image_stream_add(int fd, pid_t pid)
+{
+	if (image_stream_cnt < IMAGE_STREAM_MAX)
+	{
+		image_streams[image_stream_cnt].fd = fd;
+		image_streams[image_stream_cnt].pid = pid;
+		image_stream_cnt++;
+	}
+}
+
+// 1 if the child exited successfully or was already reaped by busybox
+static int image_stream_wait(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return 1; // check_errors_in_children() has seen the status
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* close() for image_open(). Returns 0 if the data was corrupt (CRC error of
+ * a zip member, FEC repair failed).
+ */
+int image_close(int fd)
+{
+	int i = 0, ret = 1;
+
+	close(fd);
+	while (i < image_stream_cnt)
+	{
+		if (image_streams[i].fd != fd)
+		{
+			i++;
+			continue;
+		}
+		if (!image_stream_wait(image_streams[i].pid))
+			ret = 0;
+		image_streams[i] = image_streams[--image_stream_cnt];
+	}
+	if (!ret)
+		my_printf("Error: image data is corrupt\n");
+	return ret;
+}
+
+/* Reaps all streams, for image files read by busybox (open_zipped()), which
+ * closes them itself. Returns 0 if one was corrupt.
+ */
+int image_streams_ok()
+{
+	int ret = 1;
+
+	while (image_stream_cnt > 0)
+		if (!image_stream_wait(image_streams[--image_stream_cnt].pid))
+			ret = 0;
+	if (!ret)
+		my_printf("Error: image data is corrupt\n");
+	return ret;
+}
+
+// stat() which also knows members of the zip archive
+int image_stat(const char* filename, struct stat* st)
+{
+	struct zip_member* m = zip_find(filename);
+
+	if (m == NULL)
+		return stat(filename, st);
+	*st = zip_stat; // st_dev is used to find the mount point of the image files
+	st->st_mode = S_IFREG | 0644;
+	st->st_size = m->size;
+	st->st_blocks = (m->size + 511) / 512;
+	return 0;
+}
+
+// open(filename, O_RDONLY) which also knows members of the zip archive
+int image_open(const char* filename)
+{
+	struct zip_member* m = zip_find(filename);
+	int fd, pipe_fd[2];
+	pid_t pid;
+
+	if (m == NULL)
+	{
+		fd = open(filename, O_RDONLY);
+		if (fd >= 0)
+			fd = fec_image_open(filename, fd);
+		if (fd >= 0)
+			io_source_open(fd);
+		return fd;
+	}
+
+	if (m->size <= ZIP_MEMFD_MAX)
+	{
+		fd = memfd_create("ofgwrite-zip", 0);
+		if (fd < 0)
+		{
+			my_printf("Error creating memfd: %s\n", strerror(errno));
+			return -1;
+		}
+		if (!zip_extract(m, fd) || lseek(fd, 0, SEEK_SET) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	if (pipe(pipe_fd) != 0)
+		return -1;
+	pid = fork();
+	switch (pid)
+	{
+	case -1:
+		my_printf("Error fork failed\n");
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		return -1;
+	case 0:
+		close(pipe_fd[0]);
+		signal(SIGPIPE, SIG_IGN);
+		exit(zip_extract(m, pipe_fd[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(pipe_fd[1]);
+	image_stream_add(pipe_fd[0], pid);
+	return pipe_fd[0];
+}
+
+/* Returns a stream which delivers buf and then the rest of fd.
+ * Used if already read data can't be given back by seeking (pipe).
+ */
+int image_unread(int fd, const void* buf, size_t len)
+{
+	int pipe_fd[2], i;
+	pid_t pid;
+
+	if (pipe(pipe_fd) != 0)
+		return -1;
+	pid = fork();
+	switch (pid)
+	{
+	case -1:
+		my_printf("Error fork failed\n");
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		return -1;
+	case 0:
+		close(pipe_fd[0]);
+		signal(SIGPIPE, SIG_IGN);
+		if (full_write(pipe_fd[1], buf, len) != len || bb_copyfd_eof(fd, pipe_fd[1]) < 0)
+			exit(errno == EPIPE ? EXIT_SUCCESS : EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+	close(pipe_fd[1]);
+	close(fd);
+	// the children writing into fd belong to the new stream now
+	for (i = 0; i < image_stream_cnt; i++)
+		if (image_streams[i].fd == fd)
+			image_streams[i].fd = pipe_fd[0];
+	image_stream_add(pipe_fd[0], pid);
+	return pipe_fd[0];
+}